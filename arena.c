@@ -0,0 +1,112 @@
+#include <sys/mman.h>
+
+#include "puzzle.h"
+
+/* A region of memory that one solver carves its grid, pieces, names and
+   index out of.  Reserving room for the next puzzle starts the region over
+   rather than giving it back, so a solver that goes through many puzzles
+   keeps reusing the same pages, already faulted in.  The region only grows
+   when a puzzle needs more than it has.  Regions of huge_threshold bytes
+   or more are asked for in huge pages, or failing that advised to become
+   huge pages, to cut down on TLB misses in big grids. */
+
+void
+arena_init( arena_t *arena, size_t huge_threshold )
+{
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+    arena->huge_threshold = huge_threshold;
+    arena->first_touch = 0;
+}
+
+/* Map a fresh region of size bytes. */
+
+static int
+arena_map( arena_t *arena, size_t size )
+{
+    int huge = (arena->huge_threshold > 0) && (size >= arena->huge_threshold);
+    void *base = MAP_FAILED;
+
+    if (huge)
+    {
+        size = (size + ARENA_HUGE_PAGE - 1) & ~(size_t) (ARENA_HUGE_PAGE - 1);
+#ifdef MAP_HUGETLB
+        base = mmap( NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+#endif
+    }
+    if (base == MAP_FAILED)
+    {
+        base = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if (base == MAP_FAILED)
+        {
+            return 0;
+        }
+#ifdef MADV_HUGEPAGE
+        if (huge)
+        {
+            madvise( base, size, MADV_HUGEPAGE );
+        }
+#endif
+    }
+
+    arena->base = (char *) base;
+    arena->size = size;
+    return 1;
+}
+
+/* Start the arena over with room for at least size bytes.  Everything
+   carved out of it before is gone.  Returns 0 if there isn't the memory. */
+
+int
+arena_reserve( arena_t *arena, size_t size )
+{
+    arena->used = 0;
+    if (size <= arena->size)
+    {
+        return 1;
+    }
+
+    arena_free( arena );
+    return arena_map( arena, size );
+}
+
+/* Carve size bytes out of the arena, aligned for the cache.  Returns NULL
+   if the arena hasn't got that much room left. */
+
+void *
+arena_alloc( arena_t *arena, size_t size )
+{
+    size_t start = (arena->used + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+    if ((arena->base == NULL) || (start > arena->size) || (size > arena->size - start))
+    {
+        return NULL;
+    }
+    arena->used = start + size;
+
+    return arena->base + start;
+}
+
+/* Forget everything carved out of the arena but keep its memory. */
+
+void
+arena_reset( arena_t *arena )
+{
+    arena->used = 0;
+}
+
+/* Give the arena's memory back. */
+
+void
+arena_free( arena_t *arena )
+{
+    if (arena->base != NULL)
+    {
+        munmap( arena->base, arena->size );
+    }
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
@@ -0,0 +1,541 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "puzzle.h"
+
+/* Micro-benchmarks for the solver's hot kernels, each timed on its own
+   rather than as part of a whole solve:
+
+     parse        get_input and get_pieces over the whole puzzle
+     index build  clearing the tab-pair index and entering every piece
+     find index   looking up every cell's piece from its north and west
+                  tabs, as fill_any_dir does going left to right
+     find <kind>  the same lookup by scanning the pieces with each match
+                  kernel, for a sample of the cells
+     claim        claiming and releasing every cell, as fill_any_dir does
+     claim xN     the same with N threads fighting over the same cells
+                  (one per processor unless --threads says otherwise)
+     format       format_rows over the whole solution, names and compact
+
+   "make bench" generates puzzles of a few sizes and runs this over them:
+
+     ./benchmark [--repeats=n] [--threads=n] puzzle ...
+
+   Every kernel is run once to warm up and then repeats times.  For each
+   one the mean time per operation, the spread of the runs (the standard
+   deviation as a percentage of the mean) and the throughput are printed.
+   An operation is a piece or cell, or one lookup for the scanning
+   kernels; MB/s counts the input read, the tabs scanned or the output
+   written. */
+
+#define DEFAULT_REPEATS (7)
+#define MAX_REPEATS (1000)
+
+/* The scanning kernels look up at most this many cells per run. */
+#define SCAN_SAMPLES (256)
+
+#define MAX_CLAIM_THREADS (64)
+
+typedef struct
+{
+    input_t input;
+    arena_t arena;
+    grid_t grid;
+    piece_list_t piece_list;
+    index_t index;
+    match_fn kernel;
+    long samples[SCAN_SAMPLES];
+    int numsamples;
+    char *buffer;
+    size_t output_len;
+    int compact;
+    int numThreads;
+    pthread_barrier_t barrier;
+    double claim_time;
+    long errors;
+} bench_t;
+
+typedef double (*kernel_t)( bench_t *bench );
+
+typedef struct
+{
+    bench_t *bench;
+    int thread_id;
+} claim_arg_t;
+
+static int repeats = DEFAULT_REPEATS;
+
+/* Monotonic time in nanoseconds. */
+
+static double
+now_ns( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Run a kernel and report on it.  Every kernel times its own work and
+   returns how long it took in nanoseconds, so that setting up for a run
+   isn't counted.  ops is the number of operations in one run and bytes the
+   number of bytes it reads or writes (0 if that means nothing). */
+
+static void
+run_kernel( bench_t *bench, const char *name, kernel_t kernel, double ops, double bytes )
+{
+    double times[MAX_REPEATS];
+    double mean = 0.0, spread = 0.0;
+    int run;
+
+    kernel( bench );
+    for (run = 0; run < repeats; run++)
+    {
+        times[run] = kernel( bench );
+        mean += times[run];
+    }
+    mean /= repeats;
+
+    for (run = 0; run < repeats; run++)
+    {
+        spread += (times[run] - mean) * (times[run] - mean);
+    }
+    spread = (repeats > 1) ? sqrt( spread / (repeats - 1) ) : 0.0;
+
+    printf( "  %-14s %12.2f ns/op  +-%6.2f%%  %12.0f ops/s", name, mean / ops,
+            (mean > 0.0) ? 100.0 * spread / mean : 0.0, ops * 1e9 / mean );
+    if (bytes > 0)
+    {
+        printf( "  %10.1f MB/s", bytes * 1e3 / mean );
+    }
+    printf( "\n" );
+}
+
+static double
+kernel_parse( bench_t *bench )
+{
+    double start = now_ns();
+    double stop;
+
+    bench->input.pos = 0;
+    bench->input.end = bench->input.length;
+    if (!get_input( &bench->input, &bench->grid, &bench->piece_list, &bench->arena ) ||
+            !get_pieces( &bench->input, &bench->piece_list ))
+    {
+        bench->errors++;
+    }
+    stop = now_ns();
+
+    return stop - start;
+}
+
+static double
+kernel_index_build( bench_t *bench )
+{
+    double start = now_ns();
+    long i;
+    int k;
+
+    index_clear( &bench->index, 0, 1 );
+    for (i = 0; i < bench->piece_list.numpieces; i++)
+    {
+        for (k = PAIR_NE; k <= PAIR_WN; k++)
+        {
+            index_insert( &bench->index, &bench->piece_list, i, k );
+        }
+    }
+
+    return now_ns() - start;
+}
+
+static double
+kernel_find_index( bench_t *bench )
+{
+    grid_t *grid = &bench->grid;
+    double start = now_ns();
+    cell_t *cell;
+    int row, col;
+
+    for (row = 0; row < grid->numrows; row++)
+    {
+        for (col = 0; col < grid->numcols; col++)
+        {
+            cell = grid_cell( grid, col, row );
+            if (index_find( &bench->index, &bench->piece_list, PAIR_WN,
+                            LOAD_TAB( cell->west ), LOAD_TAB( cell->north ), NULL ) != cell->piece)
+            {
+                bench->errors++;
+            }
+        }
+    }
+
+    return now_ns() - start;
+}
+
+static double
+kernel_find_scan( bench_t *bench )
+{
+    grid_t *grid = &bench->grid;
+    double start = now_ns();
+    int tabs[4] = { NO_PIECE_INDEX, NO_PIECE_INDEX, NO_PIECE_INDEX, NO_PIECE_INDEX };
+    cell_t *cell;
+    long cellnum;
+    int i;
+
+    for (i = 0; i < bench->numsamples; i++)
+    {
+        cellnum = bench->samples[i];
+        cell = grid_cell( grid, cellnum % grid->numcols, cellnum / grid->numcols );
+        tabs[NORTH_TAB] = LOAD_TAB( cell->north );
+        tabs[WEST_TAB] = LOAD_TAB( cell->west );
+        if (bench->kernel( &bench->piece_list, 0, bench->piece_list.numpieces, tabs ) != cell->piece)
+        {
+            bench->errors++;
+        }
+    }
+
+    return now_ns() - start;
+}
+
+static double
+kernel_claim( bench_t *bench )
+{
+    grid_t *grid = &bench->grid;
+    double start = now_ns();
+    cell_t *cell;
+    int row, col;
+
+    for (row = 0; row < grid->numrows; row++)
+    {
+        for (col = 0; col < grid->numcols; col++)
+        {
+            cell = grid_cell( grid, col, row );
+            if (cell_claim( cell ))
+            {
+                cell_release( cell, CELL_EMPTY );
+            }
+        }
+    }
+
+    return now_ns() - start;
+}
+
+/* Every thread sweeps the whole grid in the same order, so that they keep
+   running into each other's claims. */
+
+static void *
+claim_thread( void *arg )
+{
+    claim_arg_t *claim = (claim_arg_t *) arg;
+    bench_t *bench = claim->bench;
+    double start = 0.0;
+
+    pthread_barrier_wait( &bench->barrier );
+    if (claim->thread_id == 0)
+    {
+        start = now_ns();
+    }
+    kernel_claim( bench );
+    pthread_barrier_wait( &bench->barrier );
+    if (claim->thread_id == 0)
+    {
+        bench->claim_time = now_ns() - start;
+    }
+
+    return NULL;
+}
+
+static double
+kernel_claim_threads( bench_t *bench )
+{
+    pthread_t threads[MAX_CLAIM_THREADS];
+    claim_arg_t args[MAX_CLAIM_THREADS];
+    int i;
+
+    pthread_barrier_init( &bench->barrier, NULL, bench->numThreads );
+    for (i = 0; i < bench->numThreads; i++)
+    {
+        args[i].bench = bench;
+        args[i].thread_id = i;
+        pthread_create( &threads[i], NULL, claim_thread, &args[i] );
+    }
+    for (i = 0; i < bench->numThreads; i++)
+    {
+        pthread_join( threads[i], NULL );
+    }
+    pthread_barrier_destroy( &bench->barrier );
+
+    return bench->claim_time;
+}
+
+static double
+kernel_format( bench_t *bench )
+{
+    double start = now_ns();
+
+    bench->output_len = format_rows( &bench->grid, &bench->piece_list, bench->compact, 0,
+                                     bench->grid.numrows, bench->buffer );
+
+    return now_ns() - start;
+}
+
+/* Solve the puzzle one row at a time with the index, so that every cell
+   knows its piece and the lookups can be checked.  Returns 0 if a piece
+   can't be found. */
+
+static int
+solve_rows( bench_t *bench )
+{
+    grid_t *grid = &bench->grid;
+    piece_list_t *piece_list = &bench->piece_list;
+    int tabs[4] = { NO_PIECE_INDEX, NO_PIECE_INDEX, NO_PIECE_INDEX, NO_PIECE_INDEX };
+    cell_t *cell;
+    int found;
+    int row, col;
+
+    for (row = 0; row < grid->numrows; row++)
+    {
+        for (col = 0; col < grid->numcols; col++)
+        {
+            cell = grid_cell( grid, col, row );
+            tabs[NORTH_TAB] = cell->north;
+            tabs[WEST_TAB] = cell->west;
+            if (bench->index.slots != NULL)
+            {
+                found = index_find( &bench->index, piece_list, PAIR_WN,
+                                    tabs[WEST_TAB], tabs[NORTH_TAB], NULL );
+            }
+            else
+            {
+                found = match_scan( piece_list, tabs );
+            }
+            if (found == NO_PIECE_INDEX)
+            {
+                return 0;
+            }
+
+            cell->piece = found;
+            grid_cell( grid, col + 1, row )->west = piece_list->tab[EAST_TAB][found];
+            grid_cell( grid, col, row + 1 )->north = piece_list->tab[SOUTH_TAB][found];
+        }
+    }
+
+    return 1;
+}
+
+/* Run every kernel over the puzzle in path.  Returns 0 if the puzzle
+   can't be read. */
+
+static int
+bench_puzzle( bench_t *bench, const char *path )
+{
+    grid_t *grid = &bench->grid;
+    long numcells;
+    double scanned;
+    char name[32];
+    int fd;
+    int i;
+    int ok = 1;
+    struct
+    {
+        const char *name;
+        match_fn kernel;
+    } kernels[3];
+    int numkernels = 0;
+    const char *best;
+
+    fd = open( path, O_RDONLY );
+    if ((fd < 0) || !input_read( &bench->input, fd ))
+    {
+        perror( path );
+        return 0;
+    }
+    close( fd );
+
+    arena_init( &bench->arena, ARENA_HUGE_THRESHOLD );
+    bench->errors = 0;
+    bench->buffer = NULL;
+
+    /* Parse the puzzle once for the rest of the kernels to use, and once
+       more for every run of the parse kernel. */
+
+    kernel_parse( bench );
+    if (bench->errors > 0)
+    {
+        arena_free( &bench->arena );
+        input_close( &bench->input );
+        return 0;
+    }
+
+    numcells = (long) grid->numcols * grid->numrows;
+    printf( "%s: %d x %d, %ld pieces, %d runs\n", path, grid->numcols, grid->numrows,
+            bench->piece_list.numpieces, repeats );
+    run_kernel( bench, "parse", kernel_parse, numcells, bench->input.length );
+
+    if (!index_borrow( &bench->index, &bench->input ) &&
+            !index_alloc( &bench->index, &bench->piece_list, &bench->arena ))
+    {
+        printf( "  (puzzle is too big to index)\n" );
+    }
+    else
+    {
+        if (!bench->index.borrowed)
+        {
+            run_kernel( bench, "index build", kernel_index_build, numcells, 0 );
+        }
+    }
+
+    if (!solve_rows( bench ))
+    {
+        fprintf( stderr, "%s: couldn't solve the puzzle\n", path );
+        ok = 0;
+    }
+
+    if (ok && (bench->index.slots != NULL))
+    {
+        run_kernel( bench, "find index", kernel_find_index, numcells, 0 );
+    }
+
+    /* Spread the scanning samples evenly over the grid.  The tabs scanned
+       are counted up to the piece found, which is where the kernel stops. */
+
+    if (ok)
+    {
+        bench->numsamples = (numcells < SCAN_SAMPLES) ? numcells : SCAN_SAMPLES;
+        scanned = 0.0;
+        for (i = 0; i < bench->numsamples; i++)
+        {
+            bench->samples[i] = numcells * i / bench->numsamples;
+            scanned += (grid_cell( grid, bench->samples[i] % grid->numcols,
+                                   bench->samples[i] / grid->numcols )->piece + 1) * sizeof( int );
+        }
+
+        kernels[numkernels].name = "scalar";
+        kernels[numkernels++].kernel = match_scalar;
+        best = match_select( 1 );
+        if (strcmp( best, "scalar" ) != 0)
+        {
+            kernels[numkernels].name = "sse2";
+            kernels[numkernels++].kernel = match_sse;
+        }
+        if (strcmp( best, "avx2" ) == 0)
+        {
+            kernels[numkernels].name = "avx2";
+            kernels[numkernels++].kernel = match_avx2;
+        }
+        for (i = 0; i < numkernels; i++)
+        {
+            bench->kernel = kernels[i].kernel;
+            snprintf( name, sizeof( name ), "find %s", kernels[i].name );
+            run_kernel( bench, name, kernel_find_scan, bench->numsamples, scanned );
+        }
+    }
+
+    if (ok)
+    {
+        run_kernel( bench, "claim", kernel_claim, numcells, 0 );
+        if (bench->numThreads > 1)
+        {
+            snprintf( name, sizeof( name ), "claim x%d", bench->numThreads );
+            run_kernel( bench, name, kernel_claim_threads, numcells, 0 );
+        }
+    }
+
+    if (ok)
+    {
+        bench->buffer = (char *) malloc( grid->numrows * ((size_t) grid->numcols * (LABEL_LEN + 1) + 1) );
+        if (bench->buffer == NULL)
+        {
+            fprintf( stderr, "Not enough memory to format the solution\n" );
+            ok = 0;
+        }
+    }
+    if (ok)
+    {
+        bench->compact = 0;
+        kernel_format( bench );
+        run_kernel( bench, "format", kernel_format, numcells, bench->output_len );
+        bench->compact = 1;
+        kernel_format( bench );
+        run_kernel( bench, "format compact", kernel_format, numcells, bench->output_len );
+    }
+
+    if (bench->errors > 0)
+    {
+        fprintf( stderr, "%s: %ld lookups found the wrong piece\n", path, bench->errors );
+        ok = 0;
+    }
+
+    free( bench->buffer );
+    index_free( &bench->index );
+    release_memory( &bench->grid, &bench->piece_list );
+    arena_free( &bench->arena );
+    input_close( &bench->input );
+
+    return ok;
+}
+
+int
+main( int argc, char **argv )
+{
+    bench_t bench;
+    int arg;
+    int return_value = 0;
+
+    bench.numThreads = sysconf( _SC_NPROCESSORS_ONLN );
+    if (bench.numThreads < 1)
+    {
+        bench.numThreads = 1;
+    }
+    if (bench.numThreads > MAX_CLAIM_THREADS)
+    {
+        bench.numThreads = MAX_CLAIM_THREADS;
+    }
+
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (strncmp( argv[arg], "--repeats=", 10 ) == 0)
+        {
+            repeats = atoi( argv[arg] + 10 );
+            if ((repeats < 1) || (repeats > MAX_REPEATS))
+            {
+                fprintf( stderr, "--repeats must be between 1 and %d\n", MAX_REPEATS );
+                return 1;
+            }
+        }
+        else if (strncmp( argv[arg], "--threads=", 10 ) == 0)
+        {
+            bench.numThreads = atoi( argv[arg] + 10 );
+            if ((bench.numThreads < 1) || (bench.numThreads > MAX_CLAIM_THREADS))
+            {
+                fprintf( stderr, "--threads must be between 1 and %d\n", MAX_CLAIM_THREADS );
+                return 1;
+            }
+        }
+    }
+
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (strncmp( argv[arg], "--", 2 ) != 0)
+        {
+            if (!bench_puzzle( &bench, argv[arg] ))
+            {
+                return_value = 1;
+            }
+        }
+    }
+
+    if (argc < 2)
+    {
+        printf( "usage: %s [--repeats=n] [--threads=n] puzzle ...\n", argv[0] );
+        return_value = 1;
+    }
+
+    return return_value;
+}
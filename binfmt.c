@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "binfmt.h"
+
+/* Sections 0-3 of the writer are the north, east, south and west tab
+   arrays; section 4 is the names. */
+
+#define NAME_SECTION (4)
+
+_Static_assert( sizeof( binfmt_header_t ) == 128, "binary puzzle header must be 128 bytes" );
+
+/* Round up to the next section boundary. */
+
+static uint64_t
+align_up( uint64_t offset )
+{
+    return (offset + BINFMT_ALIGN - 1) & ~(uint64_t) (BINFMT_ALIGN - 1);
+}
+
+/* The smallest tab width that holds tabs up to max_tab. */
+
+int
+binfmt_tab_width( int max_tab )
+{
+    if (max_tab < 256)
+    {
+        return 1;
+    }
+    if (max_tab < 65536)
+    {
+        return 2;
+    }
+    return 4;
+}
+
+/* Work out where every section of a puzzle goes.  An index_slots of 0 means
+   the file has no index. */
+
+void
+binfmt_layout( binfmt_header_t *header, uint32_t cols, uint32_t rows,
+               uint32_t tab_width, uint32_t name_width, uint64_t index_slots )
+{
+    uint64_t numpieces = (uint64_t) cols * rows;
+
+    memset( header, 0, sizeof( binfmt_header_t ) );
+    memcpy( header->magic, BINFMT_MAGIC, 4 );
+    header->version = BINFMT_VERSION;
+    header->cols = cols;
+    header->rows = rows;
+    header->tab_width = tab_width;
+    header->name_width = name_width;
+    header->numpieces = numpieces;
+    header->index_slots = index_slots;
+    header->flags = (index_slots > 0) ? BINFMT_HAS_INDEX : 0;
+
+    header->boundary_offset = align_up( sizeof( binfmt_header_t ) );
+    header->tabs_offset = align_up( header->boundary_offset +
+                                    2 * ((uint64_t) cols + rows) * tab_width );
+    header->tab_stride = align_up( numpieces * tab_width );
+    header->names_offset = header->tabs_offset + 4 * header->tab_stride;
+    header->index_offset = align_up( header->names_offset + numpieces * name_width );
+    header->length = header->index_offset + index_slots * sizeof( uint32_t );
+}
+
+/* Make sure a header describes a puzzle that fits in length bytes.  Returns
+   NULL if it does and otherwise says what is wrong. */
+
+const char *
+binfmt_check( const binfmt_header_t *header, size_t length )
+{
+    binfmt_header_t expected;
+
+    if ((length < sizeof( binfmt_header_t )) || (memcmp( header->magic, BINFMT_MAGIC, 4 ) != 0))
+    {
+        return "not a binary puzzle";
+    }
+    if (header->version != BINFMT_VERSION)
+    {
+        return "unsupported binary puzzle version";
+    }
+    if ((header->cols == 0) || (header->rows == 0) ||
+            ((header->tab_width != 1) && (header->tab_width != 2) && (header->tab_width != 4)) ||
+            (header->name_width == 0))
+    {
+        return "bad binary puzzle header";
+    }
+    if ((header->index_slots & (header->index_slots - 1)) != 0)
+    {
+        return "binary puzzle index size is not a power of two";
+    }
+
+    binfmt_layout( &expected, header->cols, header->rows, header->tab_width,
+                   header->name_width, header->index_slots );
+    if ((header->numpieces != expected.numpieces) ||
+            (header->boundary_offset != expected.boundary_offset) ||
+            (header->tabs_offset != expected.tabs_offset) ||
+            (header->tab_stride != expected.tab_stride) ||
+            (header->names_offset != expected.names_offset) ||
+            (header->index_offset != expected.index_offset) ||
+            (header->length != expected.length))
+    {
+        return "bad binary puzzle section layout";
+    }
+    if (header->length > length)
+    {
+        return "binary puzzle is truncated";
+    }
+
+    return NULL;
+}
+
+/* Write bytes at an offset, noting any failure in the writer. */
+
+static void
+write_at( binfmt_writer_t *writer, const void *data, size_t size, uint64_t offset )
+{
+    ssize_t done;
+
+    while (writer->ok && (size > 0))
+    {
+        done = pwrite( writer->fd, data, size, offset );
+        if (done <= 0)
+        {
+            perror( "Error writing the binary puzzle" );
+            writer->ok = 0;
+        }
+        else
+        {
+            data = (const char *) data + done;
+            size -= done;
+            offset += done;
+        }
+    }
+}
+
+/* Where a section's buffered bytes go in the file. */
+
+static uint64_t
+section_offset( binfmt_writer_t *writer, int section )
+{
+    if (section == NAME_SECTION)
+    {
+        return writer->header.names_offset;
+    }
+    return writer->header.tabs_offset + section * writer->header.tab_stride;
+}
+
+static void
+flush_section( binfmt_writer_t *writer, int section )
+{
+    write_at( writer, writer->buffer[section], writer->used[section],
+              section_offset( writer, section ) + writer->flushed[section] );
+    writer->flushed[section] += writer->used[section];
+    writer->used[section] = 0;
+}
+
+/* Start writing a puzzle laid out by binfmt_layout to path ("-" for stdout).
+   Returns 0 on failure. */
+
+int
+binfmt_create( binfmt_writer_t *writer, const char *path, const binfmt_header_t *layout )
+{
+    int i;
+
+    writer->header = *layout;
+    writer->next_piece = 0;
+    writer->ok = 1;
+
+    if (strcmp( path, "-" ) == 0)
+    {
+        writer->fd = 1;
+    }
+    else
+    {
+        writer->fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    }
+    if (writer->fd < 0)
+    {
+        perror( path );
+        return 0;
+    }
+
+    /* Size the file up front so that the gaps between sections are zeros. */
+
+    if (ftruncate( writer->fd, layout->length ) != 0)
+    {
+        fprintf( stderr, "The binary puzzle has to be written to a file\n" );
+        if (writer->fd != 1)
+        {
+            close( writer->fd );
+        }
+        return 0;
+    }
+
+    for (i = 0; i <= NAME_SECTION; i++)
+    {
+        writer->buffer[i] = (unsigned char *) malloc( BINFMT_BUFFER_LEN );
+        writer->used[i] = 0;
+        writer->flushed[i] = 0;
+        if (writer->buffer[i] == NULL)
+        {
+            fprintf( stderr, "Not enough memory to write the binary puzzle\n" );
+            writer->ok = 0;
+        }
+    }
+
+    write_at( writer, &writer->header, sizeof( binfmt_header_t ), 0 );
+
+    if (!writer->ok)
+    {
+        for (i = 0; i <= NAME_SECTION; i++)
+        {
+            free( writer->buffer[i] );
+        }
+        if (writer->fd != 1)
+        {
+            close( writer->fd );
+        }
+    }
+
+    return writer->ok;
+}
+
+/* Store a tab in tab_width bytes. */
+
+static void
+put_tab( unsigned char *to, uint32_t tab_width, int tab )
+{
+    uint32_t value = (uint32_t) tab;
+
+    memcpy( to, &value, tab_width );
+}
+
+void
+binfmt_put_boundaries( binfmt_writer_t *writer, const int *top, const int *bottom,
+                       const int *left, const int *right )
+{
+    uint32_t width = writer->header.tab_width;
+    uint32_t cols = writer->header.cols;
+    uint32_t rows = writer->header.rows;
+    unsigned char *tabs;
+    uint32_t i;
+
+    tabs = (unsigned char *) malloc( 2 * ((size_t) cols + rows) * width );
+    if (tabs == NULL)
+    {
+        fprintf( stderr, "Not enough memory to write the binary puzzle\n" );
+        writer->ok = 0;
+        return;
+    }
+
+    for (i = 0; i < cols; i++)
+    {
+        put_tab( tabs + i * width, width, top[i] );
+        put_tab( tabs + ((size_t) cols + i) * width, width, bottom[i] );
+    }
+    for (i = 0; i < rows; i++)
+    {
+        put_tab( tabs + (2 * (size_t) cols + i) * width, width, left[i] );
+        put_tab( tabs + (2 * (size_t) cols + rows + i) * width, width, right[i] );
+    }
+
+    write_at( writer, tabs, 2 * ((size_t) cols + rows) * width, writer->header.boundary_offset );
+    free( tabs );
+}
+
+/* Add the next piece. */
+
+void
+binfmt_put_piece( binfmt_writer_t *writer, const int tabs[4], const char *name )
+{
+    uint32_t width = writer->header.tab_width;
+    uint32_t name_width = writer->header.name_width;
+    int k;
+
+    if (!writer->ok || (writer->next_piece >= writer->header.numpieces))
+    {
+        writer->ok = 0;
+        return;
+    }
+
+    for (k = 0; k < 4; k++)
+    {
+        if (writer->used[k] + width > BINFMT_BUFFER_LEN)
+        {
+            flush_section( writer, k );
+        }
+        put_tab( writer->buffer[k] + writer->used[k], width, tabs[k] );
+        writer->used[k] += width;
+    }
+
+    if (writer->used[NAME_SECTION] + name_width > BINFMT_BUFFER_LEN)
+    {
+        flush_section( writer, NAME_SECTION );
+    }
+    memset( writer->buffer[NAME_SECTION] + writer->used[NAME_SECTION], 0, name_width );
+    strncpy( (char *) writer->buffer[NAME_SECTION] + writer->used[NAME_SECTION], name, name_width - 1 );
+    writer->used[NAME_SECTION] += name_width;
+
+    writer->next_piece++;
+}
+
+void
+binfmt_put_index( binfmt_writer_t *writer, const uint32_t *slots )
+{
+    write_at( writer, slots, writer->header.index_slots * sizeof( uint32_t ),
+              writer->header.index_offset );
+}
+
+/* Flush whatever is left and close the file.  Returns 0 if anything went
+   wrong along the way or if some pieces were never put. */
+
+int
+binfmt_close( binfmt_writer_t *writer )
+{
+    int i;
+
+    for (i = 0; i <= NAME_SECTION; i++)
+    {
+        if (writer->buffer[i] != NULL)
+        {
+            flush_section( writer, i );
+            free( writer->buffer[i] );
+        }
+    }
+
+    if (writer->ok && (writer->next_piece != writer->header.numpieces))
+    {
+        fprintf( stderr, "Only %llu of %llu pieces were written to the binary puzzle\n",
+                 (unsigned long long) writer->next_piece,
+                 (unsigned long long) writer->header.numpieces );
+        writer->ok = 0;
+    }
+
+    if ((writer->fd != 1) && (close( writer->fd ) != 0))
+    {
+        perror( "Error closing the binary puzzle" );
+        writer->ok = 0;
+    }
+
+    return writer->ok;
+}
@@ -0,0 +1,104 @@
+#ifndef BINFMT_H
+#define BINFMT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* The binary puzzle format.  It holds the same puzzle as the text format,
+   laid out so that the puzzle program can map the file and use it without
+   parsing anything.  All numbers are little-endian and every section starts
+   on a BINFMT_ALIGN byte boundary:
+
+     header      a binfmt_header_t
+     boundaries  top[cols], bottom[cols], left[rows], right[rows]
+     tabs        north[n], east[n], south[n], west[n], one array after the
+                 other, tab_stride bytes apart
+     names       n piece names, each name_width bytes padded out with NULs
+     index       index_slots 32 bit slots of the tab-pair index (optional)
+
+   Boundary and piece tabs are tab_width bytes each: 1, 2 or 4, whichever is
+   the smallest that holds the biggest tab.  The index slots are exactly the
+   puzzle program's in-memory tab-pair index, so they can be used in place;
+   the version number changes if the index hashing ever does. */
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The binary puzzle format assumes a little-endian machine"
+#endif
+
+#define BINFMT_MAGIC "TPZB"
+#define BINFMT_VERSION (1)
+#define BINFMT_ALIGN (64)
+#define BINFMT_HAS_INDEX (1)
+
+/* Some pair of neighbouring tabs is shared by more than one piece, so the
+   index can name several pieces for one pair. */
+#define BINFMT_AMBIGUOUS (2)
+
+/* Pieces are written through buffers of this many bytes per section. */
+#define BINFMT_BUFFER_LEN (1 << 20)
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t cols;
+    uint32_t rows;
+    uint32_t tab_width;
+    uint32_t name_width;
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t numpieces;
+    uint64_t index_slots;
+    uint64_t boundary_offset;
+    uint64_t tabs_offset;
+    uint64_t tab_stride;
+    uint64_t names_offset;
+    uint64_t index_offset;
+    uint64_t length;
+    unsigned char pad[32];
+} binfmt_header_t;
+
+/* Writing a binary puzzle.  The header and boundaries can be written at any
+   time; pieces must be put in order, and the sections are written with
+   pwrite so the output has to be a file rather than a pipe. */
+
+typedef struct
+{
+    int fd;
+    binfmt_header_t header;
+    unsigned char *buffer[5];
+    size_t used[5];
+    uint64_t flushed[5];
+    uint64_t next_piece;
+    int ok;
+} binfmt_writer_t;
+
+/* Read tab i of an array of tab_width byte tabs. */
+
+static inline int
+binfmt_tab( const unsigned char *tabs, uint32_t tab_width, uint64_t i )
+{
+    if (tab_width == 1)
+    {
+        return tabs[i];
+    }
+    if (tab_width == 2)
+    {
+        return ((const uint16_t *) tabs)[i];
+    }
+    return (int) ((const uint32_t *) tabs)[i];
+}
+
+int binfmt_tab_width( int max_tab );
+void binfmt_layout( binfmt_header_t *header, uint32_t cols, uint32_t rows,
+                    uint32_t tab_width, uint32_t name_width, uint64_t index_slots );
+const char *binfmt_check( const binfmt_header_t *header, size_t length );
+
+int binfmt_create( binfmt_writer_t *writer, const char *path, const binfmt_header_t *layout );
+void binfmt_put_boundaries( binfmt_writer_t *writer, const int *top, const int *bottom,
+                            const int *left, const int *right );
+void binfmt_put_piece( binfmt_writer_t *writer, const int tabs[4], const char *name );
+void binfmt_put_index( binfmt_writer_t *writer, const uint32_t *slots );
+int binfmt_close( binfmt_writer_t *writer );
+
+#endif
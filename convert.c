@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "puzzle.h"
+
+/* Convert a text puzzle (like f1 - f4) into the binary puzzle format, so
+   that the puzzle program can map it and skip parsing.  With --index the
+   tab-pair index is built here and stored in the file as well.
+
+     ./convert [--index] output.bin < input
+
+   The input can also be a binary puzzle, which is handy for adding an
+   index to a puzzle that was generated without one. */
+
+int
+main( int argc, char **argv )
+{
+    input_t input;
+    grid_t grid;
+    piece_list_t piece_list;
+    index_t index;
+    arena_t arena;
+    binfmt_header_t layout;
+    binfmt_writer_t writer;
+    int *top, *bottom, *left, *right;
+    int tabs[4];
+    int with_index = 0;
+    int max_tab = 0;
+    size_t name_width = 1;
+    const char *output = NULL;
+    long i;
+    int k;
+    int arg;
+    int return_value = 0;
+
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (strcmp( argv[arg], "--index" ) == 0)
+        {
+            with_index = 1;
+        }
+        else
+        {
+            output = argv[arg];
+        }
+    }
+
+    if (output == NULL)
+    {
+        printf( "usage: %s [--index] output.bin < puzzle\n", argv[0] );
+        return 1;
+    }
+
+    if (!input_read( &input, 0 ))
+    {
+        return 1;
+    }
+    arena_init( &arena, ARENA_HUGE_THRESHOLD );
+    if (!get_input( &input, &grid, &piece_list, &arena ))
+    {
+        arena_free( &arena );
+        input_close( &input );
+        return 1;
+    }
+    if (!get_pieces( &input, &piece_list ))
+    {
+        release_memory( &grid, &piece_list );
+        arena_free( &arena );
+        input_close( &input );
+        return 1;
+    }
+
+    /* Pull the boundaries back out of the grid. */
+
+    top = (int *) malloc( grid.numcols * sizeof( int ) );
+    bottom = (int *) malloc( grid.numcols * sizeof( int ) );
+    left = (int *) malloc( grid.numrows * sizeof( int ) );
+    right = (int *) malloc( grid.numrows * sizeof( int ) );
+    if ((top == NULL) || (bottom == NULL) || (left == NULL) || (right == NULL))
+    {
+        fprintf( stderr, "Not enough memory to convert the puzzle\n" );
+        return_value = 1;
+    }
+
+    for (i = 0; (return_value == 0) && (i < grid.numcols); i++)
+    {
+        top[i] = grid_cell( &grid, i, 0 )->north;
+        bottom[i] = grid_cell( &grid, i, grid.numrows )->north;
+        if (top[i] > max_tab) max_tab = top[i];
+        if (bottom[i] > max_tab) max_tab = bottom[i];
+    }
+    for (i = 0; (return_value == 0) && (i < grid.numrows); i++)
+    {
+        left[i] = grid_cell( &grid, 0, i )->west;
+        right[i] = grid_cell( &grid, grid.numcols, i )->west;
+        if (left[i] > max_tab) max_tab = left[i];
+        if (right[i] > max_tab) max_tab = right[i];
+    }
+
+    /* Size the tabs and names to fit the biggest ones. */
+
+    for (i = 0; i < piece_list.numpieces; i++)
+    {
+        for (k = NORTH_TAB; k <= WEST_TAB; k++)
+        {
+            if (piece_list.tab[k][i] > max_tab)
+            {
+                max_tab = piece_list.tab[k][i];
+            }
+        }
+        if (strnlen( piece_name( &piece_list, i ), LABEL_LEN ) + 1 > name_width)
+        {
+            name_width = strnlen( piece_name( &piece_list, i ), LABEL_LEN ) + 1;
+        }
+    }
+
+    index.slots = NULL;
+    index.mask = 0;
+    index.borrowed = 0;
+    index.ambiguous = 0;
+    index.scan = 0;
+    if ((return_value == 0) && with_index)
+    {
+        if (!index_alloc( &index, &piece_list, &arena ))
+        {
+            fprintf( stderr, "Puzzle is too big to index, writing it without one\n" );
+        }
+        else
+        {
+            index_clear( &index, 0, 1 );
+            for (i = 0; i < piece_list.numpieces; i++)
+            {
+                for (k = PAIR_NE; k <= PAIR_WN; k++)
+                {
+                    index_insert( &index, &piece_list, i, k );
+                }
+            }
+        }
+    }
+
+    if (return_value == 0)
+    {
+        binfmt_layout( &layout, grid.numcols, grid.numrows, binfmt_tab_width( max_tab ),
+                       name_width, (index.slots != NULL) ? index.mask + 1 : 0 );
+        if (index.ambiguous > 0)
+        {
+            layout.flags |= BINFMT_AMBIGUOUS;
+        }
+        if (!binfmt_create( &writer, output, &layout ))
+        {
+            return_value = 1;
+        }
+        else
+        {
+            binfmt_put_boundaries( &writer, top, bottom, left, right );
+            for (i = 0; i < piece_list.numpieces; i++)
+            {
+                for (k = NORTH_TAB; k <= WEST_TAB; k++)
+                {
+                    tabs[k] = piece_list.tab[k][i];
+                }
+                binfmt_put_piece( &writer, tabs, piece_name( &piece_list, i ) );
+            }
+            if (index.slots != NULL)
+            {
+                binfmt_put_index( &writer, index.slots );
+            }
+            if (!binfmt_close( &writer ))
+            {
+                return_value = 1;
+            }
+        }
+    }
+
+    free( top );
+    free( bottom );
+    free( left );
+    free( right );
+    index_free( &index );
+    release_memory( &grid, &piece_list );
+    arena_free( &arena );
+    input_close( &input );
+
+    return return_value;
+}
@@ -1,56 +1,126 @@
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <math.h>
+#include <unistd.h>
+
+#include "binfmt.h"
 
 #define COLMULT (2)
 #define ROWMULT (2)
 #define LABEL_LEN (12)
 
 #define NO_TAB (-1)
-#define MAX_OUT_LINE_LEN (1000)
 #define TMP_STRING_LEN (80)
 
-#define UNUSED (-1)
-#define USED (1)
-
 #define BIGGEST_GRID_TO_PRINT (100)
 
-typedef struct { 
+/* The puzzle is written through a buffer of this many bytes. */
+#define OUT_BUFFER_LEN (1 << 20)
+
+/* The generator only ever holds one row of the puzzle, along with the
+   south tabs of the row above and the four boundaries, so its memory is
+   bounded by the width of the puzzle and the table of used tab sequences
+   rather than by the number of pieces.  The text format starts with the
+   boundaries, which aren't known until the last row, so for text the
+   puzzle is generated twice from the same seed: once for the boundaries
+   and once to write out the pieces.  The binary format can have its
+   boundaries written last, so it only takes the one pass. */
+
+typedef struct {
   int north, east, south, west;
-  char name[LABEL_LEN+1];
 } cell_t;
 
+/* The random numbers come from splitmix64, which is quick and gives the
+   same sequence for the same seed everywhere. */
+
+typedef struct {
+  uint64_t state;
+} rng_t;
+
+static inline uint64_t
+rng_next( rng_t *rng )
+{
+  uint64_t z = (rng->state += 0x9e3779b97f4a7c15ULL);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/* A random number from 0 up to range - 1. */
+
+static inline int
+rng_below( rng_t *rng, int range )
+{
+  return (int) (((rng_next( rng ) >> 32) * (uint64_t) range) >> 32);
+}
+
+/* The tab sequences that pieces already use, one bit for each ordered
+   pair of tab values. */
+
+typedef struct {
+  uint64_t *bits;
+  int range;
+} used_t;
+
+static inline int
+is_used( used_t *used, int first, int second )
+{
+  uint64_t bit = (uint64_t) first * used->range + second;
+
+  return (used->bits[bit >> 6] >> (bit & 63)) & 1;
+}
+
+static inline void
+set_used( used_t *used, int first, int second )
+{
+  uint64_t bit = (uint64_t) first * used->range + second;
+
+  used->bits[bit >> 6] |= 1ULL << (bit & 63);
+}
+
+/* Everything needed to generate the puzzle a row at a time. */
+
+typedef struct {
+  int cols, rows, range;
+  int seed;
+  int rotate;
+  rng_t rng;
+  used_t used;
+  cell_t *row;
+  int *above;
+  int next_top;
+  int *top, *bottom, *left, *right;
+} gen_t;
+
 /* Fill in the tab values for one cell with random tabs while ensuring that
    the sequence of tabs is unique and is consistent with the neighbouring
    cells.  We assume that we're going left-to-right and top-to-bottom
    in the puzzle grid so we're just looking for the east and south tab
-   entries. */
+   entries.  The next cell along starts out with the sequence east,
+   next_north, so that has to be free as well, and mustn't be one of the
+   sequences this cell is about to take. */
 
 void
-set_cell( cell_t *cell, int **used, int range, int next_north )
+set_cell( cell_t *cell, used_t *used, rng_t *rng, int range, int next_north )
 {
   int east;
   int south;
-  int found = 0;
-  int i;
-
-  /* Mark the current cell sequence as used. */
-
-  used[cell->west][cell->north] = USED;
 
   /* Pick an actual number now. */
 
   do {
-    east = random() % range;
-    south = random() % range;
-  } while ( (used[cell->north][east] == USED) ||
-            (used[east][south] == USED) ||
-            (used[south][cell->west] == USED) ||
-            (used[east][next_north] == USED) || 
+    east = rng_below( rng, range );
+    south = rng_below( rng, range );
+  } while ( (south == next_north) ||
             ((east == south) && (cell->west == next_north)) ||
-            (south == next_north)
+            ((cell->north == east) && (east == next_north)) ||
+            is_used( used, cell->north, east ) ||
+            is_used( used, east, south ) ||
+            is_used( used, south, cell->west ) ||
+            is_used( used, east, next_north )
           );
 
   /* Use the east and south values for the cell. */
@@ -61,9 +131,353 @@ set_cell( cell_t *cell, int **used, int range, int next_north )
   /* Inidicate that the new sequences of tabs are no longer available for
      other puzzle pieces. */
 
-  used[cell->north][east] = USED;
-  used[east][south] = USED;
-  used[south][cell->west] = USED;
+  set_used( used, cell->north, east );
+  set_used( used, east, south );
+  set_used( used, south, cell->west );
+}
+
+/* Start generating the puzzle over from the seed. */
+
+void
+gen_start( gen_t *gen )
+{
+  gen->rng.state = (uint64_t) (int64_t) gen->seed;
+  memset( gen->used.bits, 0, ((uint64_t) gen->range * gen->range + 63) / 64 * sizeof( uint64_t ) );
+  gen->next_top = rng_below( &gen->rng, gen->range );
+}
+
+/* Generate row j, which has to follow row j - 1, and note its part of the
+   boundaries. */
+
+void
+gen_row( gen_t *gen, int j )
+{
+  cell_t *row = gen->row;
+  int cols = gen->cols;
+  int next_north;
+  int i;
+
+  for (i = 0; i < cols; i++) {
+
+    /* Get the top and left side of the cell from predecessors. */
+
+    do {
+      if (j == 0) {
+        row[i].north = gen->next_top;
+        gen->next_top = rng_below( &gen->rng, gen->range );
+      } else {
+        row[i].north = gen->above[i];
+      }
+      if (i == 0) {
+        row[0].west = rng_below( &gen->rng, gen->range );
+      } else {
+        row[i].west = row[i-1].east;
+      }
+    } while (is_used( &gen->used, row[i].west, row[i].north ));
+
+    set_used( &gen->used, row[i].west, row[i].north );
+
+    next_north = (j == 0) ? gen->next_top : ((i + 1 < cols) ? gen->above[i+1] : 0);
+    set_cell( &row[i], &gen->used, &gen->rng, gen->range, next_north );
+  }
+
+  for (i = 0; i < cols; i++) {
+    gen->above[i] = row[i].south;
+    if (j == 0) {
+      gen->top[i] = row[i].north;
+    }
+    gen->bottom[i] = row[i].south;
+  }
+  gen->left[j] = row[0].west;
+  gen->right[j] = row[cols-1].east;
+}
+
+/* With --rotate each piece is given a number of quarter turns
+   anticlockwise, which the solver has to undo.  The turn comes from the
+   seed and where the piece goes rather than from the sequence of random
+   numbers, so that the tabs come out the same either way and both passes
+   over a text puzzle turn it alike. */
+
+static int
+piece_turn( gen_t *gen, int i, int j )
+{
+  rng_t rng;
+
+  if (!gen->rotate) {
+    return 0;
+  }
+  rng.state = ((uint64_t) (uint32_t) gen->seed << 32) ^ ((uint64_t) j * gen->cols + i);
+  return rng_below( &rng, 4 );
+}
+
+/* The tabs of a cell's piece as it is written out, north first, turned
+   the piece's way. */
+
+static void
+piece_tabs( gen_t *gen, int i, int j, int tabs[4] )
+{
+  cell_t *cell = &gen->row[i];
+  int actual[4];
+  int turn = piece_turn( gen, i, j );
+  int d;
+
+  actual[0] = cell->north;
+  actual[1] = cell->east;
+  actual[2] = cell->south;
+  actual[3] = cell->west;
+  for (d = 0; d < 4; d++) {
+    tabs[d] = actual[(d + turn) % 4];
+  }
+}
+
+/* Print a row of the solution to check on its validity. */
+
+void
+print_solution_row( gen_t *gen )
+{
+  int i;
+
+  for (i = 0; i < gen->cols; i++) {
+    fprintf( stderr, "  %2d  |", gen->row[i].north );
+  }
+  fprintf( stderr, "\n" );
+  for (i = 0; i < gen->cols; i++) {
+    fprintf( stderr, "%2d  %2d|", gen->row[i].west, gen->row[i].east );
+  }
+  fprintf( stderr, "\n" );
+  for (i = 0; i < gen->cols; i++) {
+    fprintf( stderr, "  %2d  |", gen->row[i].south );
+  }
+  fprintf( stderr, "\n" );
+  for (i = 0; i < gen->cols; i++) {
+    fprintf( stderr, "-------" );
+  }
+  fprintf( stderr, "\n" );
+}
+
+/* Write a number with at least width digits, padded with zeros.  Returns
+   the number of characters written. */
+
+static int
+put_number( char *to, unsigned int number, int width )
+{
+  char digits[16];
+  int k = 0;
+  int len;
+
+  do {
+    digits[k++] = '0' + number % 10;
+    number /= 10;
+  } while (number > 0);
+  while (k < width) {
+    digits[k++] = '0';
+  }
+
+  len = k;
+  while (k > 0) {
+    *to++ = digits[--k];
+  }
+  return len;
+}
+
+/* The name of the piece for column i and row j is colxrow, the numbers
+   padded to width digits so that every name is as long as the others. */
+
+static int
+put_name( char *to, int i, int j, int width )
+{
+  int len;
+
+  len = put_number( to, i, width );
+  to[len++] = 'x';
+  len += put_number( to + len, j, width );
+  to[len] = '\0';
+  return len;
+}
+
+/* Buffered text output on a file descriptor. */
+
+typedef struct {
+  int fd;
+  char *buffer;
+  size_t used;
+  int ok;
+} out_t;
+
+void
+out_flush( out_t *out )
+{
+  size_t done = 0;
+  ssize_t wrote;
+
+  while (out->ok && (done < out->used)) {
+    wrote = write( out->fd, out->buffer + done, out->used - done );
+    if (wrote <= 0) {
+      perror( "Error writing the puzzle" );
+      out->ok = 0;
+    } else {
+      done += wrote;
+    }
+  }
+  out->used = 0;
+}
+
+/* Make sure there are at least len bytes free in the buffer. */
+
+static inline char *
+out_room( out_t *out, size_t len )
+{
+  if (out->used + len > OUT_BUFFER_LEN) {
+    out_flush( out );
+  }
+  return out->buffer + out->used;
+}
+
+static inline void
+out_str( out_t *out, const char *str )
+{
+  size_t len = strlen( str );
+
+  memcpy( out_room( out, len ), str, len );
+  out->used += len;
+}
+
+static inline void
+out_tab( out_t *out, int tab )
+{
+  char *to = out_room( out, 16 );
+  int len = put_number( to, tab, 1 );
+
+  to[len] = ' ';
+  out->used += len + 1;
+}
+
+/* Write one boundary line of tabs. */
+
+void
+out_boundary( out_t *out, const char *label, int *tabs, int count )
+{
+  int i;
+
+  out_str( out, label );
+  for (i = 0; i < count; i++) {
+    out_tab( out, tabs[i] );
+  }
+  out_str( out, "\n" );
+}
+
+/* Write the pieces of the current row, one per line. */
+
+void
+out_row( out_t *out, gen_t *gen, int j, int width )
+{
+  int tabs[4];
+  char *to;
+  int i;
+
+  for (i = 0; i < gen->cols; i++) {
+    piece_tabs( gen, i, j, tabs );
+    to = out_room( out, 2 * LABEL_LEN + 4 * 12 );
+    to += put_name( to, i, j, width );
+    *to++ = ' ';
+    to += put_number( to, tabs[0], 1 );
+    *to++ = ' ';
+    to += put_number( to, tabs[1], 1 );
+    *to++ = ' ';
+    to += put_number( to, tabs[2], 1 );
+    *to++ = ' ';
+    to += put_number( to, tabs[3], 1 );
+    *to++ = '\n';
+    out->used = to - out->buffer;
+  }
+}
+
+/* Generate the puzzle and write it as text on stdout.  Returns 0 if it
+   couldn't be written. */
+
+int
+write_text( gen_t *gen, int width )
+{
+  out_t out;
+  int j;
+
+  out.fd = 1;
+  out.used = 0;
+  out.ok = 1;
+  out.buffer = (char *) malloc( OUT_BUFFER_LEN );
+  if (out.buffer == NULL) {
+    fprintf( stderr, "Not enough memory to write the puzzle\n" );
+    return 0;
+  }
+
+  /* The first pass is only for the boundaries. */
+
+  gen_start( gen );
+  for (j = 0; j < gen->rows; j++) {
+    gen_row( gen, j );
+  }
+
+  /* Print the grid size and the four boundaries. */
+
+  snprintf( out.buffer, OUT_BUFFER_LEN, "%d %d\n", gen->cols, gen->rows );
+  out.used = strlen( out.buffer );
+  out_boundary( &out, "top ", gen->top, gen->cols );
+  out_boundary( &out, "bottom ", gen->bottom, gen->cols );
+  out_boundary( &out, "left ", gen->left, gen->rows );
+  out_boundary( &out, "right ", gen->right, gen->rows );
+
+  /* Print out each piece. */
+
+  gen_start( gen );
+  for (j = 0; j < gen->rows; j++) {
+    gen_row( gen, j );
+    if (gen->cols <= BIGGEST_GRID_TO_PRINT) {
+      print_solution_row( gen );
+    }
+    out_row( &out, gen, j, width );
+  }
+
+  out_flush( &out );
+  free( out.buffer );
+
+  return out.ok;
+}
+
+/* Generate the puzzle and write it in the binary format (see binfmt.h)
+   rather than as text.  Returns 0 if the file couldn't be written. */
+
+int
+write_binary( gen_t *gen, int width, const char *path )
+{
+  binfmt_header_t layout;
+  binfmt_writer_t writer;
+  char name[LABEL_LEN + 1];
+  int tabs[4];
+  int i, j;
+
+  /* Tabs are all below range, and every name is 2 * width + 1 long. */
+
+  binfmt_layout( &layout, gen->cols, gen->rows, binfmt_tab_width( gen->range - 1 ),
+                 2 * width + 2, 0 );
+  if (!binfmt_create( &writer, path, &layout )) {
+    return 0;
+  }
+
+  gen_start( gen );
+  for (j = 0; j < gen->rows; j++) {
+    gen_row( gen, j );
+    if (gen->cols <= BIGGEST_GRID_TO_PRINT) {
+      print_solution_row( gen );
+    }
+    for (i = 0; i < gen->cols; i++) {
+      piece_tabs( gen, i, j, tabs );
+      put_name( name, i, j, width );
+      binfmt_put_piece( &writer, tabs, name );
+    }
+  }
+  binfmt_put_boundaries( &writer, gen->top, gen->bottom, gen->left, gen->right );
+
+  return binfmt_close( &writer );
 }
 
 int
@@ -72,30 +486,25 @@ main( int argc, char ** argv )
   int return_value = 0;
   int rows, cols;
   char line[TMP_STRING_LEN];
-  int **used;
-  int *space;
-  int i, j;
-  cell_t **grid;
-  cell_t *space2;
+  gen_t gen;
   int numrange;
   int seed;
-  int next_top;
-  char top[MAX_OUT_LINE_LEN];
-  char mid[MAX_OUT_LINE_LEN];
-  char bot[MAX_OUT_LINE_LEN];
-  char sep[MAX_OUT_LINE_LEN];
-  char add[TMP_STRING_LEN];
+  int width;
+  int biggest;
+  const char *binary = NULL;
+  int rotate = 0;
+  int arg;
 
 
   if (argc < 4) {
     printf ("enter number of rows\n");
     fgets( line, TMP_STRING_LEN, stdin );
     rows = atoi( line );
-  
+
     printf ("enter number of columns\n");
     fgets( line, TMP_STRING_LEN, stdin );
     cols = atoi( line );
-  
+
     printf ("enter random seed \n");
     fgets( line, TMP_STRING_LEN, stdin );
     seed = atoi( line );
@@ -103,154 +512,79 @@ main( int argc, char ** argv )
     cols = atoi( argv[1] );
     rows = atoi( argv[2] );
     seed = atoi( argv[3] );
-  }
-  srandom( seed );
 
-  numrange  = (rows+1) * (cols+1)/2;
-  numrange  = (int)sqrt(10.0 * (rows+1) * (cols+1));
-  if (numrange < 10) {
-    numrange *= 2;
-  }
-  fprintf (stderr, "cols %d, rows %d, seed %d range %d\n", cols, rows, seed, numrange );
+    /* Optionally write the puzzle in the binary format instead of text,
+       and turn the pieces. */
 
-  /* Make space for the allocated numbers.  Use a trick for allocating 
-     2d arrays.  The trick is to allocate a 1d array for the entire 2d array
-     content and then index each row into this 1d array.  This way, we 
-     have just two calls to malloc and can free all the space with
-     two calls to free. */
-
-  space = (int *) malloc( sizeof(int) * numrange * numrange );
-  if (space != NULL) {
-    used = (int **) malloc( sizeof( int * ) * numrange );
-    for (i = 0; i < numrange; i++) {
-      used[i] = space + i*numrange;
-      for (j = 0; j < numrange; j++) {
-        used[i][j] = UNUSED;
+    for (arg = 4; arg < argc; arg++) {
+      if ((strcmp( argv[arg], "--binary" ) == 0) && (arg + 1 < argc)) {
+        binary = argv[++arg];
+      } else if (strcmp( argv[arg], "--rotate" ) == 0) {
+        rotate = 1;
       }
     }
   }
 
-  space2 = (cell_t *) malloc( sizeof(cell_t) * rows * cols );
-  if (space != NULL) {
-    grid = (cell_t **) malloc( sizeof( cell_t * ) * cols );
-    for (i = 0; i < cols; i++) {
-      grid[i] = space2 + i*rows;
-    }
- 
-    /* Initialize the grid as not having any tab values yet. 
-       For debugging convenience, use the grid coordinates as the
-       cell name. */
- 
-    for (i = 0; i < cols; i++) {
-      for (j = 0; j < rows; j++) {
-        grid[i][j].north = NO_TAB;
-        grid[i][j].east = NO_TAB;
-        grid[i][j].south = NO_TAB;
-        grid[i][j].west = NO_TAB;
-        sprintf( grid[i][j].name, "%02dx%02d", i, j);
-      }
-    }
+  if ((cols < 1) || (rows < 1)) {
+    fprintf (stderr, "The puzzle needs at least one column and one row\n");
+    return 1;
   }
 
-  if ((space != NULL) && (space2 != NULL)) {
-
-    /* Fill in the cells now. */
-
-    next_top = random() % numrange;
-
-    for (j = 0; j < rows; j++) {
-      for (i = 0; i < cols; i++) {
-
-        /* Get the top and left side of the cell from predecessors. */
-
-        do {
-          if (j == 0) {
-            grid[i][0].north = next_top;
-            next_top = random() % numrange;
-          } else {
-            grid[i][j].north = grid[i][j-1].south;
-          }
-          if (i == 0) {
-            grid[0][j].west = random() % numrange;
-          } else {
-            grid[i][j].west = grid[i-1][j].east;
-          }
-        } while ( used[grid[i][j].west][grid[i][j].north] == USED);
-  
-        used[grid[i][j].west][grid[i][j].north] = USED;
-  
-        set_cell( &(grid[i][j]), used, numrange, (j == 0 ? next_top: (i+1 < cols ? grid[i+1][j-1].south : 0)) );
-      }
-    }
-
-    /* Strcat can't handle strings that are too long. */
-
-    if (cols <= BIGGEST_GRID_TO_PRINT) {
-      /* Print out the grid solution to check on its validity. */
-  
-      for (j = 0; j < rows; j++) {
-        top[0] = '\0'; mid[0] = '\0'; bot[0] = '\0'; sep[0]='\0';
-        for (i = 0; i < cols; i++) {
-          sprintf( add, "  %2d  |", grid[i][j].north );
-          strcat( top, add );
-          sprintf( add, "%2d  %2d|", grid[i][j].west, grid[i][j].east );
-          strcat( mid, add );
-          sprintf( add, "  %2d  |", grid[i][j].south );
-          strcat( bot, add );
-          sprintf( add, "-------" );
-          strcat( sep, add );
-        }
-        fprintf (stderr, "%s\n%s\n%s\n%s\n", top, mid, bot, sep);
-      }
-    }
-
-    /* Print the grid size and the four boundaries. */
-
-    printf ("%d %d\n", cols, rows );
+  numrange  = (int)sqrt(10.0 * (rows+1) * (cols+1));
+  if (numrange < 10) {
+    numrange *= 2;
+  }
+  fprintf (stderr, "cols %d, rows %d, seed %d range %d\n", cols, rows, seed, numrange );
 
-    printf ("top ");
-    for (i = 0; i < cols; i++) {
-      printf ("%d ", grid[i][0].north );
-    }
-    printf ("\n");
-  
-    printf ("bottom ");
-    for (i = 0; i < cols; i++) {
-      printf ("%d ", grid[i][rows-1].south );
-    }
-    printf ("\n");
+  /* Piece names are colxrow, with both numbers as wide as the biggest. */
 
-    printf ("left ");
-    for (j = 0; j < rows; j++) {
-      printf ("%d ", grid[0][j].west );
-    }
-    printf ("\n");
+  biggest = (cols > rows ? cols : rows) - 1;
+  for (width = 1; biggest >= 10; biggest /= 10) {
+    width++;
+  }
+  if (width < 2) {
+    width = 2;
+  }
+  if (2 * width + 1 > LABEL_LEN) {
+    fprintf (stderr, "The puzzle is too big to name its pieces in %d characters\n", LABEL_LEN);
+    return 1;
+  }
 
-    printf ("right ");
-    for (j = 0; j < rows; j++) {
-      printf ("%d ", grid[cols-1][j].east );
+  gen.cols = cols;
+  gen.rows = rows;
+  gen.range = numrange;
+  gen.seed = seed;
+  gen.rotate = rotate;
+  gen.used.range = numrange;
+  gen.used.bits = (uint64_t *) malloc( ((uint64_t) numrange * numrange + 63) / 64 * sizeof( uint64_t ) );
+  gen.row = (cell_t *) malloc( sizeof(cell_t) * cols );
+  gen.above = (int *) malloc( sizeof(int) * cols );
+  gen.top = (int *) malloc( sizeof(int) * cols );
+  gen.bottom = (int *) malloc( sizeof(int) * cols );
+  gen.left = (int *) malloc( sizeof(int) * rows );
+  gen.right = (int *) malloc( sizeof(int) * rows );
+
+  if ((gen.used.bits == NULL) || (gen.row == NULL) || (gen.above == NULL) ||
+      (gen.top == NULL) || (gen.bottom == NULL) || (gen.left == NULL) || (gen.right == NULL)) {
+    fprintf (stderr, "Not enough memory to generate the puzzle\n");
+    return_value = 1;
+  } else if (binary != NULL) {
+    if (!write_binary( &gen, width, binary )) {
+      return_value = 1;
     }
-    printf ("\n");
-
-    /* Print out each piece. */
-
-    for (j = 0; j < rows; j++) {
-      for (i = 0; i < cols; i++) {
-        printf ("%s %d %d %d %d\n",
-           grid[i][j].name,
-           grid[i][j].north,
-           grid[i][j].east,
-           grid[i][j].south,
-           grid[i][j].west );
-      }
+  } else {
+    if (!write_text( &gen, width )) {
+      return_value = 1;
     }
-
-    free( space );
-    free( used );
-    free( space2 );
-    free( grid );
   }
 
+  free( gen.used.bits );
+  free( gen.row );
+  free( gen.above );
+  free( gen.top );
+  free( gen.bottom );
+  free( gen.left );
+  free( gen.right );
+
   return return_value;
 }
-
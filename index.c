@@ -0,0 +1,339 @@
+#include <string.h>
+
+#include "puzzle.h"
+
+/* Spread a tab pair over the index slots. */
+
+size_t
+index_hash( int kind, int first, int second )
+{
+    unsigned long long key;
+
+    key = ((unsigned long long) (unsigned int) first << 32) | (unsigned int) second;
+    key ^= (unsigned long long) kind << 62;
+    key *= 0x9e3779b97f4a7c15ULL;
+    key ^= key >> 29;
+    return (size_t) key;
+}
+
+/* How many slots the index of numpieces pieces has.  The table is kept at
+   most three quarters full. */
+
+size_t
+index_capacity( long numpieces )
+{
+    size_t capacity = 1;
+    size_t needed = (size_t) numpieces * 4 * 4 / 3 + 1;
+
+    while (capacity < needed)
+    {
+        capacity <<= 1;
+    }
+
+    return capacity;
+}
+
+/* Make room for the index in the arena.  Returns 0 if the puzzle is too big
+   to index, in which case the solver falls back to scanning the pieces. */
+
+int
+index_alloc( index_t *index, piece_list_t *piece_list, arena_t *arena )
+{
+    size_t capacity = index_capacity( piece_list->numpieces );
+
+    index->slots = NULL;
+    index->mask = 0;
+    index->borrowed = 0;
+    index->ambiguous = 0;
+    index->scan = 0;
+
+    if ((unsigned int) piece_list->numpieces >= INDEX_PIECE_MASK)
+    {
+        return 0;
+    }
+
+    index->slots = (unsigned int *) arena_alloc( arena, capacity * sizeof( unsigned int ) );
+    if (index->slots == NULL)
+    {
+        return 0;
+    }
+    index->mask = capacity - 1;
+
+    return 1;
+}
+
+/* Each thread clears its share of the slots before any piece goes in. */
+
+void
+index_clear( index_t *index, int thread_id, int numThreads )
+{
+    size_t capacity = index->mask + 1;
+    size_t first, last;
+
+    first = capacity * thread_id / numThreads;
+    last = capacity * (thread_id + 1) / numThreads;
+    memset( index->slots + first, 0xff, (last - first) * sizeof( unsigned int ) );
+}
+
+/* Use the index that came with a binary puzzle, if it has one.  Returns 0
+   if it doesn't. */
+
+int
+index_borrow( index_t *index, input_t *input )
+{
+    const binfmt_header_t *header = input->binary;
+
+    if ((header == NULL) || !(header->flags & BINFMT_HAS_INDEX) ||
+            (header->index_slots < (uint64_t) header->numpieces * 4 + 1))
+    {
+        return 0;
+    }
+
+    index->slots = (unsigned int *) (input->data + header->index_offset);
+    index->mask = header->index_slots - 1;
+    index->borrowed = 1;
+    index->ambiguous = (header->flags & BINFMT_AMBIGUOUS) != 0;
+    index->empty = 0;
+    index->scan = 0;
+
+    return 1;
+}
+
+/* Enter one tab pair of a piece.  Slots are claimed with a compare and swap
+   so the threads can fill the table together without locking, and the
+   piece's tabs are published with it, so that it can be looked up while
+   other pieces are still going in.  A piece whose pair is already in the
+   index passes over the other piece's slot on the way to its own, so that
+   is where pairs shared by more than one piece are counted.  Rotated
+   pieces share a pair whatever kinds it has on each, though a piece that
+   has the same pair twice only looks the same turned half way round. */
+
+void
+index_insert( index_t *index, piece_list_t *piece_list, long piece, int kind )
+{
+    unsigned int expected;
+    unsigned int value = ((unsigned int) kind << INDEX_KIND_SHIFT) | (unsigned int) piece;
+    unsigned int seen;
+    int first = piece_list->tab[kind][piece];
+    int second = piece_list->tab[(kind + 1) % 4][piece];
+    int shared = 0;
+    int other_kind;
+    size_t slot;
+    long other;
+
+    slot = index_hash( piece_list->rotated ? PAIR_NE : kind, first, second ) & index->mask;
+    do
+    {
+        while ((seen = __atomic_load_n( &index->slots[slot], __ATOMIC_ACQUIRE )) != INDEX_EMPTY)
+        {
+            other = seen & INDEX_PIECE_MASK;
+            other_kind = (int) (seen >> INDEX_KIND_SHIFT);
+            if (((other_kind == kind) || piece_list->rotated) && (other != piece) &&
+                    (piece_list->tab[other_kind][other] == first) &&
+                    (piece_list->tab[(other_kind + 1) % 4][other] == second))
+            {
+                shared = 1;
+            }
+            slot = (slot + 1) & index->mask;
+        }
+        expected = INDEX_EMPTY;
+    }
+    while (!__atomic_compare_exchange_n( &index->slots[slot], &expected, value, 0,
+                                         __ATOMIC_RELEASE, __ATOMIC_RELAXED ));
+
+    if (shared)
+    {
+        __atomic_fetch_add( &index->ambiguous, 1, __ATOMIC_RELAXED );
+    }
+}
+
+/* Where the search for a tab pair starts, for index_next. */
+
+size_t
+index_start( index_t *index, int kind, int first, int second )
+{
+    return index_hash( kind, first, second ) & index->mask;
+}
+
+/* Find the pieces with a pair of tabs one after another, when more than
+   one piece can have it.  slot starts out from index_start and is left
+   just past the piece found.  Returns NO_PIECE_INDEX when there are no
+   more. */
+
+int
+index_next( index_t *index, piece_list_t *piece_list, int kind, int first, int second,
+            size_t *slot, long *compared )
+{
+    unsigned int value;
+    long piece;
+
+    while ((value = __atomic_load_n( &index->slots[*slot], __ATOMIC_ACQUIRE )) != INDEX_EMPTY)
+    {
+        *slot = (*slot + 1) & index->mask;
+        if ((int) (value >> INDEX_KIND_SHIFT) == kind)
+        {
+            piece = value & INDEX_PIECE_MASK;
+            (*compared)++;
+            if ((piece_list->tab[kind][piece] == first) &&
+                    (piece_list->tab[(kind + 1) % 4][piece] == second))
+            {
+                return (int) piece;
+            }
+        }
+    }
+
+    return NO_PIECE_INDEX;
+}
+
+/* Find the piece whose tabs of the given pair kind are first and second.
+   If compared isn't NULL, the number of pieces whose tabs were compared
+   is added to it. */
+
+int
+index_find( index_t *index, piece_list_t *piece_list, int kind, int first, int second,
+            long *compared )
+{
+    size_t slot;
+    unsigned int value;
+    long piece;
+    long count = 0;
+    int found = NO_PIECE_INDEX;
+
+    slot = index_hash( kind, first, second ) & index->mask;
+    while ((value = __atomic_load_n( &index->slots[slot], __ATOMIC_ACQUIRE )) != INDEX_EMPTY)
+    {
+        if ((int) (value >> INDEX_KIND_SHIFT) == kind)
+        {
+            piece = value & INDEX_PIECE_MASK;
+            count++;
+            if ((piece_list->tab[kind][piece] == first) &&
+                    (piece_list->tab[(kind + 1) % 4][piece] == second))
+            {
+                found = value & INDEX_PIECE_MASK;
+                break;
+            }
+        }
+        slot = (slot + 1) & index->mask;
+    }
+
+    if (compared != NULL)
+    {
+        *compared += count;
+    }
+
+    return found;
+}
+
+/* Find the rotated piece with the given pair of neighbouring tabs, going
+   clockwise, and turn it so that they face the pair kind asked for.
+   Returns the piece as placed (see PLACED), or NO_PIECE_INDEX. */
+
+int
+index_find_turned( index_t *index, piece_list_t *piece_list, int kind, int first, int second,
+                   long *compared )
+{
+    size_t slot;
+    unsigned int value;
+    long piece;
+    long count = 0;
+    int found = NO_PIECE_INDEX;
+    int was;
+
+    slot = index_hash( PAIR_NE, first, second ) & index->mask;
+    while ((value = __atomic_load_n( &index->slots[slot], __ATOMIC_ACQUIRE )) != INDEX_EMPTY)
+    {
+        piece = value & INDEX_PIECE_MASK;
+        was = (int) (value >> INDEX_KIND_SHIFT);
+        count++;
+        if ((piece_list->tab[was][piece] == first) &&
+                (piece_list->tab[(was + 1) % 4][piece] == second))
+        {
+            found = PLACED( piece, (kind - was) & 3 );
+            break;
+        }
+        slot = (slot + 1) & index->mask;
+    }
+
+    if (compared != NULL)
+    {
+        *compared += count;
+    }
+
+    return found;
+}
+
+/* Find a piece by a tab pair through a binary puzzle's own index, reading
+   the tabs of the pieces it probes straight out of the mapped file at
+   whatever width they have, so that nothing of the puzzle has to be loaded.
+   The index isn't checked first, so a slot naming a piece past the end of
+   the puzzle is passed over, and the search gives up once it has been
+   round every slot. */
+
+int
+index_find_binary( index_t *index, const binfmt_header_t *header, int kind, int first,
+                   int second )
+{
+    const unsigned char *tabs = (const unsigned char *) header + header->tabs_offset;
+    size_t slot;
+    size_t probes;
+    unsigned int value;
+    uint64_t piece;
+
+    slot = index_hash( kind, first, second ) & index->mask;
+    for (probes = 0; (probes <= index->mask) && ((value = index->slots[slot]) != INDEX_EMPTY); probes++)
+    {
+        piece = value & INDEX_PIECE_MASK;
+        if (((int) (value >> INDEX_KIND_SHIFT) == kind) && (piece < header->numpieces) &&
+                (binfmt_tab( tabs + kind * header->tab_stride, header->tab_width, piece ) == first) &&
+                (binfmt_tab( tabs + ((kind + 1) % 4) * header->tab_stride, header->tab_width,
+                             piece ) == second))
+        {
+            return (int) piece;
+        }
+        slot = (slot + 1) & index->mask;
+    }
+
+    return NO_PIECE_INDEX;
+}
+
+/* Make sure that every slot in a thread's share of a borrowed index names a
+   real piece, so that a damaged file can't send a lookup astray, and add
+   the share's empty slots to the index's count of them.  Lookups only stop
+   at an empty slot, so once every thread is done the index is only any
+   good if that count isn't 0.  Returns 0 if a slot is bad. */
+
+int
+index_check( index_t *index, piece_list_t *piece_list, int thread_id, int numThreads )
+{
+    size_t capacity = index->mask + 1;
+    size_t first = capacity * thread_id / numThreads;
+    size_t last = capacity * (thread_id + 1) / numThreads;
+    size_t slot;
+    unsigned int value;
+    long empty = 0;
+
+    for (slot = first; slot < last; slot++)
+    {
+        value = index->slots[slot];
+        if (value == INDEX_EMPTY)
+        {
+            empty++;
+        }
+        else if ((value & INDEX_PIECE_MASK) >= (unsigned long) piece_list->numpieces)
+        {
+            return 0;
+        }
+    }
+    __atomic_fetch_add( &index->empty, empty, __ATOMIC_RELAXED );
+
+    return 1;
+}
+
+/* The slots belong to the arena or to the input, so there is nothing to
+   free; they go when the arena is reset. */
+
+void
+index_free( index_t *index )
+{
+    index->slots = NULL;
+}
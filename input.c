@@ -0,0 +1,793 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "puzzle.h"
+
+/* Let go of the grid and pieces that get_input made.  Their memory belongs
+   to the arena they came from, and is reused when the arena is reserved
+   for the next puzzle. */
+
+void
+release_memory( grid_t *grid, piece_list_t *piece_list )
+{
+    /* Get rid of all the pieces. */
+
+    piece_list->tab_space = NULL;
+    piece_list->name_space = NULL;
+
+    /* Get rid of the puzzle grid. */
+
+    grid->cells = NULL;
+    grid->edges = NULL;
+}
+
+/* Get the whole of the input from a file descriptor.  A regular file is
+   mapped straight into memory; anything else is read in big blocks.
+   Returns 0 if the input can't be read. */
+
+int
+input_read( input_t *input, int fd )
+{
+    struct stat info;
+    size_t size;
+    ssize_t got;
+    char *bigger;
+
+    input->data = NULL;
+    input->length = 0;
+    input->pos = 0;
+    input->end = 0;
+    input->mapped = 0;
+    input->binary = NULL;
+
+    if ((fstat( fd, &info ) == 0) && S_ISREG( info.st_mode ) && (info.st_size > 0))
+    {
+        input->data = (char *) mmap( NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if (input->data != MAP_FAILED)
+        {
+            madvise( input->data, info.st_size, MADV_SEQUENTIAL );
+            input->length = info.st_size;
+            input->end = info.st_size;
+            input->mapped = 1;
+            return 1;
+        }
+        input->data = NULL;
+    }
+
+    size = READ_BLOCK_LEN;
+    input->data = (char *) malloc( size );
+    while (input->data != NULL)
+    {
+        if (input->length == size)
+        {
+            size *= 2;
+            bigger = (char *) realloc( input->data, size );
+            if (bigger == NULL)
+            {
+                break;
+            }
+            input->data = bigger;
+        }
+
+        got = read( fd, input->data + input->length, size - input->length );
+        if (got == 0)
+        {
+            input->end = input->length;
+            return 1;
+        }
+        if (got < 0)
+        {
+            perror( "Error reading the puzzle" );
+            break;
+        }
+        input->length += got;
+    }
+
+    free( input->data );
+    input->data = NULL;
+    fprintf( stderr, "Not enough memory to read the puzzle\n" );
+    return 0;
+}
+
+void
+input_close( input_t *input )
+{
+    if (input->mapped)
+    {
+        munmap( input->data, input->length );
+    }
+    else
+    {
+        free( input->data );
+    }
+    input->data = NULL;
+}
+
+/* Say where the input went wrong.  Line numbers are only worked out here,
+   so the scanner doesn't have to count lines as it goes. */
+
+void
+input_error( input_t *input, const char *expected )
+{
+    long line = 1;
+    size_t i;
+
+    for (i = 0; i < input->pos && i < input->length; i++)
+    {
+        if (input->data[i] == '\n')
+        {
+            line++;
+        }
+    }
+
+    if ((input->pos >= input->length) && (input->end == input->length))
+    {
+        fprintf( stderr, "Error in puzzle input: expected %s on line %ld but the input ended\n",
+                 expected, line );
+    }
+    else
+    {
+        fprintf( stderr, "Error in puzzle input: expected %s on line %ld\n", expected, line );
+    }
+}
+
+/* A small hand-written scanner over the input.  Numbers and words are
+   separated by any amount of white space, so there's no limit on how long
+   a line can be. */
+
+void
+scan_space( input_t *input )
+{
+    while ((input->pos < input->end) &&
+            ((input->data[input->pos] == ' ') || (input->data[input->pos] == '\n') ||
+             (input->data[input->pos] == '\t') || (input->data[input->pos] == '\r')))
+    {
+        input->pos++;
+    }
+}
+
+/* Read a non-negative number.  Returns 0 if there isn't one. */
+
+int
+scan_int( input_t *input, int *value )
+{
+    long number = 0;
+    size_t start;
+
+    scan_space( input );
+    start = input->pos;
+    while ((input->pos < input->end) &&
+            (input->data[input->pos] >= '0') && (input->data[input->pos] <= '9'))
+    {
+        number = number * 10 + (input->data[input->pos] - '0');
+        if (number > INT_MAX)
+        {
+            input->pos = start;
+            return 0;
+        }
+        input->pos++;
+    }
+
+    *value = (int) number;
+    return input->pos > start;
+}
+
+/* Read a word into name, which holds up to max_len characters.  Returns 0
+   if there is no word or it is too long. */
+
+int
+scan_word( input_t *input, char *name, size_t max_len )
+{
+    size_t start;
+    char c;
+
+    scan_space( input );
+    start = input->pos;
+    while (input->pos < input->end)
+    {
+        c = input->data[input->pos];
+        if ((c == ' ') || (c == '\n') || (c == '\t') || (c == '\r'))
+        {
+            break;
+        }
+        input->pos++;
+    }
+
+    if ((input->pos == start) || (input->pos - start > max_len))
+    {
+        input->pos = start;
+        return 0;
+    }
+
+    memcpy( name, input->data + start, input->pos - start );
+    name[input->pos - start] = '\0';
+    return 1;
+}
+
+/* Check for the word that starts a boundary line. */
+
+int
+scan_label( input_t *input, const char *label )
+{
+    char word[LABEL_LEN + 1];
+
+    if (!scan_word( input, word, LABEL_LEN ) || (strcmp( word, label ) != 0))
+    {
+        input_error( input, label );
+        return 0;
+    }
+
+    return 1;
+}
+
+/* Read a tab value. */
+
+int
+scan_tab( input_t *input, int *tab )
+{
+    if (!scan_int( input, tab ))
+    {
+        input_error( input, "a tab value" );
+        return 0;
+    }
+
+    return 1;
+}
+
+/* Make room for a cols x rows grid and its pieces in the arena, leaving
+   room for the index as well.  The piece tabs and names are only allocated
+   when they won't be used in place (own_tabs and own_names).  Returns 0 if
+   the puzzle is too big. */
+
+int
+grid_alloc( grid_t *grid, piece_list_t *piece_list, arena_t *arena, int cols, int rows,
+            int own_tabs, int own_names )
+{
+    cell_t *space;
+    size_t numcells;
+    size_t tab_bytes, name_bytes, index_bytes, edge_bytes;
+    long i;
+    int k;
+
+    grid->numcols = cols;
+    grid->numrows = rows;
+    grid->cells = NULL;
+    grid->edges = NULL;
+    piece_list->tab_space = NULL;
+    piece_list->name_space = NULL;
+    piece_list->rotated = 0;
+
+    piece_list->numpieces = (long) rows * cols;
+    if (piece_list->numpieces >= MAX_PIECES)
+    {
+        fprintf( stderr, "Error in puzzle input: %d x %d is too many pieces\n", cols, rows );
+        return 0;
+    }
+
+    /* The grid is stored a tile at a time (see grid_cell), with room for
+       the boundary row and column rounded up to whole tiles. */
+
+    grid->tile_cols = ((size_t) cols + GRID_TILE) >> GRID_TILE_SHIFT;
+    numcells = grid->tile_cols * ((((size_t) rows + GRID_TILE) >> GRID_TILE_SHIFT)
+                                  << (2 * GRID_TILE_SHIFT));
+    tab_bytes = own_tabs ? 4 * piece_list->numpieces * sizeof( int ) : 0;
+    name_bytes = own_names ? piece_list->numpieces * (LABEL_LEN + 1) : 0;
+    index_bytes = index_capacity( piece_list->numpieces ) * sizeof( unsigned int );
+
+    edge_bytes = arena->first_touch ? 2 * ((size_t) cols + rows) * sizeof( int ) : 0;
+
+    if (!arena_reserve( arena, numcells * sizeof( cell_t ) + tab_bytes + name_bytes +
+                        index_bytes + edge_bytes + 5 * ARENA_ALIGN ))
+    {
+        fprintf( stderr, "Not enough memory for a %d x %d puzzle\n", cols, rows );
+        return 0;
+    }
+
+    space = (cell_t *) arena_alloc( arena, numcells * sizeof( cell_t ) );
+    if (own_tabs)
+    {
+        piece_list->tab_space = (int *) arena_alloc( arena, tab_bytes );
+    }
+    if (own_names)
+    {
+        piece_list->name_space = (char *) arena_alloc( arena, name_bytes );
+    }
+
+    for (k = NORTH_TAB; own_tabs && (k <= WEST_TAB); k++)
+    {
+        piece_list->tab[k] = piece_list->tab_space + k * piece_list->numpieces;
+    }
+    if (own_names)
+    {
+        piece_list->names = piece_list->name_space;
+        piece_list->name_stride = LABEL_LEN + 1;
+    }
+
+    /* Initialize the space, unless the threads are to touch it first, in
+       which case the boundaries wait in the edges until they do. */
+
+    grid->cells = space;
+    if (arena->first_touch)
+    {
+        grid->edges = (int *) arena_alloc( arena, edge_bytes );
+        return 1;
+    }
+    for (i = 0; i < (long) numcells; i++)
+    {
+        space[i].north = NO_PIECE_INDEX;
+        space[i].west = NO_PIECE_INDEX;
+        space[i].piece = NO_PIECE_INDEX;
+        space[i].state = CELL_EMPTY;
+    }
+
+    return 1;
+}
+
+/* Where tab i of the boundary on one side of the grid goes: into the
+   grid, or into the edges if the grid hasn't been touched yet. */
+
+static int *
+boundary_tab( grid_t *grid, int side, int i )
+{
+    size_t cols = grid->numcols;
+    size_t rows = grid->numrows;
+
+    if (side == NORTH_TAB)
+    {
+        return (grid->edges != NULL) ? &grid->edges[i] : &grid_cell( grid, i, 0 )->north;
+    }
+    if (side == SOUTH_TAB)
+    {
+        return (grid->edges != NULL) ? &grid->edges[cols + i] : &grid_cell( grid, i, rows )->north;
+    }
+    if (side == WEST_TAB)
+    {
+        return (grid->edges != NULL) ? &grid->edges[2 * cols + i] : &grid_cell( grid, 0, i )->west;
+    }
+    return (grid->edges != NULL) ? &grid->edges[2 * cols + rows + i] :
+           &grid_cell( grid, cols, i )->west;
+}
+
+/* Set up this thread's share of a grid that was left untouched, a band of
+   whole tile rows, so that its pages are first touched by the thread (and
+   so placed on its NUMA node), and put back the boundaries that fall in it.
+   Every thread has to be done before the grid is used.  Does nothing to a
+   grid that get_input set up itself. */
+
+void
+grid_touch( grid_t *grid, int thread_id, int numThreads )
+{
+    size_t tile_rows = ((size_t) grid->numrows + GRID_TILE) >> GRID_TILE_SHIFT;
+    size_t tile_len = grid->tile_cols << (2 * GRID_TILE_SHIFT);
+    size_t first = tile_rows * thread_id / numThreads;
+    size_t last = tile_rows * (thread_id + 1) / numThreads;
+    cell_t *cell;
+    int row, row_end;
+    int col;
+
+    if (grid->edges == NULL)
+    {
+        return;
+    }
+
+    for (cell = grid->cells + first * tile_len; cell < grid->cells + last * tile_len; cell++)
+    {
+        cell->north = NO_PIECE_INDEX;
+        cell->west = NO_PIECE_INDEX;
+        cell->piece = NO_PIECE_INDEX;
+        cell->state = CELL_EMPTY;
+    }
+
+    row_end = (int) (last << GRID_TILE_SHIFT);
+    if (row_end > grid->numrows + 1)
+    {
+        row_end = grid->numrows + 1;
+    }
+    for (row = (int) (first << GRID_TILE_SHIFT); row < row_end; row++)
+    {
+        if ((row == 0) || (row == grid->numrows))
+        {
+            for (col = 0; col < grid->numcols; col++)
+            {
+                grid_cell( grid, col, row )->north =
+                    grid->edges[(row == 0) ? col : grid->numcols + col];
+            }
+        }
+        if (row < grid->numrows)
+        {
+            grid_cell( grid, 0, row )->west = grid->edges[2 * (size_t) grid->numcols + row];
+            grid_cell( grid, grid->numcols, row )->west =
+                grid->edges[2 * (size_t) grid->numcols + grid->numrows + row];
+        }
+    }
+}
+
+/* Retrieve the size and boundaries of a binary puzzle.  Everything else
+   stays in the mapped file until copy_binary_pieces picks it up. */
+
+int
+get_binary_input( input_t *input, grid_t *grid, piece_list_t *piece_list, arena_t *arena )
+{
+    const binfmt_header_t *header = (const binfmt_header_t *) input->data;
+    const unsigned char *tabs;
+    const char *problem;
+    uint32_t width;
+    uint32_t i;
+    int k;
+
+    grid->cells = NULL;
+    piece_list->tab_space = NULL;
+    piece_list->name_space = NULL;
+
+    problem = binfmt_check( header, input->length );
+    if (problem == NULL && (header->cols > INT_MAX - 1 || header->rows > INT_MAX - 1))
+    {
+        problem = "binary puzzle is too big";
+    }
+    if (problem == NULL && header->name_width > LABEL_LEN + 1)
+    {
+        problem = "binary puzzle piece names are too long";
+    }
+    if (problem != NULL)
+    {
+        fprintf( stderr, "Error in puzzle input: %s\n", problem );
+        return 0;
+    }
+    input->binary = header;
+
+    if (!grid_alloc( grid, piece_list, arena, header->cols, header->rows,
+                     header->tab_width != 4, 0 ))
+    {
+        return 0;
+    }
+
+    /* The names are always used in place, and so are 4 byte tabs. */
+
+    piece_list->names = input->data + header->names_offset;
+    piece_list->name_stride = header->name_width;
+    for (k = NORTH_TAB; (header->tab_width == 4) && (k <= WEST_TAB); k++)
+    {
+        piece_list->tab[k] = (int *) (input->data + header->tabs_offset + k * header->tab_stride);
+    }
+
+    /* The boundaries are the top, the bottom, the left side and the right. */
+
+    width = header->tab_width;
+    tabs = (const unsigned char *) input->data + header->boundary_offset;
+    for (i = 0; i < header->cols; i++)
+    {
+        *boundary_tab( grid, NORTH_TAB, i ) = binfmt_tab( tabs, width, i );
+        *boundary_tab( grid, SOUTH_TAB, i ) = binfmt_tab( tabs, width, header->cols + i );
+    }
+    for (i = 0; i < header->rows; i++)
+    {
+        *boundary_tab( grid, WEST_TAB, i ) = binfmt_tab( tabs, width, 2 * (uint64_t) header->cols + i );
+        *boundary_tab( grid, EAST_TAB, i ) =
+            binfmt_tab( tabs, width, 2 * (uint64_t) header->cols + header->rows + i );
+    }
+
+    return 1;
+}
+
+/* Copy the tabs of pieces first up to last out of a binary puzzle, or just
+   check them when they are used in place, entering the pieces in the index
+   unless the index was borrowed from the puzzle.  There is nothing to parse,
+   so this runs at the speed of memory.  Returns 0 if a tab is too big to be
+   a tab. */
+
+int
+copy_binary_pieces( input_t *input, piece_list_t *piece_list, long first, long last,
+                    index_t *index )
+{
+    const binfmt_header_t *header = input->binary;
+    const unsigned char *tabs = (const unsigned char *) input->data + header->tabs_offset;
+    long i;
+    int k;
+
+    for (i = first; i < last; i++)
+    {
+        for (k = NORTH_TAB; k <= WEST_TAB; k++)
+        {
+            if (piece_list->tab_space != NULL)
+            {
+                piece_list->tab[k][i] = binfmt_tab( tabs + k * header->tab_stride,
+                                                    header->tab_width, i );
+            }
+            if (piece_list->tab[k][i] < 0)
+            {
+                fprintf( stderr, "Error in puzzle input: piece %ld has a bad tab\n", i );
+                return 0;
+            }
+        }
+
+        for (k = PAIR_NE; (index->slots != NULL) && !index->borrowed && (k <= PAIR_WN); k++)
+        {
+            index_insert( index, piece_list, i, k );
+        }
+    }
+
+    return 1;
+}
+
+/* Retrieve the puzzle size and boundaries from the input, and make room for
+   the pieces.  Binary puzzles are recognised by their magic number, and
+   only at the start of the input since they can't be followed by another
+   puzzle. */
+
+int
+get_input( input_t *input, grid_t *grid, piece_list_t *piece_list, arena_t *arena )
+{
+    long i;
+    int cols, rows;
+    int ok;
+
+    input->binary = NULL;
+    if ((input->pos == 0) && (input->length >= 4) && (memcmp( input->data, BINFMT_MAGIC, 4 ) == 0))
+    {
+        return get_binary_input( input, grid, piece_list, arena );
+    }
+
+    grid->cells = NULL;
+    piece_list->tab_space = NULL;
+    piece_list->name_space = NULL;
+
+    /* Get the grid size. */
+
+    if (!scan_int( input, &cols ) || !scan_int( input, &rows ) || (cols < 1) || (rows < 1))
+    {
+        input_error( input, "the number of columns and rows" );
+        return 0;
+    }
+
+    if (!grid_alloc( grid, piece_list, arena, cols, rows, 1, 1 ))
+    {
+        return 0;
+    }
+
+    /* Get the top. */
+
+    ok = scan_label( input, "top" );
+    for (i = 0; ok && (i < cols); i++)
+    {
+        ok = scan_tab( input, boundary_tab( grid, NORTH_TAB, i ) );
+    }
+
+    /* Get the bottom. */
+
+    ok = ok && scan_label( input, "bottom" );
+    for (i = 0; ok && (i < cols); i++)
+    {
+        ok = scan_tab( input, boundary_tab( grid, SOUTH_TAB, i ) );
+    }
+
+    /* Get the left side. */
+
+    ok = ok && scan_label( input, "left" );
+    for (i = 0; ok && (i < rows); i++)
+    {
+        ok = scan_tab( input, boundary_tab( grid, WEST_TAB, i ) );
+    }
+
+    /* Get the right. */
+
+    ok = ok && scan_label( input, "right" );
+    for (i = 0; ok && (i < rows); i++)
+    {
+        ok = scan_tab( input, boundary_tab( grid, EAST_TAB, i ) );
+    }
+
+    if (!ok)
+    {
+        release_memory( grid, piece_list );
+        return 0;
+    }
+
+    /* The pieces start here.  They are parsed by the threads (see
+       load_pieces), or by get_pieces for a caller that has no threads. */
+
+    return 1;
+}
+
+/* Parse the piece on the line that starts at input->pos and ends at
+   line_end.  A piece line is a name and then its four tabs. */
+
+int
+scan_piece_line( input_t *input, size_t line_end, piece_list_t *piece_list, long piece )
+{
+    size_t end = input->end;
+    int ok;
+    int k;
+
+    input->end = line_end;
+    ok = scan_word( input, piece_name( piece_list, piece ), LABEL_LEN );
+    if (!ok)
+    {
+        input_error( input, "a piece name of at most 12 characters" );
+    }
+    for (k = NORTH_TAB; ok && (k <= WEST_TAB); k++)
+    {
+        ok = scan_tab( input, &piece_list->tab[k][piece] );
+    }
+    if (ok)
+    {
+        scan_space( input );
+        if (input->pos != line_end)
+        {
+            input_error( input, "the end of the piece line" );
+            ok = 0;
+        }
+    }
+    input->end = end;
+    input->pos = line_end + 1;
+
+    return ok;
+}
+
+/* Is there anything but white space between start and end? */
+
+int
+blank_line( const char *data, size_t start, size_t end )
+{
+    while ((start < end) &&
+            ((data[start] == ' ') || (data[start] == '\t') || (data[start] == '\r')))
+    {
+        start++;
+    }
+
+    return start == end;
+}
+
+/* Split the text from input->pos to input->end into numThreads chunks and
+   find where thread_id's chunk starts and ends.  Chunks start and end just
+   after a newline, so that neighbouring threads agree on where they meet. */
+
+void
+input_chunk( input_t *input, int thread_id, int numThreads, size_t *start, size_t *end )
+{
+    const char *data = input->data;
+    size_t section = input->end - input->pos;
+
+    *start = input->pos + section * thread_id / numThreads;
+    *end = input->pos + section * (thread_id + 1) / numThreads;
+
+    while ((*start > input->pos) && (*start < input->end) && (data[*start - 1] != '\n'))
+    {
+        (*start)++;
+    }
+    while ((*end < input->end) && (data[*end - 1] != '\n'))
+    {
+        (*end)++;
+    }
+}
+
+/* Count the piece lines between start and end, not counting blank lines. */
+
+long
+count_piece_lines( const char *data, size_t start, size_t end )
+{
+    const char *newline;
+    size_t line_end;
+    long count = 0;
+
+    while (start < end)
+    {
+        newline = (const char *) memchr( data + start, '\n', end - start );
+        line_end = (newline == NULL) ? end : (size_t) (newline - data);
+        if (!blank_line( data, start, line_end ))
+        {
+            count++;
+        }
+        start = line_end + 1;
+    }
+
+    return count;
+}
+
+/* Parse the piece lines from input->pos up to end into the piece list,
+   starting with piece number first, and enter them in the index if there
+   is one.  Lines past the last piece of the puzzle are left alone.
+   Returns how many pieces were parsed, or -1 on an error. */
+
+long
+parse_pieces( input_t *input, size_t end, piece_list_t *piece_list, long first,
+              index_t *index )
+{
+    const char *newline;
+    size_t line_end;
+    long i = first;
+    int kind;
+
+    while ((input->pos < end) && (i < piece_list->numpieces))
+    {
+        newline = (const char *) memchr( input->data + input->pos, '\n', end - input->pos );
+        line_end = (newline == NULL) ? end : (size_t) (newline - input->data);
+        if (blank_line( input->data, input->pos, line_end ))
+        {
+            input->pos = line_end + 1;
+            continue;
+        }
+
+        if (!scan_piece_line( input, line_end, piece_list, i ))
+        {
+            return -1;
+        }
+        for (kind = PAIR_NE; (index != NULL) && (index->slots != NULL) && (kind <= PAIR_WN); kind++)
+        {
+            index_insert( index, piece_list, i, kind );
+        }
+        i++;
+    }
+
+    return i - first;
+}
+
+/* Find where the piece section that starts at input->pos ends, which is
+   just after its numpieces-th piece line, so that another puzzle can
+   follow it in the same input.  A binary puzzle takes up the whole of its
+   input. */
+
+size_t
+find_pieces_end( input_t *input, long numpieces )
+{
+    const char *newline;
+    size_t start = input->pos;
+    size_t line_end;
+
+    if (input->binary != NULL)
+    {
+        return input->end;
+    }
+
+    while ((start < input->end) && (numpieces > 0))
+    {
+        newline = (const char *) memchr( input->data + start, '\n', input->end - start );
+        line_end = (newline == NULL) ? input->end : (size_t) (newline - input->data);
+        if (!blank_line( input->data, start, line_end ))
+        {
+            numpieces--;
+        }
+        start = (line_end < input->end) ? line_end + 1 : input->end;
+    }
+
+    return start;
+}
+
+/* Is there another puzzle after input->pos, or just white space? */
+
+int
+input_more( input_t *input )
+{
+    scan_space( input );
+
+    return input->pos < input->end;
+}
+
+/* Parse all of the pieces on one thread.  Returns 0 on an error. */
+
+int
+get_pieces( input_t *input, piece_list_t *piece_list )
+{
+    index_t no_index = { NULL, 0, 0, 0 };
+    long found;
+
+    if (input->binary != NULL)
+    {
+        return copy_binary_pieces( input, piece_list, 0, piece_list->numpieces, &no_index );
+    }
+
+    found = parse_pieces( input, input->end, piece_list, 0, NULL );
+
+    if ((found >= 0) && (found < piece_list->numpieces))
+    {
+        fprintf( stderr, "Error in puzzle input: expected %ld pieces but found %ld\n",
+                 piece_list->numpieces, found );
+        found = -1;
+    }
+
+    return found >= 0;
+}
@@ -0,0 +1,425 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "puzzle.h"
+#include "solve.h"
+#include "libpuzzle.h"
+
+/* The library's contexts (see libpuzzle.h).  A context starts its pool of
+   workers once and keeps them waiting for puzzles, much as batch mode does
+   for a big puzzle: puzzle_solve reads the puzzle's boundaries on the
+   caller's thread, hands the puzzle to every worker by bumping round, and
+   waits for them to count themselves out on left.  Once the workers have
+   solved it, each measures its band of rows of the solution, one of them
+   works out where every band starts in the caller's buffer, and each
+   formats its band straight into place.  call_lock makes callers sharing
+   a context take turns. */
+
+_Static_assert( (PUZZLE_MATCH_INDEX == MATCH_INDEX) && (PUZZLE_MATCH_SCAN == MATCH_SCAN) &&
+                (PUZZLE_MATCH_SCALAR == MATCH_SCALAR), "match options differ from match.c" );
+
+typedef struct
+{
+    puzzle_ctx_t *ctx;
+    int worker;
+} ctx_worker_t;
+
+struct puzzle_ctx
+{
+    pthread_mutex_t call_lock;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t finished;
+    pthread_barrier_t barrier;
+    pthread_t *workers;
+    ctx_worker_t *selves;
+    int numThreads;
+    puzzle_options_t options;
+    arena_t arena;
+    numa_t numa;
+    numa_t *placement;
+
+    /* The puzzle being solved, where its solution goes, and where each
+       worker's band of rows starts in it. */
+    solve_t *solve;
+    puzzle_result_t *result;
+    size_t *offsets;
+    char *out;
+    int status;
+
+    long round;
+    int left;
+    int stop;
+};
+
+/* The scan kernel is one for the whole process, so the first context to
+   be made picks it. */
+
+static pthread_mutex_t select_lock = PTHREAD_MUTEX_INITIALIZER;
+static int selected = 0;
+
+void
+puzzle_options_init( puzzle_options_t *options )
+{
+    options->mode = PUZZLE_MODE_SWEEP;
+    options->match = PUZZLE_MATCH_INDEX;
+    options->compact = 0;
+    options->stats = 0;
+    options->rotate = 0;
+    options->affinity = 0;
+    options->numa = 0;
+    options->huge_threshold = ARENA_HUGE_THRESHOLD;
+}
+
+/* Write a worker's band of rows of a solved puzzle into the caller's
+   buffer, once every worker has finished solving.  The first worker past
+   each barrier does the work that only one of them should. */
+
+static void
+ctx_format( puzzle_ctx_t *ctx, int worker )
+{
+    solve_t *solve = ctx->solve;
+    puzzle_result_t *result = ctx->result;
+    grid_t *grid = &solve->grid;
+    int first = (int) ((long) grid->numrows * worker / ctx->numThreads);
+    int last = (int) ((long) grid->numrows * (worker + 1) / ctx->numThreads);
+    size_t length;
+    unsigned long long trace;
+    int i;
+
+    if (pthread_barrier_wait( &ctx->barrier ) == PTHREAD_BARRIER_SERIAL_THREAD)
+    {
+        solve->end_time = now_ms();
+    }
+    if (!solve->input_ok || !solve_complete( solve ))
+    {
+        return;
+    }
+
+    trace = trace_begin();
+    ctx->offsets[worker + 1] = measure_rows( grid, &solve->piece_list, ctx->options.compact,
+                                             first, last );
+    trace_end( TRACE_FORMAT, trace, first, last - first, 0 );
+
+    if (pthread_barrier_wait( &ctx->barrier ) == PTHREAD_BARRIER_SERIAL_THREAD)
+    {
+        ctx->offsets[0] = 0;
+        for (i = 0; i < ctx->numThreads; i++)
+        {
+            ctx->offsets[i + 1] += ctx->offsets[i];
+        }
+        length = ctx->offsets[ctx->numThreads];
+        result->length = length;
+
+        ctx->out = NULL;
+        if (result->buffer == NULL)
+        {
+            result->buffer = (char *) malloc( length > 0 ? length : 1 );
+            result->capacity = (result->buffer != NULL) ? length : 0;
+            if (result->buffer == NULL)
+            {
+                ctx->status = PUZZLE_NO_MEMORY;
+            }
+        }
+        if (result->capacity < length)
+        {
+            if (ctx->status == PUZZLE_OK)
+            {
+                ctx->status = PUZZLE_NO_SPACE;
+            }
+        }
+        else
+        {
+            ctx->out = result->buffer;
+        }
+    }
+    pthread_barrier_wait( &ctx->barrier );
+
+    if (ctx->out != NULL)
+    {
+        trace = trace_begin();
+        format_rows( grid, &solve->piece_list, ctx->options.compact, first, last,
+                     ctx->out + ctx->offsets[worker] );
+        trace_end( TRACE_FORMAT, trace, first, last - first, 0 );
+    }
+}
+
+/* Workers wait for puzzles until the context is destroyed. */
+
+static void *
+ctx_worker( void *temp )
+{
+    ctx_worker_t *self = (ctx_worker_t *) temp;
+    puzzle_ctx_t *ctx = self->ctx;
+    long round = 0;
+
+    trace_thread( "solver", self->worker );
+    pthread_mutex_lock( &ctx->lock );
+    while (1)
+    {
+        if (ctx->round != round)
+        {
+            round = ctx->round;
+            pthread_mutex_unlock( &ctx->lock );
+
+            puzzleThreadSolver( &ctx->solve->fills[self->worker] );
+            ctx_format( ctx, self->worker );
+
+            pthread_mutex_lock( &ctx->lock );
+            if (--ctx->left == 0)
+            {
+                pthread_cond_broadcast( &ctx->finished );
+            }
+        }
+        else if (ctx->stop)
+        {
+            break;
+        }
+        else
+        {
+            pthread_cond_wait( &ctx->work, &ctx->lock );
+        }
+    }
+    pthread_mutex_unlock( &ctx->lock );
+
+    return NULL;
+}
+
+/* Tell the first started workers of a context to stop, and wait for them. */
+
+static void
+ctx_stop( puzzle_ctx_t *ctx, int started )
+{
+    int i;
+
+    pthread_mutex_lock( &ctx->lock );
+    ctx->stop = 1;
+    pthread_cond_broadcast( &ctx->work );
+    pthread_mutex_unlock( &ctx->lock );
+    for (i = 0; i < started; i++)
+    {
+        pthread_join( ctx->workers[i], NULL );
+    }
+}
+
+static void
+ctx_free( puzzle_ctx_t *ctx )
+{
+    pthread_barrier_destroy( &ctx->barrier );
+    pthread_cond_destroy( &ctx->finished );
+    pthread_cond_destroy( &ctx->work );
+    pthread_mutex_destroy( &ctx->lock );
+    pthread_mutex_destroy( &ctx->call_lock );
+    arena_free( &ctx->arena );
+    if (ctx->placement != NULL)
+    {
+        numa_free( ctx->placement );
+    }
+    free( ctx->workers );
+    free( ctx->selves );
+    free( ctx->offsets );
+    free( ctx );
+}
+
+/* Make a context that solves with numThreads threads, with the default
+   options if options is NULL.  Returns NULL if the threads or the memory
+   for them can't be had. */
+
+puzzle_ctx_t *
+puzzle_ctx_create( int numThreads, const puzzle_options_t *options )
+{
+    puzzle_options_t defaults;
+    puzzle_ctx_t *ctx;
+    pthread_attr_t attr;
+    int i;
+
+    if (numThreads < 1)
+    {
+        return NULL;
+    }
+    if (options == NULL)
+    {
+        puzzle_options_init( &defaults );
+        options = &defaults;
+    }
+
+    ctx = (puzzle_ctx_t *) calloc( 1, sizeof( puzzle_ctx_t ) );
+    if (ctx == NULL)
+    {
+        return NULL;
+    }
+    ctx->workers = (pthread_t *) malloc( numThreads * sizeof( pthread_t ) );
+    ctx->selves = (ctx_worker_t *) malloc( numThreads * sizeof( ctx_worker_t ) );
+    ctx->offsets = (size_t *) malloc( (numThreads + 1) * sizeof( size_t ) );
+    if ((ctx->workers == NULL) || (ctx->selves == NULL) || (ctx->offsets == NULL))
+    {
+        free( ctx->workers );
+        free( ctx->selves );
+        free( ctx->offsets );
+        free( ctx );
+        return NULL;
+    }
+    ctx->numThreads = numThreads;
+    ctx->options = *options;
+
+    pthread_mutex_lock( &select_lock );
+    if (!selected)
+    {
+        match_select( options->match != PUZZLE_MATCH_SCALAR );
+        selected = 1;
+    }
+    pthread_mutex_unlock( &select_lock );
+
+    if (options->affinity || options->numa)
+    {
+        if (numa_init( &ctx->numa, options->numa ))
+        {
+            ctx->placement = &ctx->numa;
+        }
+        else
+        {
+            fprintf(stderr, "Can't find the CPUs to pin the threads to, leaving them be\n");
+        }
+    }
+    arena_init( &ctx->arena, options->huge_threshold );
+    ctx->arena.first_touch = options->numa;
+
+    pthread_mutex_init( &ctx->call_lock, NULL );
+    pthread_mutex_init( &ctx->lock, NULL );
+    pthread_cond_init( &ctx->work, NULL );
+    pthread_cond_init( &ctx->finished, NULL );
+    pthread_barrier_init( &ctx->barrier, NULL, numThreads );
+
+    for (i = 0; i < numThreads; i++)
+    {
+        ctx->selves[i].ctx = ctx;
+        ctx->selves[i].worker = i;
+        pthread_attr_init( &attr );
+        numa_attr( ctx->placement, &attr, i );
+        if (pthread_create( &ctx->workers[i], &attr, &ctx_worker, &ctx->selves[i] ))
+        {
+            pthread_attr_destroy( &attr );
+            ctx_stop( ctx, i );
+            ctx_free( ctx );
+            return NULL;
+        }
+        pthread_attr_destroy( &attr );
+    }
+
+    return ctx;
+}
+
+/* Solve one puzzle and write its solution into result (see libpuzzle.h).
+   Returns PUZZLE_OK, or why the puzzle couldn't be solved or written. */
+
+int
+puzzle_solve( puzzle_ctx_t *ctx, const puzzle_view_t *puzzle, puzzle_result_t *result )
+{
+    solve_t solve;
+    double start_time;
+    double parsed_time;
+    unsigned long long trace;
+    int status = PUZZLE_OK;
+
+    result->length = 0;
+    result->numcols = 0;
+    result->numrows = 0;
+    result->numpieces = 0;
+    result->parse_ms = 0.0;
+    result->index_ms = 0.0;
+    result->solve_ms = 0.0;
+    result->format_ms = 0.0;
+
+    pthread_mutex_lock( &ctx->call_lock );
+    start_time = now_ms();
+    trace = trace_begin();
+
+    /* The puzzle is only ever read, so it can be scanned where it is. */
+
+    solve.arena = &ctx->arena;
+    solve.input.data = (char *) puzzle->data;
+    solve.input.length = puzzle->length;
+    solve.input.pos = 0;
+    solve.input.end = puzzle->length;
+    solve.input.mapped = 0;
+    solve.input.binary = NULL;
+
+    if (!get_input( &solve.input, &solve.grid, &solve.piece_list, &ctx->arena ))
+    {
+        status = PUZZLE_BAD_INPUT;
+    }
+    else if (!solve_init( &solve, ctx->numThreads, ctx->options.mode, ctx->options.match,
+                          ctx->options.stats, ctx->options.rotate ))
+    {
+        release_memory( &solve.grid, &solve.piece_list );
+        status = PUZZLE_NO_MEMORY;
+    }
+    else
+    {
+        result->numcols = solve.grid.numcols;
+        result->numrows = solve.grid.numrows;
+        result->numpieces = solve.piece_list.numpieces;
+        trace_end( TRACE_PARSE, trace, 0, 0, 0 );
+
+        pthread_mutex_lock( &ctx->lock );
+        ctx->solve = &solve;
+        ctx->result = result;
+        ctx->status = PUZZLE_OK;
+        solve.start_time = now_ms();
+        parsed_time = solve.start_time;
+        ctx->left = ctx->numThreads;
+        ctx->round++;
+        pthread_cond_broadcast( &ctx->work );
+        while (ctx->left > 0)
+        {
+            pthread_cond_wait( &ctx->finished, &ctx->lock );
+        }
+        pthread_mutex_unlock( &ctx->lock );
+
+        if (!solve.input_ok)
+        {
+            status = PUZZLE_BAD_INPUT;
+        }
+        else if (!solve_complete( &solve ))
+        {
+            status = PUZZLE_UNSOLVED;
+        }
+        else
+        {
+            status = ctx->status;
+            result->parse_ms = parsed_time - start_time;
+            result->index_ms = solve.index_time - solve.start_time;
+            result->solve_ms = solve.end_time - solve.index_time;
+            result->format_ms = now_ms() - solve.end_time;
+            if (solve.stats != NULL)
+            {
+                solve_print_stats( &solve, -1 );
+            }
+            if (ctx->options.affinity || ctx->options.numa)
+            {
+                solve_print_placement( &solve );
+            }
+        }
+        solve_free( &solve );
+    }
+
+    pthread_mutex_unlock( &ctx->call_lock );
+
+    return status;
+}
+
+/* Stop a context's workers and give back everything it holds.  Nobody may
+   be solving with it. */
+
+void
+puzzle_ctx_destroy( puzzle_ctx_t *ctx )
+{
+    if (ctx == NULL)
+    {
+        return;
+    }
+    ctx_stop( ctx, ctx->numThreads );
+    ctx_free( ctx );
+}
@@ -0,0 +1,114 @@
+
+#ifndef LIBPUZZLE_H
+#define LIBPUZZLE_H
+
+#include <stddef.h>
+
+/* The puzzle solver as a library.  A context owns a pool of solving
+   threads and the memory they solve in, both kept from one puzzle to the
+   next, so a long-running program can solve puzzle after puzzle without
+   starting threads or mapping memory each time.
+
+   Puzzles are given as a view of text or binary puzzle bytes in memory,
+   which the library only ever reads; a binary puzzle has to start on an
+   8 byte boundary, as anything from malloc or mmap does.  The solution is
+   written into the caller's buffer in the same form the puzzle program
+   prints it.
+
+   Any number of threads may call puzzle_solve at once.  Calls on the same
+   context take turns, and calls on different contexts run side by side,
+   so a service wanting several puzzles solved at once makes a context for
+   each.  What goes wrong with a puzzle's input, or with solving it, is
+   described on stderr, as are the statistics and page placement asked
+   for in the options. */
+
+#if defined(__GNUC__)
+#define PUZZLE_API __attribute__ ((visibility ("default")))
+#else
+#define PUZZLE_API
+#endif
+
+/* How the threads share a puzzle out (see the How To Run section of the
+   README), and how they look pieces up. */
+
+#define PUZZLE_MODE_SWEEP (0)
+#define PUZZLE_MODE_WAVEFRONT (1)
+#define PUZZLE_MODE_DATAFLOW (2)
+#define PUZZLE_MODE_PIPELINE (3)
+
+#define PUZZLE_MATCH_INDEX (0)
+#define PUZZLE_MATCH_SCAN (1)
+#define PUZZLE_MATCH_SCALAR (2)
+
+/* What puzzle_solve returns.  PUZZLE_NO_SPACE means the caller's buffer
+   was too small; the result's length says how big it needs to be.
+   PUZZLE_UNSOLVED means the puzzle was read but some cell has no piece
+   that fits it, and no solution is written. */
+
+#define PUZZLE_OK (0)
+#define PUZZLE_BAD_INPUT (1)
+#define PUZZLE_NO_MEMORY (2)
+#define PUZZLE_NO_SPACE (3)
+#define PUZZLE_UNSOLVED (4)
+
+typedef struct puzzle_ctx puzzle_ctx_t;
+
+/* How a context solves its puzzles; puzzle_options_init fills in the
+   defaults.  compact gives each piece's number instead of its name.
+   stats prints each thread's counters as JSON on stderr.  rotate finds
+   pieces whichever way round they were given, and says how each was
+   turned in the solution.  affinity pins the threads to CPUs, and numa
+   has them first touch the grid as well, and either prints which NUMA
+   nodes the memory ended up on.  Memory
+   regions of at least huge_threshold bytes use huge pages (0 for never).
+   The scan kernel is picked for the whole process by the first context
+   made, so match only picks between index and scan after that. */
+
+typedef struct
+{
+    int mode;
+    int match;
+    int compact;
+    int stats;
+    int rotate;
+    int affinity;
+    int numa;
+    size_t huge_threshold;
+} puzzle_options_t;
+
+/* A puzzle in memory, text or binary. */
+
+typedef struct
+{
+    const char *data;
+    size_t length;
+} puzzle_view_t;
+
+/* Where the solution goes, and what solving it took.  The caller sets
+   buffer and capacity; with a NULL buffer the library allocates one of
+   just the right size, which the caller frees with free.  The solution is
+   not NUL terminated; length is its size in bytes.  The times are in
+   milliseconds: reading the boundaries and setting up, parsing the pieces
+   and building the index, solving, and writing out the solution. */
+
+typedef struct
+{
+    char *buffer;
+    size_t capacity;
+    size_t length;
+    int numcols;
+    int numrows;
+    long numpieces;
+    double parse_ms;
+    double index_ms;
+    double solve_ms;
+    double format_ms;
+} puzzle_result_t;
+
+PUZZLE_API void puzzle_options_init( puzzle_options_t *options );
+PUZZLE_API puzzle_ctx_t *puzzle_ctx_create( int numThreads, const puzzle_options_t *options );
+PUZZLE_API int puzzle_solve( puzzle_ctx_t *ctx, const puzzle_view_t *puzzle,
+                             puzzle_result_t *result );
+PUZZLE_API void puzzle_ctx_destroy( puzzle_ctx_t *ctx );
+
+#endif
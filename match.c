@@ -0,0 +1,231 @@
+#include <stdlib.h>
+
+#include "puzzle.h"
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#define MATCH_X86 (1)
+#endif
+
+/* Scanning the pieces for one that fits a cell.  This is how find_piece
+   finds pieces when there is no index to look them up in.
+
+   The vector kernels compare the first known tab of the cell against 8
+   pieces at a time (AVX2) or 4 at a time (SSE2), two vectors to a step, and
+   only check the other known tabs of the pieces that pass.  An unknown tab
+   (NO_PIECE_INDEX) matches anything, so its array is never read at all.
+   The kernel is picked once by match_select, from what the processor
+   supports. */
+
+static match_fn match_kernel = match_scalar;
+
+/* Put the known tabs of a cell first.  Returns how many there are. */
+
+static int
+known_tabs( piece_list_t *piece_list, const int tabs[4], const int *arrays[4], int want[4] )
+{
+    int known = 0;
+    int k;
+
+    for (k = NORTH_TAB; k <= WEST_TAB; k++)
+    {
+        if (tabs[k] != NO_PIECE_INDEX)
+        {
+            arrays[known] = piece_list->tab[k];
+            want[known] = tabs[k];
+            known++;
+        }
+    }
+
+    return known;
+}
+
+/* Do the rest of the known tabs of piece agree? */
+
+static int
+rest_match( const int *arrays[4], const int want[4], int known, long piece )
+{
+    int k;
+
+    for (k = 1; k < known; k++)
+    {
+        if (arrays[k][piece] != want[k])
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Try the pieces whose bits are set in hits, starting at piece base. */
+
+static long
+first_hit( const int *arrays[4], const int want[4], int known, long base, unsigned int hits )
+{
+    int bit;
+
+    while (hits != 0)
+    {
+        bit = __builtin_ctz( hits );
+        if (rest_match( arrays, want, known, base + bit ))
+        {
+            return base + bit;
+        }
+        hits &= hits - 1;
+    }
+
+    return NO_PIECE_INDEX;
+}
+
+long
+match_scalar( piece_list_t *piece_list, long first, long last, const int tabs[4] )
+{
+    const int *arrays[4];
+    int want[4];
+    int known;
+    long j;
+
+    known = known_tabs( piece_list, tabs, arrays, want );
+    if (known == 0)
+    {
+        return (first < last) ? first : NO_PIECE_INDEX;
+    }
+
+    for (j = first; j < last; j++)
+    {
+        if ((arrays[0][j] == want[0]) && rest_match( arrays, want, known, j ))
+        {
+            return j;
+        }
+    }
+
+    return NO_PIECE_INDEX;
+}
+
+#ifdef MATCH_X86
+
+long
+match_sse( piece_list_t *piece_list, long first, long last, const int tabs[4] )
+{
+    const int *arrays[4];
+    int want[4];
+    int known;
+    long j, found;
+    __m128i key;
+    unsigned int hits;
+
+    known = known_tabs( piece_list, tabs, arrays, want );
+    if (known == 0)
+    {
+        return (first < last) ? first : NO_PIECE_INDEX;
+    }
+
+    key = _mm_set1_epi32( want[0] );
+    for (j = first; j + 8 <= last; j += 8)
+    {
+        hits = _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32(
+                   _mm_loadu_si128( (const __m128i *) (arrays[0] + j) ), key ) ) );
+        hits |= _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32(
+                    _mm_loadu_si128( (const __m128i *) (arrays[0] + j + 4) ), key ) ) ) << 4;
+        if (hits != 0)
+        {
+            found = first_hit( arrays, want, known, j, hits );
+            if (found != NO_PIECE_INDEX)
+            {
+                return found;
+            }
+        }
+    }
+
+    return match_scalar( piece_list, j, last, tabs );
+}
+
+__attribute__ ((target ("avx2")))
+long
+match_avx2( piece_list_t *piece_list, long first, long last, const int tabs[4] )
+{
+    const int *arrays[4];
+    int want[4];
+    int known;
+    long j, found;
+    __m256i key;
+    unsigned int hits;
+
+    known = known_tabs( piece_list, tabs, arrays, want );
+    if (known == 0)
+    {
+        return (first < last) ? first : NO_PIECE_INDEX;
+    }
+
+    key = _mm256_set1_epi32( want[0] );
+    for (j = first; j + 16 <= last; j += 16)
+    {
+        hits = _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32(
+                   _mm256_loadu_si256( (const __m256i *) (arrays[0] + j) ), key ) ) );
+        hits |= _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32(
+                    _mm256_loadu_si256( (const __m256i *) (arrays[0] + j + 8) ), key ) ) ) << 8;
+        if (hits != 0)
+        {
+            found = first_hit( arrays, want, known, j, hits );
+            if (found != NO_PIECE_INDEX)
+            {
+                return found;
+            }
+        }
+    }
+
+    return match_scalar( piece_list, j, last, tabs );
+}
+
+#else
+
+/* Other processors only have the plain C kernel. */
+
+long
+match_sse( piece_list_t *piece_list, long first, long last, const int tabs[4] )
+{
+    return match_scalar( piece_list, first, last, tabs );
+}
+
+long
+match_avx2( piece_list_t *piece_list, long first, long last, const int tabs[4] )
+{
+    return match_scalar( piece_list, first, last, tabs );
+}
+
+#endif
+
+/* Choose the kernel for match_scan: the widest one the processor can run,
+   or the plain C one if vector is 0.  Returns the kernel's name. */
+
+const char *
+match_select( int vector )
+{
+    match_kernel = match_scalar;
+    if (!vector)
+    {
+        return "scalar";
+    }
+
+#ifdef MATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports( "avx2" ))
+    {
+        match_kernel = match_avx2;
+        return "avx2";
+    }
+    match_kernel = match_sse;
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+/* Scan all of the pieces. */
+
+long
+match_scan( piece_list_t *piece_list, const int tabs[4] )
+{
+    return match_kernel( piece_list, 0, piece_list->numpieces, tabs );
+}
@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "puzzle.h"
+
+/* Placing the threads for --affinity and --numa.  The CPUs the program is
+   allowed to run on are listed node by node, and thread i is pinned to the
+   i-th of them (wrapping around), so that neighbouring threads, which work
+   on neighbouring rows, share a node.  Which node a CPU is on comes from
+   sysfs; without it every CPU counts as node 0.  Where pages ended up is
+   asked of the kernel with move_pages, which moves nothing when it isn't
+   given nodes to move to. */
+
+#define NUMA_MAX_NODES (64)
+#define NUMA_QUERY_PAGES (4096)
+
+/* The node a CPU is on, from the nodeN link in its sysfs directory. */
+
+static int
+cpu_node( int cpu )
+{
+    char path[64];
+    DIR *dir;
+    struct dirent *entry;
+    int node = 0;
+
+    snprintf( path, sizeof( path ), "/sys/devices/system/cpu/cpu%d", cpu );
+    dir = opendir( path );
+    if (dir == NULL)
+    {
+        return 0;
+    }
+    while ((entry = readdir( dir )) != NULL)
+    {
+        if ((strncmp( entry->d_name, "node", 4 ) == 0) &&
+                (entry->d_name[4] >= '0') && (entry->d_name[4] <= '9'))
+        {
+            node = atoi( entry->d_name + 4 );
+            break;
+        }
+    }
+    closedir( dir );
+
+    return node;
+}
+
+/* List the CPUs the threads can be pinned to, ordered by node.  first_touch
+   says whether the grid is to be first touched by the threads as well.
+   Returns 0 if the CPUs can't be found out. */
+
+int
+numa_init( numa_t *numa, int first_touch )
+{
+    cpu_set_t allowed;
+    int cpu, node;
+    int i;
+
+    numa->first_touch = first_touch;
+    numa->numcpus = 0;
+    numa->cpus = NULL;
+    numa->nodes = NULL;
+
+    if (sched_getaffinity( 0, sizeof( allowed ), &allowed ) != 0)
+    {
+        perror( "Error finding the CPUs to run on" );
+        return 0;
+    }
+    numa->cpus = (int *) malloc( CPU_COUNT( &allowed ) * sizeof( int ) );
+    numa->nodes = (int *) malloc( CPU_COUNT( &allowed ) * sizeof( int ) );
+    if ((numa->cpus == NULL) || (numa->nodes == NULL))
+    {
+        fprintf( stderr, "Not enough memory to place the threads\n" );
+        numa_free( numa );
+        return 0;
+    }
+
+    /* Insert each CPU after the others on its node. */
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET( cpu, &allowed ))
+        {
+            continue;
+        }
+        node = cpu_node( cpu );
+        for (i = numa->numcpus; (i > 0) && (numa->nodes[i - 1] > node); i--)
+        {
+            numa->cpus[i] = numa->cpus[i - 1];
+            numa->nodes[i] = numa->nodes[i - 1];
+        }
+        numa->cpus[i] = cpu;
+        numa->nodes[i] = node;
+        numa->numcpus++;
+    }
+
+    return numa->numcpus > 0;
+}
+
+void
+numa_free( numa_t *numa )
+{
+    free( numa->cpus );
+    free( numa->nodes );
+    numa->cpus = NULL;
+    numa->nodes = NULL;
+    numa->numcpus = 0;
+}
+
+/* Make a thread created with attr start out pinned to thread_id's CPU.
+   Does nothing without --affinity (numa is NULL). */
+
+void
+numa_attr( numa_t *numa, pthread_attr_t *attr, int thread_id )
+{
+    cpu_set_t set;
+
+    if ((numa == NULL) || (numa->numcpus == 0))
+    {
+        return;
+    }
+
+    CPU_ZERO( &set );
+    CPU_SET( numa->cpus[thread_id % numa->numcpus], &set );
+    pthread_attr_setaffinity_np( attr, sizeof( set ), &set );
+}
+
+/* Say on stderr how many of the pages from start to start + length are on
+   each node, and how many haven't been touched at all. */
+
+void
+numa_report( const char *what, const void *start, size_t length )
+{
+    long page = sysconf( _SC_PAGESIZE );
+    uintptr_t address = (uintptr_t) start & ~(uintptr_t) (page - 1);
+    uintptr_t end = (uintptr_t) start + length;
+    void *pages[NUMA_QUERY_PAGES];
+    int status[NUMA_QUERY_PAGES];
+    long counts[NUMA_MAX_NODES];
+    long absent = 0;
+    int count;
+    int node;
+    int i;
+
+    if ((start == NULL) || (length == 0))
+    {
+        return;
+    }
+
+    memset( counts, 0, sizeof( counts ) );
+    while (address < end)
+    {
+        for (count = 0; (count < NUMA_QUERY_PAGES) && (address < end); count++)
+        {
+            pages[count] = (void *) address;
+            address += page;
+        }
+
+#ifdef SYS_move_pages
+        if (syscall( SYS_move_pages, 0, (unsigned long) count, pages, NULL, status, 0 ) != 0)
+#endif
+        {
+            fprintf( stderr, "%s pages by node: unknown\n", what );
+            return;
+        }
+
+        for (i = 0; i < count; i++)
+        {
+            if ((status[i] >= 0) && (status[i] < NUMA_MAX_NODES))
+            {
+                counts[status[i]]++;
+            }
+            else
+            {
+                absent++;
+            }
+        }
+    }
+
+    fprintf( stderr, "%s pages by node:", what );
+    for (node = 0; node < NUMA_MAX_NODES; node++)
+    {
+        if (counts[node] > 0)
+        {
+            fprintf( stderr, " %d: %ld", node, counts[node] );
+        }
+    }
+    if (absent > 0)
+    {
+        fprintf( stderr, " not present: %ld", absent );
+    }
+    fprintf( stderr, "\n" );
+}
@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "puzzle.h"
+
+/* Linux takes at least this many buffers per writev; limits.h only says so
+   when asked for XOPEN. */
+#ifndef IOV_MAX
+#define IOV_MAX (1024)
+#endif
+
+/* Printing the solved grid.  Rows are formatted into per-thread buffers and
+   written out in row order with one writev per round, rather than with a
+   printf for every cell.  Each round, thread t formats the t-th block of
+   rows_per_round rows; once every thread is done, thread 0 writes all of
+   the buffers and the next round starts.  A cell never takes more than
+   CELL_TEXT_LEN bytes, so the buffers are sized up front. */
+
+typedef struct
+{
+    grid_t *grid;
+    piece_list_t *piece_list;
+    int compact;
+    int fd;
+
+    int thread_id;
+    int numThreads;
+    pthread_barrier_t *barrier;
+    char *buffer;
+    struct iovec *iov;
+    int rows_per_round;
+    int *ok;
+} print_t;
+
+/* Write out all of iov, carrying on after partial writes.  Returns 0 on an
+   error. */
+
+int
+write_all( int fd, struct iovec *iov, int count )
+{
+    ssize_t done;
+    int batch;
+
+    while (count > 0)
+    {
+        batch = (count < IOV_MAX) ? count : IOV_MAX;
+        done = writev( fd, iov, batch );
+        if (done < 0)
+        {
+            perror( "Error writing the solution" );
+            return 0;
+        }
+
+        /* Skip over what was written, which may end part way through a
+           buffer. */
+
+        while ((count > 0) && ((size_t) done >= iov->iov_len))
+        {
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char *) iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+
+    return 1;
+}
+
+/* The number of bytes format_rows would take for rows first up to last, so
+   that a caller's buffer can be filled by several threads at once. */
+
+size_t
+measure_rows( grid_t *grid, piece_list_t *piece_list, int compact, int first, int last )
+{
+    size_t length = 0;
+    long piece;
+    long number;
+    int placed;
+    int i, j;
+
+    for (j = first; j < last; j++)
+    {
+        for (i = 0; i < grid->numcols; i++)
+        {
+            placed = grid_cell( grid, i, j )->piece;
+            piece = PLACED_PIECE( placed );
+            if (placed == NO_PIECE_INDEX)
+            {
+                length++;
+            }
+            else if (compact)
+            {
+                number = piece;
+                do
+                {
+                    length++;
+                    number /= 10;
+                }
+                while (number > 0);
+            }
+            else
+            {
+                length += strnlen( piece_name( piece_list, piece ), LABEL_LEN );
+            }
+            if (piece_list->rotated && (placed != NO_PIECE_INDEX))
+            {
+                length += 2;
+            }
+            length++;
+        }
+        length++;
+    }
+
+    return length;
+}
+
+/* Format rows first up to last of the grid into buffer.  Rotated pieces are
+   followed by a slash and the number of quarter turns clockwise they were
+   given.  Returns the number of bytes used. */
+
+size_t
+format_rows( grid_t *grid, piece_list_t *piece_list, int compact, int first, int last,
+             char *buffer )
+{
+    char *out = buffer;
+    char digits[24];
+    long piece;
+    long number;
+    size_t len;
+    int placed;
+    int i, j, k;
+
+    for (j = first; j < last; j++)
+    {
+        for (i = 0; i < grid->numcols; i++)
+        {
+            placed = grid_cell( grid, i, j )->piece;
+            piece = PLACED_PIECE( placed );
+            if (placed == NO_PIECE_INDEX)
+            {
+                *out++ = '.';
+            }
+            else if (compact)
+            {
+                /* Print where the piece came in the input instead of its
+                   name. */
+
+                number = piece;
+                k = 0;
+                do
+                {
+                    digits[k++] = '0' + number % 10;
+                    number /= 10;
+                }
+                while (number > 0);
+                while (k > 0)
+                {
+                    *out++ = digits[--k];
+                }
+            }
+            else
+            {
+                len = strnlen( piece_name( piece_list, piece ), LABEL_LEN );
+                memcpy( out, piece_name( piece_list, piece ), len );
+                out += len;
+            }
+            if (piece_list->rotated && (placed != NO_PIECE_INDEX))
+            {
+                *out++ = '/';
+                *out++ = '0' + PLACED_TURN( placed );
+            }
+            *out++ = ' ';
+        }
+        *out++ = '\n';
+    }
+
+    return out - buffer;
+}
+
+/* Format the whole grid into a buffer of its own, for a caller that wants
+   to write it out later.  Returns NULL if there isn't the memory. */
+
+char *
+format_grid( grid_t *grid, piece_list_t *piece_list, int compact, size_t *length )
+{
+    size_t row_len = (size_t) grid->numcols * CELL_TEXT_LEN + 1;
+    char *buffer;
+
+    buffer = (char *) malloc( grid->numrows * row_len );
+    if (buffer != NULL)
+    {
+        *length = format_rows( grid, piece_list, compact, 0, grid->numrows, buffer );
+    }
+
+    return buffer;
+}
+
+/* The formatting threads take turns formatting and waiting for thread 0 to
+   write the round out. */
+
+void *
+print_thread( void *temp )
+{
+    print_t *print = (print_t *) temp;
+    grid_t *grid = print->grid;
+    int rows_per_round = print->rows_per_round;
+    int round_rows = rows_per_round * print->numThreads;
+    int base, first, last;
+    unsigned long long trace;
+    size_t bytes;
+    int i;
+
+    if (print->thread_id > 0)
+    {
+        trace_thread( "print", print->thread_id );
+    }
+
+    for (base = 0; base < grid->numrows; base += round_rows)
+    {
+        first = base + print->thread_id * rows_per_round;
+        last = first + rows_per_round;
+        if (first > grid->numrows) first = grid->numrows;
+        if (last > grid->numrows) last = grid->numrows;
+
+        trace = trace_begin();
+        print->iov[print->thread_id].iov_base = print->buffer;
+        print->iov[print->thread_id].iov_len =
+            format_rows( grid, print->piece_list, print->compact, first, last, print->buffer );
+        trace_end( TRACE_FORMAT, trace, first, last - first, 0 );
+
+        pthread_barrier_wait( print->barrier );
+        if ((print->thread_id == 0) && *print->ok)
+        {
+            trace = trace_begin();
+            for (i = 0, bytes = 0; i < print->numThreads; i++)
+            {
+                bytes += print->iov[i].iov_len;
+            }
+            *print->ok = write_all( print->fd, print->iov, print->numThreads );
+            trace_end( TRACE_WRITE, trace, (int) bytes, 0, 0 );
+        }
+        pthread_barrier_wait( print->barrier );
+    }
+
+    return NULL;
+}
+
+/* Display the names of all the pieces in the grid, or with compact set,
+   the numbers of the pieces in the order they were input.  Returns 0 if
+   the output couldn't be written. */
+
+int
+print_grid( grid_t *grid, piece_list_t *piece_list, int fd, int numThreads, int compact )
+{
+    size_t row_len = (size_t) grid->numcols * CELL_TEXT_LEN + 1;
+    pthread_t threads[numThreads];
+    print_t prints[numThreads];
+    struct iovec iov[numThreads];
+    pthread_barrier_t barrier;
+    int rows_per_round;
+    int ok = 1;
+    int i;
+
+    /* Anything already printed with stdio has to go out first. */
+
+    fflush( stdout );
+
+    /* Small grids aren't worth the threads. */
+
+    if ((long) grid->numcols * grid->numrows < PRINT_THREADED_CELLS)
+    {
+        numThreads = 1;
+    }
+
+    /* Aim for buffers of about PRINT_BUFFER_LEN bytes, but never less than a
+       row, and don't have threads with nothing to format. */
+
+    rows_per_round = PRINT_BUFFER_LEN / row_len;
+    if (rows_per_round < 1)
+    {
+        rows_per_round = 1;
+    }
+    if ((long) rows_per_round * numThreads > grid->numrows)
+    {
+        rows_per_round = (grid->numrows + numThreads - 1) / numThreads;
+    }
+
+    pthread_barrier_init( &barrier, NULL, numThreads );
+    for (i = 0; i < numThreads; i++)
+    {
+        prints[i].grid = grid;
+        prints[i].piece_list = piece_list;
+        prints[i].compact = compact;
+        prints[i].fd = fd;
+        prints[i].thread_id = i;
+        prints[i].numThreads = numThreads;
+        prints[i].barrier = &barrier;
+        prints[i].iov = iov;
+        prints[i].rows_per_round = rows_per_round;
+        prints[i].ok = &ok;
+        prints[i].buffer = (char *) malloc( rows_per_round * row_len );
+        if (prints[i].buffer == NULL)
+        {
+            ok = 0;
+        }
+    }
+
+    if (!ok)
+    {
+        fprintf( stderr, "Not enough memory to print the solution\n" );
+    }
+    else if (numThreads == 1)
+    {
+        print_thread( &prints[0] );
+    }
+    else
+    {
+        for (i = 1; i < numThreads; i++)
+        {
+            if (pthread_create( &threads[i], NULL, &print_thread, &prints[i] ))
+            {
+                fprintf( stderr, "Error creating thread\n" );
+                exit( 2 );
+            }
+        }
+        print_thread( &prints[0] );
+        for (i = 1; i < numThreads; i++)
+        {
+            pthread_join( threads[i], NULL );
+        }
+    }
+
+    for (i = 0; i < numThreads; i++)
+    {
+        free( prints[i].buffer );
+    }
+    pthread_barrier_destroy( &barrier );
+
+    return ok;
+}
+
+/* Display the set of tabs of the puzzle. */
+
+void
+print_edges( grid_t *grid )
+{
+    int i, j;
+
+    for (j = 0; j < grid->numrows; j++)
+    {
+        for (i = 0; i < grid->numcols; i++)
+        {
+            printf ("   %3d", grid_cell( grid, i, j )->north);
+        }
+        printf ("\n");
+        for (i = 0; i <= grid->numcols; i++)
+        {
+            printf ("%3d   ", grid_cell( grid, i, j )->west);
+        }
+        printf ("\n");
+    }
+    for (i = 0; i < grid->numcols; i++)
+    {
+        printf ("   %3d", grid_cell( grid, i, grid->numrows )->north);
+    }
+    printf ("\n");
+}
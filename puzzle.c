@@ -1,485 +1,447 @@
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
-#include <semaphore.h>
-
-#define LABEL_LEN (12)
-#define MAXLINELEN (8096)
-
-/* Each puzzle piece is an array of 4 tabs ordered clockwise and starting
-   at the top (north) tab. */
-
-#define NORTH_TAB (0)
-#define EAST_TAB (1)
-#define SOUTH_TAB (2)
-#define WEST_TAB (3)
-
-#define NO_PIECE_INDEX (-1)
-
-typedef struct
-{
-    int tab[4];
-    char name[LABEL_LEN + 1];
-} piece_t;
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "puzzle.h"
+#include "solve.h"
+#include "libpuzzle.h"
+
+/* Batch mode solves a stream of puzzles with one pool of worker threads.
+   A puzzle with fewer than BATCH_SMALL_PIECES pieces is solved whole by a
+   single worker, so lots of small puzzles are solved at once; a bigger
+   puzzle is solved by all of the workers together, once the small puzzles
+   ahead of it are done.  The main thread reads each puzzle's boundaries,
+   hands the puzzle out and writes the solutions in input order.  The
+   puzzles in flight sit in a window of BATCH_WINDOW per worker: submitted
+   counts the puzzles put in it, handed the ones taken by workers and
+   written the ones written out.  Each place in the window has an arena
+   that is reused by every puzzle that goes through it. */
+
+#define BATCH_SMALL_PIECES (65536)
+#define BATCH_WINDOW (4)
 
-/* We'll want to keep all the pieces and the number of them together. */
-
-typedef struct
-{
-    piece_t *pieces;
-    int numpieces;
-} piece_list_t;
-
-/* A cell in the grid knows its north and west tabs.  Since this cell is
-   expected to be in a grid, its east tab is the same as the west tab of the
-   next cell to the right.  Its south tab is the same as the north tab of the
-   cell immediately below.
-
-    When we define our grid, cell entry (0, 0) will be the top left
-    corner with the "y" values increasing as you go down the page.
-    That's the opposite of typical geometry from high school but
-    is not uncommon in graphics systems.
-*/
-
-/* Added a lock to the cell to keep things synced when solving with threads */
 typedef struct
 {
-    sem_t threadLock;
-    int north;
-    int west;
-    piece_t *piece;
-} cell_t;
+    long number;
+    solve_t solve;
+    double read_time;
+    double parsed_time;
+    char *output;
+    size_t length;
+    int done;
+} batch_job_t;
 
 typedef struct
 {
-    cell_t **cells;
-    int numcols;
-    int numrows;
-    int testnum;
-} grid_t;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t finished;
+    batch_job_t **jobs;
+    arena_t *arenas;
+    long window;
+    long submitted;
+    long handed;
+    long written;
+
+    /* The big puzzle every worker is to help with.  Workers notice a new
+       one by gang_round changing, and count themselves out on gang_left. */
+    solve_t *gang;
+    long gang_round;
+    int gang_left;
+
+    int stop;
+    int numThreads;
+    int mode;
+    int match;
+    int compact;
+    int stats;
+    int rotate;
+    long numbered;
+} batch_t;
 
-/* Create a sturct for all of the fill_any_dir arguments to pass into threads */
 typedef struct
 {
-    grid_t *grid;
-    piece_list_t *piece_list;
-    int start_col;
-    int start_row;
-    int inc_index;
-} fill_t;
+    batch_t *batch;
+    int worker;
+} batch_worker_t;
 
-
-/* Display the names of all the pieces in the grid. */
+/* Solve a small puzzle on this worker alone and format its solution, so
+   that the main thread only has to write it. */
 
 void
-print_grid( grid_t *grid )
+batch_solve( batch_t *batch, batch_job_t *job )
 {
-    int i, j;
+    solve_t *solve = &job->solve;
+    unsigned long long trace;
+
+    solve->start_time = now_ms();
+    puzzleThreadSolver( &solve->fills[0] );
+    solve->end_time = now_ms();
 
-    for (j = 0; j < grid->numrows; j++)
+    if (solve->input_ok && solve_complete( solve ))
     {
-        for (i = 0; i < grid->numcols; i++)
+        trace = trace_begin();
+        job->output = format_grid( &solve->grid, &solve->piece_list, batch->compact, &job->length );
+        trace_end( TRACE_FORMAT, trace, 0, solve->grid.numrows, 0 );
+        if (job->output == NULL)
         {
-            if (grid->cells[i][j].piece == NULL)
-            {
-                printf (". ");
-            }
-            else
-            {
-                printf ("%s ", grid->cells[i][j].piece->name);
-            }
+            fprintf(stderr, "Not enough memory to print puzzle %ld\n", job->number);
+            solve->input_ok = 0;
         }
-        printf ("\n");
     }
 }
 
-/* Display the set of tabs of the puzzle. */
+/* Workers take small puzzles off the window until they are told to stop,
+   joining in whenever a big puzzle comes along. */
 
-void
-print_edges( grid_t *grid )
+void *
+batch_worker( void *temp )
 {
-    int i, j;
-
-    for (j = 0; j < grid->numrows; j++)
+    batch_worker_t *self = (batch_worker_t *) temp;
+    batch_t *batch = self->batch;
+    batch_job_t *job;
+    solve_t *gang;
+    long round = 0;
+
+    trace_thread( "worker", self->worker );
+    pthread_mutex_lock( &batch->lock );
+    while (1)
     {
-        for (i = 0; i < grid->numcols; i++)
+        if (batch->gang_round != round)
+        {
+            round = batch->gang_round;
+            gang = batch->gang;
+            pthread_mutex_unlock( &batch->lock );
+
+            puzzleThreadSolver( &gang->fills[self->worker] );
+
+            pthread_mutex_lock( &batch->lock );
+            if (--batch->gang_left == 0)
+            {
+                pthread_cond_broadcast( &batch->finished );
+            }
+        }
+        else if (batch->handed < batch->submitted)
         {
-            printf ("   %3d", grid->cells[i][j].north);
+            job = batch->jobs[batch->handed % batch->window];
+            batch->handed++;
+            pthread_mutex_unlock( &batch->lock );
+
+            batch_solve( batch, job );
+
+            pthread_mutex_lock( &batch->lock );
+            job->done = 1;
+            pthread_cond_broadcast( &batch->finished );
         }
-        printf ("\n");
-        for (i = 0; i <= grid->numcols; i++)
+        else if (batch->stop)
         {
-            printf ("%3d   ", grid->cells[i][j].west);
+            break;
+        }
+        else
+        {
+            pthread_cond_wait( &batch->work, &batch->lock );
         }
-        printf ("\n");
-    }
-    for (i = 0; i < grid->numcols; i++)
-    {
-        printf ("   %3d", grid->cells[i][grid->numrows].north);
     }
-    printf ("\n");
+    pthread_mutex_unlock( &batch->lock );
+
+    return NULL;
 }
 
-/* Retrieve the puzzle configuration from stdin. */
+/* Write out a solved puzzle with its timing and free it.  Returns 0 if the
+   puzzle couldn't be solved or written. */
 
 int
-get_input( grid_t *grid, piece_list_t *piece_list )
+batch_write( batch_t *batch, batch_job_t *job )
 {
-    int return_value = 0;
-    char line[MAXLINELEN + 1];
-    cell_t *space;
-    char *token;
-    char *context;
-    int i;
-    int *cols = &(grid->numcols);
-    int *rows = &(grid->numrows);
-    piece_t **piece = &(piece_list->pieces);
-
-    /* Get the grid size. */
-
-    fgets( line, MAXLINELEN, stdin );
-    line[MAXLINELEN] = '\0';
-
-    sscanf( line, "%d %d", cols, rows );
+    solve_t *solve = &job->solve;
+    struct iovec iov;
+    unsigned long long trace;
+    int ok = solve->input_ok && solve_complete( solve );
 
-    /* Use a "trick" for two dimensional array space management.  Allocate
-       the entire 2d array as a sing sequence of cells and then build up
-       the 2d index by pointing into parts of that space.  The trick means
-       that we can release the whole 2d array with just two calls to "free". */
-
-    space = (cell_t *) malloc( (*rows + 1) * (*cols + 1) * sizeof( cell_t ) );
-    grid->cells = (cell_t **) malloc(      (*cols + 1) * sizeof( cell_t *) );
-
-    if ((space != NULL) && (grid->cells != NULL))
+    if (ok)
     {
-        /* Initialize the space. */
-
-        for (i = 0; i < *cols + 1; i++)
+        fprintf(stderr, "puzzle %ld: parse time: %.3f ms, wait time: %.3f ms, "
+                "piece parse and index build time: %.3f ms, solve time: %.3f ms\n",
+                job->number, job->parsed_time - job->read_time,
+                solve->start_time - job->parsed_time, solve->index_time - solve->start_time,
+                solve->end_time - solve->index_time);
+        if (solve->stats != NULL)
         {
-            grid->cells[i] = space + i * (*rows + 1);
+            solve_print_stats( solve, job->number );
         }
 
-        for (i = 0; i < (*rows + 1) * (*cols + 1); i++)
-        {
-            space[i].north = NO_PIECE_INDEX;
-            space[i].west = NO_PIECE_INDEX;
-            space[i].piece = NULL;
+        /* Anything already printed with stdio has to go out first. */
 
-            // Set up lock for this cell when the pieces are being set up
-            sem_init(&space[i].threadLock, 0, 1);
+        fflush( stdout );
+        if (job->output != NULL)
+        {
+            trace = trace_begin();
+            iov.iov_base = job->output;
+            iov.iov_len = job->length;
+            ok = write_all( 1, &iov, 1 );
+            trace_end( TRACE_WRITE, trace, (int) job->length, 0, 0 );
         }
-
-        /* Get the top. */
-
-        fgets( line, MAXLINELEN, stdin );
-        context = NULL;
-        token = strtok_r( line, " \n", &context);
-        for (i = 0; i < *cols; i++)
+        else
         {
-            grid->cells[i][0].north = atoi( strtok_r( NULL, " \n", &context ));
+            ok = print_grid( &solve->grid, &solve->piece_list, 1, batch->numThreads, batch->compact );
         }
+    }
+    else
+    {
+        fprintf(stderr, "puzzle %ld could not be solved\n", job->number);
+    }
 
-        /* Get the bottom. */
+    free( job->output );
+    solve_free( solve );
+    free( job );
 
-        fgets( line, MAXLINELEN, stdin );
-        context = NULL;
-        token = strtok_r( line, " \n", &context );
-        for (i = 0; i < *cols; i++)
-        {
-            grid->cells[i][*rows].north = atoi( strtok_r( NULL, " \n", &context ));
-        }
+    return ok;
+}
 
-        /* Get the left side. */
+/* Write out the finished puzzles at the front of the window, in order,
+   waiting for them until no more than limit puzzles are left in flight.
+   Returns 0 if any of them failed. */
 
-        fgets( line, MAXLINELEN, stdin );
-        context = NULL;
-        token = strtok_r( line, " \n", &context );
-        for (i = 0; i < *rows; i++)
+int
+batch_flush( batch_t *batch, long limit )
+{
+    batch_job_t *job;
+    int ok = 1;
+
+    pthread_mutex_lock( &batch->lock );
+    while (batch->written < batch->submitted)
+    {
+        job = batch->jobs[batch->written % batch->window];
+        if (job->done)
         {
-            grid->cells[0][i].west = atoi( strtok_r( NULL, " \n", &context ));
+            batch->written++;
+            pthread_mutex_unlock( &batch->lock );
+            ok = batch_write( batch, job ) && ok;
+            pthread_mutex_lock( &batch->lock );
         }
-
-        /* Get the right. */
-
-        fgets( line, MAXLINELEN, stdin );
-        context = NULL;
-        token = strtok_r( line, " \n", &context );
-        for (i = 0; i < *rows; i++)
+        else if (batch->submitted - batch->written > limit)
         {
-            grid->cells[*cols][i].west = atoi( strtok_r( NULL, " \n", &context ));
+            pthread_cond_wait( &batch->finished, &batch->lock );
         }
-
-        /* Get the pieces now. */
-
-        *piece = (piece_t *)malloc( *rows **cols * sizeof( piece_t ) );
-        piece_list->numpieces = *rows **cols;
-        if (*piece != NULL)
+        else
         {
-            for (i = 0; i < *rows **cols; i++)
-            {
-                fgets( line, MAXLINELEN, stdin );
-                sscanf( line, "%s %d %d %d %d", (*piece)[i].name,
-                        &((*piece)[i].tab[NORTH_TAB]), &((*piece)[i].tab[EAST_TAB]),
-                        &((*piece)[i].tab[SOUTH_TAB]), &((*piece)[i].tab[WEST_TAB]) );
-
-            }
+            break;
         }
-
-        return_value = 1;
     }
+    pthread_mutex_unlock( &batch->lock );
 
-    return return_value;
+    return ok;
 }
 
-/* Free up the memory that get_input allocates. */
+/* Solve a big puzzle with every worker, once everything ahead of it has
+   been written.  Returns 0 if it failed. */
 
-void
-release_memory( grid_t *grid, piece_list_t *piece_list )
+int
+batch_gang( batch_t *batch, batch_job_t *job )
 {
-    /* Get rid of all the pieces. */
-
-    free( piece_list->pieces );
-    piece_list->pieces = NULL;
-
-    /* Get rid of the puzzle grid. */
+    int ok = batch_flush( batch, 0 );
+
+    pthread_mutex_lock( &batch->lock );
+    job->solve.start_time = now_ms();
+    batch->gang = &job->solve;
+    batch->gang_left = batch->numThreads;
+    batch->gang_round++;
+    pthread_cond_broadcast( &batch->work );
+    while (batch->gang_left > 0)
+    {
+        pthread_cond_wait( &batch->finished, &batch->lock );
+    }
+    job->solve.end_time = now_ms();
+    pthread_mutex_unlock( &batch->lock );
 
-    free( grid->cells[0] );
-    free( grid->cells );
-    grid->cells = NULL;
+    return batch_write( batch, job ) && ok;
 }
 
+/* Solve every puzzle in an input.  The input has to stay around until all
+   of its puzzles are written, so this waits for them before returning.
+   Returns 0 if any puzzle failed; a puzzle that can't be read ends the
+   input, since there is no telling where the next one would start. */
 
-/* Have a function that traverses a row or a column, trying to fill in
-   pieces.  Only puzzle grid spots that have at least two tabs defined
-   are candidates to be filled in.
-
-   There are four possible directions to travel:
-     GO_LEFT_TO_RIGHT -- assumes that north and west of current cell are defined
-                         (like the top row)
-     GO_TOP_TO_BOTTOM -- assumes that north and east of current cell are defined
-                         (like the rightmost column)
-     GO_RIGHT_TO_LEFT -- assumes that east and south of current cell are defined
-                         (like the bottom row)
-     GO_BOTTOM_TO_TOP -- assumes that south and west of current cell are defined
-                         (like the leftmost column)
-
-   These four directions essentially let you go clockwise around the inside
-   of the puzzle boundary if you want.
-*/
-
-#define GO_LEFT_TO_RIGHT (0)
-#define GO_TOP_TO_BOTTOM (1)
-#define GO_RIGHT_TO_LEFT (2)
-#define GO_BOTTOM_TO_TOP (3)
-
-void
-fill_any_dir( grid_t *grid, piece_list_t *piece_list,
-              int start_col, int start_row, int inc_index )
+int
+batch_run( batch_t *batch, input_t *input )
 {
-    int j;
-    int found;
-    int row, col;
-    int col_inc[] = {1, 0, -1, 0};
-    int row_inc[] = {0, 1, 0, -1};
-    int count;
-
-    row = start_row;
-    col = start_col;
+    batch_job_t *job;
+    unsigned long long trace;
+    int ok = 1;
+    int small;
 
-    /* Loop through the entire column / row and stop when we hit an edge or a
-       puzzle grid cell that is already filled in. */
-
-    while ((row >= 0) && (col >= 0) && (row < grid->numrows) &&
-            (col < grid->numcols))
+    while (input_more( input ))
     {
-        // Wait for piece to unlock and then solve it if not solved
-        sem_wait(&grid->cells[col][row].threadLock);
-
-        // If solved skip and unlock, else solve
-        if (grid->cells[col][row].piece == NULL)
-        {
-
-            /* Ensure that we're ready for the piece by making sure that at least
-               two tabs are defined. */
+        /* Make sure the next place in the window, and its arena, are free. */
 
-            count = 0;
-            if (grid->cells[col][row].north != NO_PIECE_INDEX) count++;
-            if (grid->cells[col][row].west != NO_PIECE_INDEX) count++;
-            if (grid->cells[col][row + 1].north != NO_PIECE_INDEX) count++;
-            if (grid->cells[col + 1][row].west != NO_PIECE_INDEX) count++;
-
-            if (count >= 2)
-            {
-                /* Search the set of pieces for what will go in this grid position. */
-
-                found = NO_PIECE_INDEX;
-                for (j = 0; (j < grid->numcols * grid->numrows) && (found == NO_PIECE_INDEX); j++)
-                {
-
-                    /* I will find the first piece whose tabs match the defined tabs of
-                       the grid cell.  This will find the unique pieces _if_ the grid
-                       cell has at least two adjacent tabs that are not -1. */
-
-                    if (
-                        ((grid->cells[col][row].north == NO_PIECE_INDEX) ||
-                         (grid->cells[col][row].north == piece_list->pieces[j].tab[NORTH_TAB])) &&
-                        ((grid->cells[col + 1][row].west == NO_PIECE_INDEX) ||
-                         (grid->cells[col + 1][row].west == piece_list->pieces[j].tab[EAST_TAB])) &&
-                        ((grid->cells[col][row + 1].north == NO_PIECE_INDEX) ||
-                         (grid->cells[col][row + 1].north == piece_list->pieces[j].tab[SOUTH_TAB])) &&
-                        ((grid->cells[col][row].west == NO_PIECE_INDEX) ||
-                         (grid->cells[col][row].west == piece_list->pieces[j].tab[WEST_TAB]))
-                    )
-                    {
-                        found = j;
-                    }
-                }
-
-                /* When we get the piece, fit it into the grid and update the tabs of
-                   the grid for all surrounding grid cells. */
-
-                if (found != NO_PIECE_INDEX)
-                {
-                    grid->cells[col][row].piece = &(piece_list->pieces[found]);
-                    grid->cells[col][row].north = piece_list->pieces[found].tab[NORTH_TAB];
-                    grid->cells[col + 1][row].west = piece_list->pieces[found].tab[EAST_TAB];
-                    grid->cells[col][row + 1].north = piece_list->pieces[found].tab[SOUTH_TAB];
-                    grid->cells[col][row].west = piece_list->pieces[found].tab[WEST_TAB];
-                }
-                else
-                {
-                    printf("Error piece not found!!!\n");
-                }
-            }
-
-            // Unlock after solving the piece
-            sem_post(&grid->cells[col][row].threadLock);
+        ok = batch_flush( batch, batch->window - 1 ) && ok;
 
+        job = (batch_job_t *) calloc( 1, sizeof( batch_job_t ) );
+        if (job == NULL)
+        {
+            fprintf(stderr, "Not enough memory for another puzzle\n");
+            ok = 0;
+            break;
         }
-        // Unlock if piece is solved after getting access to the critical section
-        else
+        job->number = batch->numbered++;
+        job->read_time = now_ms();
+        trace = trace_begin();
+
+        job->solve.arena = &batch->arenas[batch->submitted % batch->window];
+        job->solve.input = *input;
+        if (!get_input( &job->solve.input, &job->solve.grid, &job->solve.piece_list,
+                        job->solve.arena ))
+        {
+            free( job );
+            ok = 0;
+            break;
+        }
+        job->solve.input.end = find_pieces_end( &job->solve.input, job->solve.piece_list.numpieces );
+        input->pos = job->solve.input.end;
+        job->parsed_time = now_ms();
+        trace_end( TRACE_PARSE, trace, (int) job->number, 0, 0 );
+
+        small = job->solve.piece_list.numpieces < BATCH_SMALL_PIECES;
+        if (!solve_init( &job->solve, small ? 1 : batch->numThreads, batch->mode, batch->match,
+                         batch->stats, batch->rotate ))
         {
-            sem_post(&grid->cells[col][row].threadLock);
+            release_memory( &job->solve.grid, &job->solve.piece_list );
+            free( job );
+            ok = 0;
+            break;
         }
 
-        /* Go to the next grid cell in the direction given as a parameter. */
-        row += row_inc[inc_index];
-        col += col_inc[inc_index];
+        if (!small)
+        {
+            ok = batch_gang( batch, job ) && ok;
+            continue;
+        }
 
+        pthread_mutex_lock( &batch->lock );
+        batch->jobs[batch->submitted % batch->window] = job;
+        batch->submitted++;
+        pthread_cond_signal( &batch->work );
+        pthread_mutex_unlock( &batch->lock );
     }
+
+    return batch_flush( batch, 0 ) && ok;
 }
 
-/* This function is called when a new thread is created, and starts in a position
-   dependent on the fill sturct contents */
-void *puzzleThreadSolver(void *temp)
-{
-    // Set temp to a fill_t struct
-    fill_t *fill = (fill_t *)temp;
+/* Solve the puzzles in each of the files, or on stdin if there are none,
+   with a pool of numThreads workers.  Returns the exit status. */
 
-    // Define variables to pass into fill_in_dir
-    piece_list_t *piece_list;
-    grid_t *grid;
+int
+batch_main( int numThreads, int mode, int match, int compact, int stats, int rotate,
+            size_t huge_threshold, numa_t *numa, char **files, int numfiles )
+{
+    pthread_t workers[numThreads];
+    pthread_attr_t attr;
+    batch_worker_t selves[numThreads];
+    batch_t batch;
+    input_t input;
+    double start_time;
+    unsigned long long trace;
+    int return_value = 0;
+    int ok;
+    int fd;
     int i;
-    int start_col;
-    int start_row;
-    int inc_index;
-
-    // Get info to pass into fill_to_dir
-    grid = fill->grid;
-    piece_list = fill->piece_list;
-    start_col = fill->start_col;
-    start_row = fill->start_row;
-    inc_index = fill->inc_index;
-
-    /* Logic for running each thread and which corner and direction */
-    // Call fill_to_dir based on inc_index and start row
-
-    /* Left to right and right to left */
-    // Top left
-    if (inc_index == GO_LEFT_TO_RIGHT && start_row == 0)
+
+    memset( &batch, 0, sizeof( batch ) );
+    batch.numThreads = numThreads;
+    batch.mode = mode;
+    batch.match = match;
+    batch.compact = compact;
+    batch.stats = stats;
+    batch.rotate = rotate;
+    batch.window = BATCH_WINDOW * numThreads;
+    batch.jobs = (batch_job_t **) malloc( batch.window * sizeof( batch_job_t * ) );
+    batch.arenas = (arena_t *) malloc( batch.window * sizeof( arena_t ) );
+    if ((batch.jobs == NULL) || (batch.arenas == NULL))
     {
-        for (i = start_row; i < grid->numrows; i++)
-        {
-            //printf("Test1 Col:%d Row%d\n", start_col, i);
-            fill_any_dir(grid, piece_list, start_col, i, GO_LEFT_TO_RIGHT);
-        }
+        fprintf(stderr, "Not enough memory for batch mode\n");
+        free( batch.jobs );
+        free( batch.arenas );
+        return 1;
     }
-
-    // Bottom right
-    if (inc_index == GO_RIGHT_TO_LEFT && start_row == grid->numrows - 1)
+    for (i = 0; i < batch.window; i++)
     {
-        for (i = start_row; i >= 0; i--)
-        {
-            //printf("Test2 Col:%d Row%d\n", start_col, i);
-            fill_any_dir(grid, piece_list, start_col, i, GO_RIGHT_TO_LEFT);
-        }
+        arena_init( &batch.arenas[i], huge_threshold );
+        batch.arenas[i].first_touch = (numa != NULL) && numa->first_touch;
     }
+    pthread_mutex_init( &batch.lock, NULL );
+    pthread_cond_init( &batch.work, NULL );
+    pthread_cond_init( &batch.finished, NULL );
 
-    //Top right
-    if (inc_index == GO_RIGHT_TO_LEFT && start_row == 0)
+    start_time = now_ms();
+    for (i = 0; i < numThreads; i++)
     {
-        for (i = start_row; i < grid->numrows; i++)
+        selves[i].batch = &batch;
+        selves[i].worker = i;
+        pthread_attr_init( &attr );
+        numa_attr( numa, &attr, i );
+        if (pthread_create(&workers[i], &attr, &batch_worker, &selves[i]))
         {
-            //printf("Test3 Col:%d Row%d\n", start_col, i);
-            fill_any_dir(grid, piece_list, start_col, i, GO_RIGHT_TO_LEFT);
+            fprintf(stderr, "Error creating thread\n");
+            exit( 2 );
         }
+        pthread_attr_destroy( &attr );
     }
 
-    //Bottom left
-    if (inc_index == GO_LEFT_TO_RIGHT && start_row == grid->numrows - 1)
+    for (i = 0; (i < numfiles) || ((i == 0) && (numfiles == 0)); i++)
     {
-        for (i = start_row; i >= 0; i--)
+        fd = (numfiles == 0) ? 0 : open( files[i], O_RDONLY );
+        if (fd < 0)
         {
-            //printf("Test4 Col:%d Row%d\n", start_col, i);
-            fill_any_dir(grid, piece_list, start_col, i, GO_LEFT_TO_RIGHT);
+            perror( files[i] );
+            return_value = 1;
+            continue;
         }
-    }
-
-    /* Top to bottom and bottom to top */
-
-    // Top left
-    if (inc_index == GO_TOP_TO_BOTTOM && start_col == 0)
-    {
-        for (i = start_col; i < grid->numcols; i++)
+        trace = trace_begin();
+        ok = input_read( &input, fd );
+        trace_end( TRACE_READ, trace, 0, 0, 0 );
+        if (!ok)
         {
-            //printf("Test5 Col:%d Row%d\n", i, start_row);
-            fill_any_dir(grid, piece_list, i, start_row, GO_TOP_TO_BOTTOM);
+            return_value = 1;
         }
-    }
-
-    // Bottom right
-    if (inc_index == GO_BOTTOM_TO_TOP && start_col == grid->numcols - 1)
-    {
-        for (i = start_col; i >= 0; i--)
+        else
         {
-            //printf("Test6 Col:%d Row%d\n", i, start_row);
-            fill_any_dir(grid, piece_list, i, start_row, GO_BOTTOM_TO_TOP);
+            if (!batch_run( &batch, &input ))
+            {
+                return_value = 1;
+            }
+            input_close( &input );
+        }
+        if (fd != 0)
+        {
+            close( fd );
         }
     }
 
-    //Top right
-    if (inc_index == GO_TOP_TO_BOTTOM && start_col == grid->numcols - 1)
+    pthread_mutex_lock( &batch.lock );
+    batch.stop = 1;
+    pthread_cond_broadcast( &batch.work );
+    pthread_mutex_unlock( &batch.lock );
+    for (i = 0; i < numThreads; i++)
     {
-        for (i = start_col; i >= 0; i--)
-        {
-            //printf("Test7 Col:%d Row%d\n", i, start_row);
-            fill_any_dir(grid, piece_list, i, start_row, GO_TOP_TO_BOTTOM);
-        }
+        pthread_join( workers[i], NULL );
     }
 
-    //Bottom left
-    if (inc_index == GO_BOTTOM_TO_TOP && start_col == 0)
+    fprintf(stderr, "batch: %ld puzzles in %.3f ms\n", batch.numbered, now_ms() - start_time);
+
+    pthread_cond_destroy( &batch.finished );
+    pthread_cond_destroy( &batch.work );
+    pthread_mutex_destroy( &batch.lock );
+    for (i = 0; i < batch.window; i++)
     {
-        for (i = start_col; i < grid->numcols; i++)
-        {
-            //printf("Test8 Col:%d Row%d\n", i, start_row);
-            fill_any_dir(grid, piece_list, i, start_row, GO_BOTTOM_TO_TOP);
-        }
+        arena_free( &batch.arenas[i] );
     }
+    free( batch.arenas );
+    free( batch.jobs );
 
-    return NULL;
+    return return_value;
 }
 
 int
@@ -489,9 +451,124 @@ main( int argc, char **argv )
     /* Take in the threads from command line using argv and create
        that many threads */
     int numThreads;
+    int mode = SOLVE_SWEEP;
+    int compact = 0;
+    int match = MATCH_INDEX;
+    int batch = 0;
+    int stats = 0;
+    int rotate = 0;
+    int window_rows = -1;
+    int affinity = 0;
+    int first_touch = 0;
+    numa_t numa;
+    numa_t *placement = NULL;
+    int return_value = 0;
+    int numfiles = 0;
+    size_t huge_threshold = ARENA_HUGE_THRESHOLD;
+    const char *trace_path = NULL;
+    unsigned long long trace;
+    int arg;
+
+    for (arg = 2; arg < argc; arg++)
+    {
+        if (strcmp(argv[arg], "--mode=sweep") == 0)
+        {
+            mode = SOLVE_SWEEP;
+        }
+        else if (strcmp(argv[arg], "--mode=wavefront") == 0)
+        {
+            mode = SOLVE_WAVEFRONT;
+        }
+        else if (strcmp(argv[arg], "--mode=dataflow") == 0)
+        {
+            mode = SOLVE_DATAFLOW;
+        }
+        else if (strcmp(argv[arg], "--mode=pipeline") == 0)
+        {
+            mode = SOLVE_PIPELINE;
+        }
+        else if (strcmp(argv[arg], "--match=index") == 0)
+        {
+            match = MATCH_INDEX;
+        }
+        else if (strcmp(argv[arg], "--match=scan") == 0)
+        {
+            match = MATCH_SCAN;
+        }
+        else if (strcmp(argv[arg], "--match=scalar") == 0)
+        {
+            match = MATCH_SCALAR;
+        }
+        else if (strcmp(argv[arg], "--compact") == 0)
+        {
+            compact = 1;
+        }
+        else if (strcmp(argv[arg], "--batch") == 0)
+        {
+            batch = 1;
+        }
+        else if (strcmp(argv[arg], "--stats") == 0)
+        {
+            stats = 1;
+        }
+        else if (strcmp(argv[arg], "--rotate") == 0)
+        {
+            rotate = 1;
+        }
+        else if (strcmp(argv[arg], "--out-of-core") == 0)
+        {
+            if (window_rows < 0)
+            {
+                window_rows = 0;
+            }
+        }
+        else if (strncmp(argv[arg], "--window=", 9) == 0)
+        {
+            window_rows = atoi(argv[arg] + 9);
+            if (window_rows < WINDOW_MIN_ROWS)
+            {
+                printf("The window must be at least %d rows\n", WINDOW_MIN_ROWS);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[arg], "--affinity") == 0)
+        {
+            affinity = 1;
+        }
+        else if (strcmp(argv[arg], "--numa") == 0)
+        {
+            affinity = 1;
+            first_touch = 1;
+        }
+        else if (strcmp(argv[arg], "--no-hugepages") == 0)
+        {
+            huge_threshold = 0;
+        }
+        else if ((strncmp(argv[arg], "--trace=", 8) == 0) && (argv[arg][8] != '\0'))
+        {
+            trace_path = argv[arg] + 8;
+        }
+        else if (argv[arg][0] != '-')
+        {
+            // Batch mode reads puzzles from files named after the options
+            argv[2 + numfiles] = argv[arg];
+            numfiles++;
+        }
+        else
+        {
+            printf("Unknown option %s\n", argv[arg]);
+            return 1;
+        }
+    }
+
     if (argc >= 2)
     {
         numThreads = atoi(argv[1]);
+        if (numThreads < 1)
+        {
+            printf("The number of threads must be at least 1\n");
+            return 1;
+        }
     }
     else
     {
@@ -499,105 +576,148 @@ main( int argc, char **argv )
         return 1;
     }
 
-    // Define threads array
-    pthread_t puzzleThread[numThreads];
-    fill_t fillArray[numThreads];
+    if ((numfiles > 0) && !batch)
+    {
+        printf("Puzzle files can only be given with --batch\n");
+        return 1;
+    }
 
-    // Define values to get from input for grid and piece list
-    int return_value = 0;
-    piece_list_t piece_list;
-    grid_t grid;
-    int i;
+    if (batch && (window_rows >= 0))
+    {
+        printf("Batch mode can't solve out of core\n");
+        return 1;
+    }
 
-    // Get input from STDIN for piece list and grid
-    if (get_input( &grid, &piece_list ))
+    if (rotate && (window_rows >= 0))
+    {
+        printf("Turned pieces can't be solved out of core\n");
+        return 1;
+    }
+
+    if ((trace_path != NULL) && (window_rows >= 0))
     {
+        printf("The out-of-core solver can't be traced\n");
+        return 1;
+    }
 
-        /* Create all of the structs to pass in with the threads */
-        for (i = 0; i < numThreads; i++)
-        {
-            fillArray[i].grid = &grid;
-            fillArray[i].piece_list = &piece_list;
+    if ((trace_path != NULL) && !trace_open( trace_path ))
+    {
+        return 1;
+    }
 
-            // Pick which corner to put the thread in, and to go which direction
-            if (i % 8 == 0) // Top left
-            {
-                fillArray[i].start_col = 0;
-                fillArray[i].start_row = 0;
-                fillArray[i].inc_index = GO_LEFT_TO_RIGHT;
-            }
-            else if (i % 8 == 1) // Bottom right
-            {
-                fillArray[i].start_col = grid.numcols - 1;
-                fillArray[i].start_row = grid.numrows - 1;
-                fillArray[i].inc_index = GO_RIGHT_TO_LEFT;
-            }
-            else if (i % 8 == 2) // Top right
-            {
-                fillArray[i].start_col = grid.numcols - 1;
-                fillArray[i].start_row = 0;
-                fillArray[i].inc_index = GO_RIGHT_TO_LEFT;
-            }
-            else if ( i % 8 == 3) // Bottom left
-            {
-                fillArray[i].start_col = 0;
-                fillArray[i].start_row = grid.numrows - 1;
-                fillArray[i].inc_index = GO_LEFT_TO_RIGHT;
-            }
-            else if ( i % 8 == 4) // Top left top-bottom
-            {
-                fillArray[i].start_col = 0;
-                fillArray[i].start_row = 0;
-                fillArray[i].inc_index = GO_TOP_TO_BOTTOM;
-            }
-            else if ( i % 8 == 5) // Bottom right bottom-top
-            {
-                fillArray[i].start_col = grid.numcols - 1;
-                fillArray[i].start_row = grid.numrows - 1;
-                fillArray[i].inc_index = GO_BOTTOM_TO_TOP;
-            }
-            else if ( i % 8 == 6) // Top right top-bottom
-            {
-                fillArray[i].start_col = grid.numcols - 1;
-                fillArray[i].start_row = 0;
-                fillArray[i].inc_index = GO_TOP_TO_BOTTOM;
-            }
-            else if ( i % 8 == 7) // Bottom left bottom-top
-            {
-                fillArray[i].start_col = 0;
-                fillArray[i].start_row = grid.numrows - 1;
-                fillArray[i].inc_index = GO_BOTTOM_TO_TOP;
-            }
-        }
+    if (window_rows >= 0)
+    {
+        match_select( match != MATCH_SCALAR );
+        return window_main( numThreads, window_rows, compact, huge_threshold );
+    }
 
-        /* Create all of the threads at once */
-        for (i = 0; i < numThreads; i++)
+    if (batch)
+    {
+        match_select( match != MATCH_SCALAR );
+        if (affinity && numa_init( &numa, first_touch ))
         {
-            // Create a single puzzle thread to solve starting in top left
-            if (pthread_create(&puzzleThread[i], NULL, &puzzleThreadSolver, &fillArray[i]))
-            {
-                fprintf(stderr, "Error creating thread\n");
-            }
+            placement = &numa;
         }
-
-        /* End Thread creation */
-
-        // Wait for threads to finish that are created and join them to main
-        for (i = 0; i < numThreads; i++)
+        else if (affinity)
         {
-            // Wait for puzzle threads to end
-            if (pthread_join(puzzleThread[i], NULL))
-            {
-                fprintf(stderr, "Error joining thread\n");
-                return_value = 2;
-            }
+            fprintf(stderr, "Can't find the CPUs to pin the threads to, leaving them be\n");
+        }
+        return_value = batch_main( numThreads, mode, match, compact, stats, rotate, huge_threshold,
+                                   placement, argv + 2, numfiles );
+        if (placement != NULL)
+        {
+            numa_free( placement );
         }
+        if (!trace_close())
+        {
+            return_value = 1;
+        }
+        return return_value;
+    }
+
+    /* A single puzzle is solved through the library, which starts the
+       threads and writes the solution into a buffer of its own. */
+
+    puzzle_options_t options;
+    puzzle_view_t view;
+    puzzle_result_t result;
+    puzzle_ctx_t *ctx;
+    input_t input;
+    double read_time;
+    struct iovec iov;
+    int status;
+
+    puzzle_options_init( &options );
+    options.mode = mode;
+    options.match = match;
+    options.compact = compact;
+    options.stats = stats;
+    options.rotate = rotate;
+    options.affinity = affinity;
+    options.numa = first_touch;
+    options.huge_threshold = huge_threshold;
+
+    // Get input from STDIN for piece list and grid
+    read_time = now_ms();
+    trace = trace_begin();
+    if (!input_read( &input, 0 ))
+    {
+        trace_close();
+        return 1;
+    }
+    trace_end( TRACE_READ, trace, 0, 0, 0 );
+    read_time = now_ms() - read_time;
+
+    ctx = puzzle_ctx_create( numThreads, &options );
+    if (ctx == NULL)
+    {
+        fprintf(stderr, "Error creating threads\n");
+        input_close( &input );
+        trace_close();
+        return 2;
+    }
+
+    view.data = input.data;
+    view.length = input.length;
+    result.buffer = NULL;
+    result.capacity = 0;
+    status = puzzle_solve( ctx, &view, &result );
+    if (status == PUZZLE_OK)
+    {
+        fprintf(stderr, "parse time: %.3f ms\n", read_time + result.parse_ms);
+        fprintf(stderr, "piece parse and index build time: %.3f ms\n", result.index_ms);
+        fprintf(stderr, "solve time: %.3f ms\n", result.solve_ms);
 
         /* Show what the puzzle came out to be. */
 
-        print_grid( &grid );
+        trace = trace_begin();
+        iov.iov_base = result.buffer;
+        iov.iov_len = result.length;
+        if (!write_all( 1, &iov, 1 ))
+        {
+            return_value = 1;
+        }
+        trace_end( TRACE_WRITE, trace, (int) result.length, 0, 0 );
+    }
+    else
+    {
+        if (status == PUZZLE_NO_MEMORY)
+        {
+            fprintf(stderr, "Not enough memory to solve the puzzle\n");
+        }
+        else if (status == PUZZLE_UNSOLVED)
+        {
+            fprintf(stderr, "The puzzle has no solution\n");
+        }
+        return_value = 1;
+    }
 
-        release_memory( &grid, &piece_list );
+    free( result.buffer );
+    puzzle_ctx_destroy( ctx );
+    input_close( &input );
+    if (!trace_close())
+    {
+        return_value = 1;
     }
 
     // Exit the program with return value
@@ -0,0 +1,431 @@
+
+#ifndef PUZZLE_H
+#define PUZZLE_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "binfmt.h"
+
+#define LABEL_LEN (12)
+
+/* Input that can't be mapped (a pipe, say) is read in blocks of at least
+   this many bytes. */
+#define READ_BLOCK_LEN (1 << 20)
+
+/* Each puzzle piece is an array of 4 tabs ordered clockwise and starting
+   at the top (north) tab. */
+
+#define NORTH_TAB (0)
+#define EAST_TAB (1)
+#define SOUTH_TAB (2)
+#define WEST_TAB (3)
+
+#define NO_PIECE_INDEX (-1)
+
+/* Pairs of neighbouring tabs, going clockwise.  Pair kind k is made of
+   tab k and tab (k+1)%4, so PAIR_NE is the north and east tabs. */
+
+#define PAIR_NE (0)
+#define PAIR_ES (1)
+#define PAIR_SW (2)
+#define PAIR_WN (3)
+
+/* The pieces are kept as a structure of arrays: tab[k][i] is tab k of piece
+   i, so that scanning the pieces for a match only reads the tabs it
+   compares.  The names are kept apart in an arena, name_stride bytes each,
+   and end with a NUL unless they fill their slot.  A binary puzzle's names
+   are used where they lie in the mapped file, and so are its tabs when they
+   are 4 bytes wide; tab_space and name_space are whatever had to be
+   allocated.  rotated says that the pieces may have come turned any way
+   round (--rotate), so that they have to be turned to fit. */
+
+typedef struct
+{
+    int *tab[4];
+    char *names;
+    size_t name_stride;
+    long numpieces;
+    int *tab_space;
+    char *name_space;
+    int rotated;
+} piece_list_t;
+
+static inline char *
+piece_name( piece_list_t *piece_list, long piece )
+{
+    return piece_list->names + piece * piece_list->name_stride;
+}
+
+/* A piece as it is placed: its number, with the number of quarter turns
+   clockwise it was given in the top two bits.  Turning a piece t times
+   moves its tab k round to (k + t) % 4.  Cells keep their piece this way;
+   unless the pieces are rotated, the turns are always 0 and a placed piece
+   is just its number. */
+
+#define TURN_SHIFT (30)
+
+/* Piece numbers have to leave the top two bits free, and with them set
+   the largest number would be NO_PIECE_INDEX (and INDEX_EMPTY), so a
+   puzzle has fewer pieces than this. */
+
+#define MAX_PIECES ((1L << TURN_SHIFT) - 1)
+
+#define PLACED(piece, turn) ((int) ((unsigned int) (piece) | ((unsigned int) (turn) << TURN_SHIFT)))
+#define PLACED_PIECE(placed) ((long) ((unsigned int) (placed) & ((1u << TURN_SHIFT) - 1)))
+#define PLACED_TURN(placed) ((int) ((unsigned int) (placed) >> TURN_SHIFT))
+
+/* The tab a placed piece shows in direction dir. */
+
+static inline int
+placed_tab( piece_list_t *piece_list, int placed, int dir )
+{
+    return piece_list->tab[(dir - PLACED_TURN( placed )) & 3][PLACED_PIECE( placed )];
+}
+
+/* A cell in the grid knows its north and west tabs.  Since this cell is
+   expected to be in a grid, its east tab is the same as the west tab of the
+   next cell to the right.  Its south tab is the same as the north tab of the
+   cell immediately below.
+
+    When we define our grid, cell entry (0, 0) will be the top left
+    corner with the "y" values increasing as you go down the page.
+    That's the opposite of typical geometry from high school but
+    is not uncommon in graphics systems.
+*/
+
+/* Threads claim a cell through its state word before solving it: an empty
+   cell is claimed with a compare and swap and then either filled or handed
+   back as empty.  The tab values are shared with neighbouring cells, so they
+   are always read and written atomically; a filler publishes its tabs with
+   release stores before it marks the cell filled. */
+
+#define CELL_EMPTY (0)
+#define CELL_CLAIMED (1)
+#define CELL_FILLED (2)
+
+#define LOAD_TAB(tab) __atomic_load_n( &(tab), __ATOMIC_ACQUIRE )
+#define STORE_TAB(tab, value) __atomic_store_n( &(tab), (value), __ATOMIC_RELEASE )
+
+typedef struct
+{
+    int state;
+    int north;
+    int west;
+    int piece;
+} cell_t;
+
+/* Claim an empty cell.  Returns 0 if the cell is already filled or another
+   thread got to it first. */
+
+static inline int
+cell_claim( cell_t *cell )
+{
+    int expected = CELL_EMPTY;
+
+    return (__atomic_load_n( &cell->state, __ATOMIC_ACQUIRE ) == CELL_EMPTY) &&
+           __atomic_compare_exchange_n( &cell->state, &expected, CELL_CLAIMED, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED );
+}
+
+/* Hand a claimed cell back, either filled or still empty. */
+
+static inline void
+cell_release( cell_t *cell, int state )
+{
+    __atomic_store_n( &cell->state, state, __ATOMIC_RELEASE );
+}
+
+/* The whole puzzle input, mapped from the file when we can and read into
+   memory otherwise, along with where the scanner has got to in it.  The
+   scanner never reads past end, which is normally the end of the input;
+   threads parsing pieces each set it to the end of the current line.
+   When the input is a binary puzzle, binary points at its header. */
+
+typedef struct
+{
+    char *data;
+    size_t length;
+    size_t pos;
+    size_t end;
+    int mapped;
+    const binfmt_header_t *binary;
+} input_t;
+
+/* An arena that a solver allocates a puzzle's memory from (see arena.c).
+   Allocations are aligned to ARENA_ALIGN bytes.  Arenas of at least
+   ARENA_HUGE_THRESHOLD bytes use huge pages of ARENA_HUGE_PAGE bytes when
+   the system has them.  A grid allocated from an arena with first_touch set
+   is left untouched for the solving threads to set up (see grid_touch), so
+   that its pages end up on the NUMA nodes of the threads that use them. */
+
+#define ARENA_ALIGN (64)
+#define ARENA_HUGE_PAGE (2 << 20)
+#define ARENA_HUGE_THRESHOLD (32 << 20)
+
+typedef struct
+{
+    char *base;
+    size_t size;
+    size_t used;
+    size_t huge_threshold;
+    int first_touch;
+} arena_t;
+
+/* The cells of the grid are stored in square tiles of GRID_TILE x GRID_TILE
+   cells, each tile contiguous and the tiles in row order, so that a sweep
+   along a row and a sweep down a column both stay within a few cache lines
+   for GRID_TILE cells at a time.  With 16 byte cells a tile row is two
+   cache lines and a whole tile is 1 KB.  Always go through grid_cell.
+   edges holds the boundaries of a grid that is left for the threads to
+   touch (the top, bottom, left and right, one after the other) until
+   grid_touch puts them in; it is NULL if get_input put them in itself. */
+
+#define GRID_TILE_SHIFT (3)
+#define GRID_TILE (1 << GRID_TILE_SHIFT)
+#define GRID_TILE_MASK (GRID_TILE - 1)
+
+typedef struct
+{
+    cell_t *cells;
+    size_t tile_cols;
+    int numcols;
+    int numrows;
+    int testnum;
+    int *edges;
+} grid_t;
+
+/* The cell at col, row.  col can be numcols and row can be numrows, for the
+   right and bottom boundaries. */
+
+static inline cell_t *
+grid_cell( grid_t *grid, int col, int row )
+{
+    size_t tile = (row >> GRID_TILE_SHIFT) * grid->tile_cols + (col >> GRID_TILE_SHIFT);
+
+    return grid->cells + (tile << (2 * GRID_TILE_SHIFT)) +
+           ((row & GRID_TILE_MASK) << GRID_TILE_SHIFT) + (col & GRID_TILE_MASK);
+}
+
+/* The tab-pair index.  Every piece is entered four times, once for each
+   pair of neighbouring tabs.  The generator guarantees that every such pair
+   is unique within a puzzle, so any two adjacent tabs of a grid cell name
+   exactly one piece.  The index is an open addressing hash table whose slots
+   hold the piece number with the pair kind in the top two bits; the tab
+   values themselves are read back from the piece when probing.  A binary
+   puzzle can carry a ready-made index, in which case the slots are borrowed
+   from the input rather than allocated.  Puzzles from elsewhere may not
+   keep the generator's promise: ambiguous counts the pairs entered that
+   another piece already had (for a borrowed index, just whether the file
+   says there are any), and a puzzle with any is solved exactly instead
+   (see fill_exact).  Probing stops at an empty slot, so a borrowed index
+   counts its empty slots as it is checked (empty), and one without any is
+   refused.  With --match=scan or scalar the index is still built, to count
+   ambiguous, but scan says find_piece should look pieces up by scanning.
+
+   When the pieces are rotated, a pair is hashed by its tabs alone, so the
+   four entries of a piece are its four pairs going clockwise whichever
+   way round it came; a cell's pair of any kind finds the piece under the
+   kind it came in as, which says how far to turn it (index_find_turned). */
+
+#define INDEX_EMPTY (0xffffffffu)
+#define INDEX_KIND_SHIFT (30)
+#define INDEX_PIECE_MASK ((1u << INDEX_KIND_SHIFT) - 1)
+
+typedef struct
+{
+    unsigned int *slots;
+    size_t mask;
+    int borrowed;
+    long ambiguous;
+    long empty;
+    int scan;
+} index_t;
+
+/* arena.c */
+
+void arena_init( arena_t *arena, size_t huge_threshold );
+int arena_reserve( arena_t *arena, size_t size );
+void *arena_alloc( arena_t *arena, size_t size );
+void arena_reset( arena_t *arena );
+void arena_free( arena_t *arena );
+
+/* input.c */
+
+void release_memory( grid_t *grid, piece_list_t *piece_list );
+int input_read( input_t *input, int fd );
+void input_close( input_t *input );
+void input_error( input_t *input, const char *expected );
+int get_input( input_t *input, grid_t *grid, piece_list_t *piece_list, arena_t *arena );
+void grid_touch( grid_t *grid, int thread_id, int numThreads );
+void input_chunk( input_t *input, int thread_id, int numThreads, size_t *start, size_t *end );
+long count_piece_lines( const char *data, size_t start, size_t end );
+long parse_pieces( input_t *input, size_t end, piece_list_t *piece_list, long first,
+                   index_t *index );
+int get_pieces( input_t *input, piece_list_t *piece_list );
+size_t find_pieces_end( input_t *input, long numpieces );
+int input_more( input_t *input );
+int copy_binary_pieces( input_t *input, piece_list_t *piece_list, long first, long last,
+                        index_t *index );
+
+/* match.c */
+
+/* How find_piece looks pieces up: through the tab-pair index, or by
+   scanning, with the fastest kernel the processor has or with plain C. */
+
+#define MATCH_INDEX (0)
+#define MATCH_SCAN (1)
+#define MATCH_SCALAR (2)
+
+/* A scan kernel returns the first piece from first up to last whose tabs
+   agree with the known tabs in tabs[] (NO_PIECE_INDEX matches anything),
+   or NO_PIECE_INDEX. */
+
+typedef long (*match_fn)( piece_list_t *piece_list, long first, long last, const int tabs[4] );
+
+long match_scalar( piece_list_t *piece_list, long first, long last, const int tabs[4] );
+long match_sse( piece_list_t *piece_list, long first, long last, const int tabs[4] );
+long match_avx2( piece_list_t *piece_list, long first, long last, const int tabs[4] );
+const char *match_select( int vector );
+long match_scan( piece_list_t *piece_list, const int tabs[4] );
+
+/* output.c */
+
+/* Grids with fewer cells than this are printed on one thread.  Each
+   printing thread formats roughly this many bytes at a time. */
+
+#define PRINT_THREADED_CELLS (16384)
+#define PRINT_BUFFER_LEN (1 << 20)
+
+/* The most a cell of the solution takes: a name, its turns when the
+   pieces are rotated, and a space. */
+
+#define CELL_TEXT_LEN (LABEL_LEN + 3)
+
+int write_all( int fd, struct iovec *iov, int count );
+size_t measure_rows( grid_t *grid, piece_list_t *piece_list, int compact, int first, int last );
+size_t format_rows( grid_t *grid, piece_list_t *piece_list, int compact, int first, int last,
+                    char *buffer );
+char *format_grid( grid_t *grid, piece_list_t *piece_list, int compact, size_t *length );
+int print_grid( grid_t *grid, piece_list_t *piece_list, int fd, int numThreads, int compact );
+void print_edges( grid_t *grid );
+
+/* index.c */
+
+size_t index_hash( int kind, int first, int second );
+size_t index_capacity( long numpieces );
+int index_alloc( index_t *index, piece_list_t *piece_list, arena_t *arena );
+int index_borrow( index_t *index, input_t *input );
+void index_clear( index_t *index, int thread_id, int numThreads );
+void index_insert( index_t *index, piece_list_t *piece_list, long piece, int kind );
+size_t index_start( index_t *index, int kind, int first, int second );
+int index_next( index_t *index, piece_list_t *piece_list, int kind, int first, int second,
+                size_t *slot, long *compared );
+int index_check( index_t *index, piece_list_t *piece_list, int thread_id, int numThreads );
+int index_find( index_t *index, piece_list_t *piece_list, int kind, int first, int second,
+                long *compared );
+int index_find_turned( index_t *index, piece_list_t *piece_list, int kind, int first, int second,
+                       long *compared );
+int index_find_binary( index_t *index, const binfmt_header_t *header, int kind, int first,
+                       int second );
+void index_free( index_t *index );
+
+/* window.c */
+
+/* The out-of-core solver keeps this many rows in memory for each thread,
+   and never fewer than WINDOW_MIN_ROWS. */
+
+#define WINDOW_ROWS_PER_THREAD (2)
+#define WINDOW_MIN_ROWS (3)
+
+int window_main( int numThreads, int window_rows, int compact, size_t huge_threshold );
+
+/* numa.c */
+
+/* Where --affinity pins the threads: the CPUs the program may run on,
+   ordered by NUMA node, and the node of each.  With --numa the threads
+   first touch the grid as well. */
+
+typedef struct
+{
+    int *cpus;
+    int *nodes;
+    int numcpus;
+    int first_touch;
+} numa_t;
+
+int numa_init( numa_t *numa, int first_touch );
+void numa_free( numa_t *numa );
+void numa_attr( numa_t *numa, pthread_attr_t *attr, int thread_id );
+void numa_report( const char *what, const void *start, size_t length );
+
+/* trace.c */
+
+/* What --trace records: spans of time on each thread, and instants.  Each
+   thread keeps the last TRACE_RING_LEN of them in a ring of its own, so
+   recording never waits on another thread, and they are all written out
+   as Chrome trace events once the threads are done.  The sweeps are one
+   kind for each direction, in the order of the GO_ directions. */
+
+#define TRACE_RING_LEN (1 << 16)
+
+#define TRACE_READ (0)
+#define TRACE_PARSE (1)
+#define TRACE_INDEX (2)
+#define TRACE_SOLVE (3)
+#define TRACE_SWEEP (4)
+#define TRACE_BLOCK (8)
+#define TRACE_IDLE (9)
+#define TRACE_CLAIM_LOST (10)
+#define TRACE_FORMAT (11)
+#define TRACE_WRITE (12)
+
+extern int trace_on;
+
+int trace_open( const char *path );
+int trace_close( void );
+void trace_thread( const char *role, int number );
+unsigned long long trace_clock( void );
+void trace_record( int what, unsigned long long start, unsigned long long end, int a, int b,
+                   int c );
+
+/* Start timing a span, or 0 if nothing is being traced. */
+
+static inline unsigned long long
+trace_begin( void )
+{
+    return __builtin_expect( trace_on, 0 ) ? trace_clock() : 0;
+}
+
+/* Record a span started with trace_begin, with up to three numbers to
+   show with it. */
+
+static inline void
+trace_end( int what, unsigned long long start, int a, int b, int c )
+{
+    if (start != 0)
+    {
+        trace_record( what, start, trace_clock(), a, b, c );
+    }
+}
+
+/* Record an instant on this thread's timeline. */
+
+static inline void
+trace_instant( int what, int a, int b, int c )
+{
+    unsigned long long now;
+
+    if (__builtin_expect( trace_on, 0 ))
+    {
+        now = trace_clock();
+        trace_record( what, now, now, a, b, c );
+    }
+}
+
+/* solve.c */
+
+double now_ms( void );
+
+#endif
@@ -0,0 +1,116 @@
+#!/bin/bash
+#
+# Find out where the puzzle program stops scaling.  For every puzzle size,
+# solver mode and thread count, time ./puzzle (best of a few runs), check
+# its solution with ./verify, and print a line of CSV:
+#
+#   size,cols,rows,pieces,mode,threads,wall_ms,solve_ms,speedup,efficiency,correct
+#
+# wall_ms is the whole run, reading the puzzle and writing the solution
+# included; solve_ms is the solve time the program reports itself.
+# speedup and efficiency compare wall_ms with the run of the same puzzle
+# and mode on the first thread count (one thread unless SCALE_THREADS
+# starts elsewhere).  Run it with "make scale", which writes scale.csv,
+# or set any of these first:
+#
+#   SCALE_SIZES    puzzle sizes, each NxN or N for NxN
+#   SCALE_THREADS  thread counts (default 1 up to the number of processors)
+#   SCALE_MODES    solver modes (default sweep)
+#   SCALE_REPEATS  runs per configuration, the fastest counts (default 3)
+#   SCALE_DIR      where the generated puzzles are kept (default scale.d)
+#
+# Everything runs locally; nothing but ./generate, ./puzzle and ./verify
+# is needed.
+
+SIZES=${SCALE_SIZES:-"5x5 20x20 50x50 100x100 200x200 500x500 1000x1000 2000x2000"}
+NPROC=$(getconf _NPROCESSORS_ONLN 2> /dev/null || echo 1)
+THREADS=${SCALE_THREADS:-$(seq 1 "$NPROC")}
+MODES=${SCALE_MODES:-sweep}
+REPEATS=${SCALE_REPEATS:-3}
+DIR=${SCALE_DIR:-scale.d}
+
+cd "$(dirname "$0")" || exit 1
+mkdir -p "$DIR" || exit 1
+
+now_ns()
+{
+    date +%s%N
+}
+
+# Generate the puzzle for cols x rows into $DIR unless it is already there.
+
+generate()
+{
+    local cols=$1 rows=$2 puzzle=$3
+
+    if [ -s "$puzzle" ]; then
+        return 0
+    fi
+    if ./generate "$cols" "$rows" 7 > "$puzzle.tmp" 2> /dev/null; then
+        mv "$puzzle.tmp" "$puzzle"
+        return 0
+    fi
+    rm -f "$puzzle.tmp"
+    echo "scale: couldn't generate a $cols x $rows puzzle" >&2
+    return 1
+}
+
+# Is the solution in a file right?  ./verify checks it against the puzzle
+# itself, on all the processors.
+
+check()
+{
+    ./verify --threads="$NPROC" "$1" "$2" > /dev/null 2>&1
+}
+
+echo "size,cols,rows,pieces,mode,threads,wall_ms,solve_ms,speedup,efficiency,correct"
+
+status=0
+for size in $SIZES; do
+    cols=${size%x*}
+    rows=${size#*x}
+    puzzle="$DIR/$cols"x"$rows.txt"
+    output="$DIR/solution.txt"
+    generate "$cols" "$rows" "$puzzle" || { status=1; continue; }
+
+    for mode in $MODES; do
+        base=""
+        for threads in $THREADS; do
+            best=""
+            best_solve=""
+            correct=yes
+            for ((run = 0; run < REPEATS; run++)); do
+                start=$(now_ns)
+                ./puzzle "$threads" --mode="$mode" < "$puzzle" > "$output" 2> "$DIR/times.txt"
+                result=$?
+                stop=$(now_ns)
+                wall=$(( (stop - start) / 1000 ))
+                if [ "$result" -ne 0 ] || ! check "$puzzle" "$output"; then
+                    correct=no
+                fi
+                if [ -z "$best" ] || [ "$wall" -lt "$best" ]; then
+                    best=$wall
+                    best_solve=$(awk '/^solve time:/ { print $3 }' "$DIR/times.txt")
+                fi
+            done
+            if [ -z "$base" ]; then
+                base=$best
+                base_threads=$threads
+            fi
+            if [ "$correct" = no ]; then
+                status=1
+            fi
+            awk -v size="$size" -v cols="$cols" -v rows="$rows" -v mode="$mode" \
+                -v threads="$threads" -v wall="$best" -v solve="$best_solve" \
+                -v base="$base" -v base_threads="$base_threads" -v correct="$correct" 'BEGIN {
+                    speedup = base / wall
+                    printf "%s,%d,%d,%d,%s,%d,%.3f,%s,%.3f,%.3f,%s\n", size, cols, rows,
+                           cols * rows, mode, threads, wall / 1000, solve, speedup,
+                           speedup * base_threads / threads, correct
+                }'
+        done
+    done
+done
+rm -f "$DIR/solution.txt" "$DIR/times.txt"
+
+exit $status
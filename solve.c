@@ -0,0 +1,3083 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sched.h>
+
+#include "puzzle.h"
+#include "solve.h"
+
+/* Wall clock time in milliseconds, for reporting how long each phase took. */
+
+double
+now_ms( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* A cheap clock for timing the short waits counted by --stats: the time
+   stamp counter where the processor has one, nanoseconds otherwise. */
+
+static inline unsigned long long
+stats_ticks( void )
+{
+#ifdef __x86_64__
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* Find the piece that goes in a grid cell whose known tabs are in tabs[]
+   (NO_PIECE_INDEX where unknown).  At least two tabs must be known.  The
+   number of pieces compared along the way is added to compared.  Returns
+   the piece as placed (see PLACED), turned to fit if the pieces are
+   rotated. */
+
+int
+find_piece( piece_list_t *piece_list, index_t *index, int tabs[4], long *compared )
+{
+    int j;
+    int kind;
+    int found = NO_PIECE_INDEX;
+
+    /* Look the piece up by any two neighbouring tabs that we know.
+       The other known tabs still have to agree with it. */
+
+    kind = PAIR_NE;
+    while ((kind <= PAIR_WN) &&
+            ((tabs[kind] == NO_PIECE_INDEX) || (tabs[(kind + 1) % 4] == NO_PIECE_INDEX)))
+    {
+        kind++;
+    }
+
+    if ((index->slots != NULL) && !index->scan && (kind <= PAIR_WN))
+    {
+        if (piece_list->rotated)
+        {
+            found = index_find_turned( index, piece_list, kind, tabs[kind], tabs[(kind + 1) % 4],
+                                       compared );
+        }
+        else
+        {
+            found = index_find( index, piece_list, kind, tabs[kind], tabs[(kind + 1) % 4], compared );
+        }
+        for (j = 0; (j < 4) && (found != NO_PIECE_INDEX); j++)
+        {
+            if ((tabs[j] != NO_PIECE_INDEX) && (tabs[j] != placed_tab( piece_list, found, j )))
+            {
+                found = NO_PIECE_INDEX;
+            }
+        }
+        return found;
+    }
+
+    /* Opposite tabs alone don't pick out one piece, and the scan only
+       finds pieces the way round they came. */
+
+    if ((kind > PAIR_WN) || piece_list->rotated)
+    {
+        return NO_PIECE_INDEX;
+    }
+
+    /* Without an index, search the set of pieces for what will go in
+       this grid position (see match.c).  With two adjacent tabs known
+       there is only one such piece, so the scan stops at the piece it
+       finds. */
+
+    found = match_scan( piece_list, tabs );
+    *compared += (found == NO_PIECE_INDEX) ? piece_list->numpieces : found + 1;
+
+    return found;
+}
+
+/* Find the piece for a cell of a puzzle where pieces share tab pairs (see
+   exact_t): the one unused piece that agrees with all the known tabs.  The
+   piece is marked used before it is returned, so that no other cell gets
+   it.  Returns EXACT_UNSURE if more than one piece fits, or none does yet. */
+
+#define EXACT_UNSURE (-2)
+
+int
+exact_find( exact_t *exact, piece_list_t *piece_list, index_t *index, int tabs[4],
+            long *compared )
+{
+    size_t slot;
+    int kind;
+    int piece;
+    int found = NO_PIECE_INDEX;
+    int j;
+
+    kind = PAIR_NE;
+    while ((kind <= PAIR_WN) &&
+            ((tabs[kind] == NO_PIECE_INDEX) || (tabs[(kind + 1) % 4] == NO_PIECE_INDEX)))
+    {
+        kind++;
+    }
+    if (kind > PAIR_WN)
+    {
+        return EXACT_UNSURE;
+    }
+
+    slot = index_start( index, kind, tabs[kind], tabs[(kind + 1) % 4] );
+    while ((piece = index_next( index, piece_list, kind, tabs[kind], tabs[(kind + 1) % 4], &slot,
+                                compared )) != NO_PIECE_INDEX)
+    {
+        for (j = 0; j < 4; j++)
+        {
+            if ((tabs[j] != NO_PIECE_INDEX) && (tabs[j] != piece_list->tab[j][piece]))
+            {
+                break;
+            }
+        }
+        if ((j < 4) || __atomic_load_n( &exact->used[piece], __ATOMIC_RELAXED ))
+        {
+            continue;
+        }
+        if (found != NO_PIECE_INDEX)
+        {
+            return EXACT_UNSURE;
+        }
+        found = piece;
+    }
+
+    if ((found == NO_PIECE_INDEX) || __atomic_exchange_n( &exact->used[found], 1, __ATOMIC_RELAXED ))
+    {
+        return EXACT_UNSURE;
+    }
+
+    return found;
+}
+
+/* Fit a piece, as placed (see PLACED), into the grid and update the tabs
+   of the grid for all surrounding grid cells.  The tabs are published
+   before the cell is marked filled. */
+
+void
+place_piece( grid_t *grid, piece_list_t *piece_list, int col, int row, int found )
+{
+    grid_cell( grid, col, row )->piece = found;
+    STORE_TAB( grid_cell( grid, col, row )->north, placed_tab( piece_list, found, NORTH_TAB ) );
+    STORE_TAB( grid_cell( grid, col + 1, row )->west, placed_tab( piece_list, found, EAST_TAB ) );
+    STORE_TAB( grid_cell( grid, col, row + 1 )->north, placed_tab( piece_list, found, SOUTH_TAB ) );
+    STORE_TAB( grid_cell( grid, col, row )->west, placed_tab( piece_list, found, WEST_TAB ) );
+}
+
+/* Have a function that traverses a row or a column, trying to fill in
+   pieces.  Only puzzle grid spots that have at least two tabs defined
+   are candidates to be filled in.
+
+   There are four possible directions to travel:
+     GO_LEFT_TO_RIGHT -- assumes that north and west of current cell are defined
+                         (like the top row)
+     GO_TOP_TO_BOTTOM -- assumes that north and east of current cell are defined
+                         (like the rightmost column)
+     GO_RIGHT_TO_LEFT -- assumes that east and south of current cell are defined
+                         (like the bottom row)
+     GO_BOTTOM_TO_TOP -- assumes that south and west of current cell are defined
+                         (like the leftmost column)
+
+   These four directions essentially let you go clockwise around the inside
+   of the puzzle boundary if you want.  The return value is nonzero if a
+   cell on the line was left empty, for want of tabs or because another
+   thread had it.
+*/
+
+#define GO_LEFT_TO_RIGHT (0)
+#define GO_TOP_TO_BOTTOM (1)
+#define GO_RIGHT_TO_LEFT (2)
+#define GO_BOTTOM_TO_TOP (3)
+
+/* Make room for the sweep solver's frontiers, all at 0.  Returns 0 if
+   there isn't the memory. */
+
+int
+frontier_alloc( frontier_t *frontier, grid_t *grid )
+{
+    int *done;
+
+    done = (int *) calloc( 2 * ((size_t) grid->numrows + grid->numcols), sizeof( int ) );
+    if (done == NULL)
+    {
+        return 0;
+    }
+    frontier->done[GO_LEFT_TO_RIGHT] = done;
+    frontier->done[GO_RIGHT_TO_LEFT] = done + grid->numrows;
+    frontier->done[GO_TOP_TO_BOTTOM] = done + 2 * grid->numrows;
+    frontier->done[GO_BOTTOM_TO_TOP] = done + 2 * grid->numrows + grid->numcols;
+    frontier->remaining = (long) grid->numcols * grid->numrows;
+    frontier->failed = 0;
+
+    return 1;
+}
+
+void
+frontier_free( frontier_t *frontier )
+{
+    free( frontier->done[GO_LEFT_TO_RIGHT] );
+}
+
+/* Say that the first count cells from a line's edge are filled, unless
+   more of them are already known to be. */
+
+static inline void
+frontier_advance( int *done, int count )
+{
+    int seen = __atomic_load_n( done, __ATOMIC_RELAXED );
+
+    while ((count > seen) &&
+            !__atomic_compare_exchange_n( done, &seen, count, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED ))
+    {
+    }
+}
+
+/* Do the frontiers of the line crossing a sweep at col, row say the cell
+   is filled? */
+
+static inline int
+frontier_crossed( frontier_t *frontier, grid_t *grid, int col, int row, int horizontal )
+{
+    if (horizontal)
+    {
+        return (row < __atomic_load_n( &frontier->done[GO_TOP_TO_BOTTOM][col], __ATOMIC_RELAXED )) ||
+               (grid->numrows - 1 - row <
+                __atomic_load_n( &frontier->done[GO_BOTTOM_TO_TOP][col], __ATOMIC_RELAXED ));
+    }
+    return (col < __atomic_load_n( &frontier->done[GO_LEFT_TO_RIGHT][row], __ATOMIC_RELAXED )) ||
+           (grid->numcols - 1 - col <
+            __atomic_load_n( &frontier->done[GO_RIGHT_TO_LEFT][row], __ATOMIC_RELAXED ));
+}
+
+/* Is every cell placed? */
+
+static inline int
+frontier_complete( frontier_t *frontier )
+{
+    return __atomic_load_n( &frontier->remaining, __ATOMIC_ACQUIRE ) == 0;
+}
+
+/* Is there nothing more for the sweeps to do, either because every cell is
+   placed or because one can't be? */
+
+static inline int
+frontier_stopped( frontier_t *frontier )
+{
+    return frontier_complete( frontier ) || __atomic_load_n( &frontier->failed, __ATOMIC_RELAXED );
+}
+
+int
+fill_any_dir( grid_t *grid, piece_list_t *piece_list, index_t *index, frontier_t *frontier,
+              exact_t *exact, int start_col, int start_row, int inc_index, stats_t *stats )
+{
+    int found;
+    int row, col;
+    int col_inc[] = {1, 0, -1, 0};
+    int row_inc[] = {0, 1, 0, -1};
+    int count;
+    int kind;
+    int tabs[4];
+    int state;
+    int horizontal;
+    int length;
+    int step;
+    int run;
+    int *ahead;
+    int *behind;
+    cell_t *cell;
+    long visited = 0, filled = 0, solved = 0, unready = 0, compared = 0, lost = 0;
+    unsigned long long trace = trace_begin();
+
+    /* The line's frontiers from the edge we start at and from the far
+       edge. */
+
+    horizontal = (inc_index == GO_LEFT_TO_RIGHT) || (inc_index == GO_RIGHT_TO_LEFT);
+    length = horizontal ? grid->numcols : grid->numrows;
+    ahead = &frontier->done[inc_index][horizontal ? start_row : start_col];
+    behind = &frontier->done[(inc_index + 2) % 4][horizontal ? start_row : start_col];
+
+    /* Jump past the cells already solved from this edge, and keep track of
+       how far the solved cells now reach from it. */
+
+    step = __atomic_load_n( ahead, __ATOMIC_ACQUIRE );
+    run = step;
+    row = start_row + step * row_inc[inc_index];
+    col = start_col + step * col_inc[inc_index];
+
+    /* Loop through the column / row and stop when we hit an edge or the
+       cells solved from the far edge. */
+
+    while (step < length - __atomic_load_n( behind, __ATOMIC_ACQUIRE ))
+    {
+        cell = grid_cell( grid, col, row );
+        visited++;
+        state = CELL_EMPTY;
+
+        /* Step over cells the crossing line has solved.  Otherwise claim the
+           cell before solving it; a thread that finds the cell filled just
+           moves on to the next cell.  One that loses the race for it doesn't
+           wait: the cell isn't done as far as this sweep goes, and fill_sweep
+           comes back for it and whatever is left beyond it. */
+
+        if (frontier_crossed( frontier, grid, col, row, horizontal ))
+        {
+            solved++;
+            state = CELL_FILLED;
+        }
+        else
+        {
+            /* Ensure that we're ready for the piece by making sure that at
+               least two neighbouring tabs are defined.  Opposite tabs alone
+               don't pick out one piece.  A cell that isn't ready isn't
+               claimed, so it never holds up another thread. */
+
+            tabs[NORTH_TAB] = LOAD_TAB( cell->north );
+            tabs[EAST_TAB] = LOAD_TAB( grid_cell( grid, col + 1, row )->west );
+            tabs[SOUTH_TAB] = LOAD_TAB( grid_cell( grid, col, row + 1 )->north );
+            tabs[WEST_TAB] = LOAD_TAB( cell->west );
+
+            count = 0;
+            for (kind = PAIR_NE; kind <= PAIR_WN; kind++)
+            {
+                if ((tabs[kind] != NO_PIECE_INDEX) && (tabs[(kind + 1) % 4] != NO_PIECE_INDEX))
+                {
+                    count++;
+                }
+            }
+
+            if (count == 0)
+            {
+                /* Without the exact solver's rounds to come back, the cells
+                   beyond mostly need this one's tabs too. */
+
+                unready++;
+                if (exact == NULL)
+                {
+                    break;
+                }
+            }
+            else if (!cell_claim( cell ))
+            {
+                state = __atomic_load_n( &cell->state, __ATOMIC_ACQUIRE );
+                if (state == CELL_FILLED)
+                {
+                    solved++;
+                }
+                else
+                {
+                    /* The cells beyond need this one's tabs, so leave the
+                       rest of the line for later. */
+
+                    lost++;
+                    trace_instant( TRACE_CLAIM_LOST, col, row, 0 );
+                    break;
+                }
+            }
+            else
+            {
+                if (exact != NULL)
+                {
+                    /* Only a piece that is sure to be right goes in; the rest
+                       are left for fill_exact. */
+
+                    found = exact_find( exact, piece_list, index, tabs, &compared );
+                    if (found >= 0)
+                    {
+                        place_piece( grid, piece_list, col, row, found );
+                        state = CELL_FILLED;
+                        filled++;
+                    }
+                    else
+                    {
+                        unready++;
+                    }
+                }
+                else
+                {
+                    found = find_piece( piece_list, index, tabs, &compared );
+
+                    if (found != NO_PIECE_INDEX)
+                    {
+                        place_piece( grid, piece_list, col, row, found );
+                        state = CELL_FILLED;
+                        filled++;
+                    }
+                    else
+                    {
+                        fprintf( stderr, "Error piece not found for row %d, column %d\n", row, col );
+                        __atomic_store_n( &frontier->failed, 1, __ATOMIC_RELAXED );
+                    }
+                }
+
+                // Release the claim, leaving the cell either filled or empty
+                cell_release( cell, state );
+            }
+        }
+
+        if ((state == CELL_FILLED) && (run == step))
+        {
+            run = step + 1;
+        }
+
+        /* Go to the next grid cell in the direction given as a parameter. */
+        row += row_inc[inc_index];
+        col += col_inc[inc_index];
+        step++;
+    }
+
+    frontier_advance( ahead, run );
+    if (filled > 0)
+    {
+        __atomic_fetch_sub( &frontier->remaining, filled, __ATOMIC_RELEASE );
+    }
+    trace_end( TRACE_SWEEP + inc_index, trace, horizontal ? start_row : start_col, (int) filled,
+               (int) lost );
+
+    if (stats != NULL)
+    {
+        stats->cells_visited += visited;
+        stats->cells_filled += filled;
+        stats->skipped_solved += solved;
+        stats->skipped_unready += unready;
+        stats->pieces_compared += compared;
+        stats->claims_lost += lost;
+    }
+
+    return (unready + lost) > 0;
+}
+
+/* Fill the grid a block diagonal at a time.  The blocks on a diagonal are
+   dealt out to the threads round robin, and everyone waits at the barrier
+   before moving to the next diagonal.  Within a block we go row by row, so
+   the north and west tabs of every cell are known when we reach it.  Once a
+   cell turns up that no piece fits, the blocks left are skipped, though
+   every thread still meets the others at each barrier. */
+
+void
+fill_wavefront( fill_t *fill )
+{
+    grid_t *grid = fill->grid;
+    int block = fill->wave_block;
+    int block_cols = (grid->numcols + block - 1) / block;
+    int block_rows = (grid->numrows + block - 1) / block;
+    int diagonal, first, last, k;
+    int block_row, block_col;
+    int row, col, row_end, col_end;
+    int tabs[4];
+    int found;
+    long visited = 0, filled = 0, compared = 0;
+    long block_filled;
+    unsigned long long ticks;
+    unsigned long long trace;
+
+    for (diagonal = 0; diagonal < block_cols + block_rows - 1; diagonal++)
+    {
+        first = (diagonal < block_cols) ? 0 : diagonal - block_cols + 1;
+        last = (diagonal < block_rows) ? diagonal : block_rows - 1;
+
+        for (k = first + fill->thread_id;
+             (k <= last) && !__atomic_load_n( fill->unsolved, __ATOMIC_RELAXED );
+             k += fill->numThreads)
+        {
+            block_row = k;
+            block_col = diagonal - k;
+            row_end = (block_row + 1) * block;
+            col_end = (block_col + 1) * block;
+            if (row_end > grid->numrows) row_end = grid->numrows;
+            if (col_end > grid->numcols) col_end = grid->numcols;
+            trace = trace_begin();
+            block_filled = filled;
+
+            for (row = block_row * block;
+                 (row < row_end) && !__atomic_load_n( fill->unsolved, __ATOMIC_RELAXED ); row++)
+            {
+                for (col = block_col * block; col < col_end; col++)
+                {
+                    tabs[NORTH_TAB] = LOAD_TAB( grid_cell( grid, col, row )->north );
+                    tabs[EAST_TAB] = LOAD_TAB( grid_cell( grid, col + 1, row )->west );
+                    tabs[SOUTH_TAB] = LOAD_TAB( grid_cell( grid, col, row + 1 )->north );
+                    tabs[WEST_TAB] = LOAD_TAB( grid_cell( grid, col, row )->west );
+
+                    visited++;
+                    found = find_piece( fill->piece_list, fill->index, tabs, &compared );
+                    if (found != NO_PIECE_INDEX)
+                    {
+                        place_piece( grid, fill->piece_list, col, row, found );
+                        __atomic_store_n( &grid_cell( grid, col, row )->state, CELL_FILLED, __ATOMIC_RELEASE );
+                        filled++;
+                    }
+                    else
+                    {
+                        fprintf( stderr, "Error piece not found for row %d, column %d\n", row, col );
+                        __atomic_store_n( fill->unsolved, 1, __ATOMIC_RELAXED );
+                        break;
+                    }
+                }
+            }
+            trace_end( TRACE_BLOCK, trace, block_col * block, block_row * block,
+                       (int) (filled - block_filled) );
+        }
+
+        trace = trace_begin();
+        if (fill->stats != NULL)
+        {
+            ticks = stats_ticks();
+            pthread_barrier_wait( fill->barrier );
+            fill->stats->idle_ticks += stats_ticks() - ticks;
+        }
+        else
+        {
+            pthread_barrier_wait( fill->barrier );
+        }
+        trace_end( TRACE_IDLE, trace, 0, 0, 0 );
+    }
+
+    if (fill->stats != NULL)
+    {
+        fill->stats->cells_visited += visited;
+        fill->stats->cells_filled += filled;
+        fill->stats->pieces_compared += compared;
+    }
+}
+
+/* Set up an empty work-stealing deque.  Returns 0 if there is no memory. */
+
+int
+deque_init( deque_t *deque )
+{
+    deque->top = 0;
+    deque->bottom = 0;
+    deque->array = (deque_array_t *) malloc( sizeof( deque_array_t ) +
+                   DEQUE_INITIAL_SIZE * sizeof( long ) );
+    if (deque->array == NULL)
+    {
+        return 0;
+    }
+    deque->array->size = DEQUE_INITIAL_SIZE;
+    deque->array->retired = NULL;
+
+    return 1;
+}
+
+void
+deque_destroy( deque_t *deque )
+{
+    deque_array_t *array = deque->array;
+    deque_array_t *next;
+
+    while (array != NULL)
+    {
+        next = array->retired;
+        free( array );
+        array = next;
+    }
+    deque->array = NULL;
+}
+
+/* Add an item at the bottom.  Only the owning thread may push. */
+
+void
+deque_push( deque_t *deque, long item )
+{
+    long bottom = __atomic_load_n( &deque->bottom, __ATOMIC_RELAXED );
+    long top = __atomic_load_n( &deque->top, __ATOMIC_ACQUIRE );
+    deque_array_t *array = __atomic_load_n( &deque->array, __ATOMIC_RELAXED );
+    deque_array_t *bigger;
+    long i;
+
+    if (bottom - top > array->size - 1)
+    {
+        bigger = (deque_array_t *) malloc( sizeof( deque_array_t ) +
+                                           2 * array->size * sizeof( long ) );
+        if (bigger == NULL)
+        {
+            fprintf(stderr, "Out of memory growing a work queue\n");
+            exit(2);
+        }
+        bigger->size = 2 * array->size;
+        bigger->retired = array;
+        for (i = top; i < bottom; i++)
+        {
+            bigger->items[i % bigger->size] =
+                __atomic_load_n( &array->items[i % array->size], __ATOMIC_RELAXED );
+        }
+        __atomic_store_n( &deque->array, bigger, __ATOMIC_RELEASE );
+        array = bigger;
+    }
+
+    __atomic_store_n( &array->items[bottom % array->size], item, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+    __atomic_store_n( &deque->bottom, bottom + 1, __ATOMIC_RELAXED );
+}
+
+/* Take the most recently pushed item.  Only the owning thread may take. */
+
+long
+deque_take( deque_t *deque )
+{
+    long bottom = __atomic_load_n( &deque->bottom, __ATOMIC_RELAXED ) - 1;
+    deque_array_t *array = __atomic_load_n( &deque->array, __ATOMIC_RELAXED );
+    long top;
+    long item = DEQUE_EMPTY;
+
+    __atomic_store_n( &deque->bottom, bottom, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    top = __atomic_load_n( &deque->top, __ATOMIC_RELAXED );
+
+    if (top <= bottom)
+    {
+        item = __atomic_load_n( &array->items[bottom % array->size], __ATOMIC_RELAXED );
+        if (top == bottom)
+        {
+            /* Last item, race the thieves for it. */
+            if (!__atomic_compare_exchange_n( &deque->top, &top, top + 1, 0,
+                                              __ATOMIC_SEQ_CST, __ATOMIC_RELAXED ))
+            {
+                item = DEQUE_EMPTY;
+            }
+            __atomic_store_n( &deque->bottom, bottom + 1, __ATOMIC_RELAXED );
+        }
+    }
+    else
+    {
+        __atomic_store_n( &deque->bottom, bottom + 1, __ATOMIC_RELAXED );
+    }
+
+    return item;
+}
+
+/* Steal the oldest item from another thread's deque.  Returns DEQUE_ABORT if
+   another thread got there first. */
+
+long
+deque_steal( deque_t *deque )
+{
+    long top = __atomic_load_n( &deque->top, __ATOMIC_ACQUIRE );
+    long bottom;
+    deque_array_t *array;
+    long item = DEQUE_EMPTY;
+
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    bottom = __atomic_load_n( &deque->bottom, __ATOMIC_ACQUIRE );
+
+    if (top < bottom)
+    {
+        array = __atomic_load_n( &deque->array, __ATOMIC_ACQUIRE );
+        item = __atomic_load_n( &array->items[top % array->size], __ATOMIC_RELAXED );
+        if (!__atomic_compare_exchange_n( &deque->top, &top, top + 1, 0,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED ))
+        {
+            return DEQUE_ABORT;
+        }
+    }
+
+    return item;
+}
+
+/* Make room for the dataflow solver's known-tab masks and work queues.
+   Returns 0 if there is no memory. */
+
+int
+dataflow_alloc( dataflow_t *dataflow, grid_t *grid, int numThreads )
+{
+    int i;
+
+    dataflow->remaining = (long) grid->numcols * grid->numrows;
+    dataflow->failed = 0;
+    dataflow->known = (unsigned char *) malloc( dataflow->remaining );
+    dataflow->deques = (deque_t *) aligned_alloc( 64, numThreads * sizeof( deque_t ) );
+    if ((dataflow->known == NULL) || (dataflow->deques == NULL))
+    {
+        free( dataflow->known );
+        free( dataflow->deques );
+        return 0;
+    }
+
+    for (i = 0; i < numThreads; i++)
+    {
+        if (!deque_init( &dataflow->deques[i] ))
+        {
+            while (--i >= 0)
+            {
+                deque_destroy( &dataflow->deques[i] );
+            }
+            free( dataflow->known );
+            free( dataflow->deques );
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void
+dataflow_free( dataflow_t *dataflow, int numThreads )
+{
+    int i;
+
+    for (i = 0; i < numThreads; i++)
+    {
+        deque_destroy( &dataflow->deques[i] );
+    }
+    free( dataflow->deques );
+    free( dataflow->known );
+}
+
+/* Tell a neighbouring cell that one of its tabs is now known, and queue it
+   if that gives it its first pair of adjacent known tabs. */
+
+void
+dataflow_notify( fill_t *fill, int col, int row, int tab )
+{
+    dataflow_t *dataflow = fill->dataflow;
+    long cell = (long) row * fill->grid->numcols + col;
+    unsigned char old;
+
+    old = __atomic_fetch_or( &dataflow->known[cell], 1 << tab, __ATOMIC_ACQ_REL );
+    if (!KNOWN_READY(old) && KNOWN_READY(old | (1 << tab)))
+    {
+        deque_push( &dataflow->deques[fill->thread_id], cell );
+    }
+}
+
+/* Fill cells as they become ready.  Each thread first seeds its queue with
+   its share of the cells that are ready from the boundary alone (the corners,
+   usually), then works its own queue and steals when it runs dry.  A piece
+   that can't be found leaves the cells beyond it never ready, so it stops
+   every thread and fails the solve. */
+
+void
+fill_dataflow( fill_t *fill )
+{
+    grid_t *grid = fill->grid;
+    dataflow_t *dataflow = fill->dataflow;
+    deque_t *own = &dataflow->deques[fill->thread_id];
+    long numcells = (long) grid->numcols * grid->numrows;
+    long first = numcells * fill->thread_id / fill->numThreads;
+    long last = numcells * (fill->thread_id + 1) / fill->numThreads;
+    unsigned int seed = fill->thread_id * 2654435761u + 1;
+    long cell;
+    unsigned char mask;
+    int row, col;
+    int tabs[4];
+    int found;
+    int victim, tries;
+    long compared;
+    unsigned long long ticks = 0;
+    unsigned long long idle;
+
+    for (cell = first; cell < last; cell++)
+    {
+        col = cell % grid->numcols;
+        row = cell / grid->numcols;
+        mask = 0;
+        if (grid_cell( grid, col, row )->north != NO_PIECE_INDEX) mask |= 1 << NORTH_TAB;
+        if (grid_cell( grid, col + 1, row )->west != NO_PIECE_INDEX) mask |= 1 << EAST_TAB;
+        if (grid_cell( grid, col, row + 1 )->north != NO_PIECE_INDEX) mask |= 1 << SOUTH_TAB;
+        if (grid_cell( grid, col, row )->west != NO_PIECE_INDEX) mask |= 1 << WEST_TAB;
+        dataflow->known[cell] = mask;
+        if (KNOWN_READY(mask))
+        {
+            deque_push( own, cell );
+        }
+    }
+
+    idle = trace_begin();
+    if (fill->stats != NULL)
+    {
+        ticks = stats_ticks();
+    }
+    pthread_barrier_wait( fill->barrier );
+    if (fill->stats != NULL)
+    {
+        fill->stats->idle_ticks += stats_ticks() - ticks;
+        ticks = 0;
+    }
+    trace_end( TRACE_IDLE, idle, 0, 0, 0 );
+    idle = 0;
+
+    while ((__atomic_load_n( &dataflow->remaining, __ATOMIC_ACQUIRE ) > 0) &&
+           !__atomic_load_n( &dataflow->failed, __ATOMIC_RELAXED ))
+    {
+        cell = deque_take( own );
+
+        /* Nothing of our own to do, so go and steal from a random thread.
+           The time until there is something to do counts as idle. */
+
+        if ((cell < 0) && (fill->stats != NULL) && (ticks == 0))
+        {
+            ticks = stats_ticks();
+        }
+        if ((cell < 0) && (idle == 0))
+        {
+            idle = trace_begin();
+        }
+
+        for (tries = 0; (cell < 0) && (tries < fill->numThreads) &&
+                        !__atomic_load_n( &dataflow->failed, __ATOMIC_RELAXED ); tries++)
+        {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            victim = seed % fill->numThreads;
+            if (victim != fill->thread_id)
+            {
+                cell = deque_steal( &dataflow->deques[victim] );
+            }
+        }
+
+        if (cell < 0)
+        {
+            sched_yield();
+            continue;
+        }
+        if (ticks != 0)
+        {
+            fill->stats->idle_ticks += stats_ticks() - ticks;
+            ticks = 0;
+        }
+        trace_end( TRACE_IDLE, idle, 0, 0, 0 );
+        idle = 0;
+
+        col = cell % grid->numcols;
+        row = cell / grid->numcols;
+        tabs[NORTH_TAB] = LOAD_TAB( grid_cell( grid, col, row )->north );
+        tabs[EAST_TAB] = LOAD_TAB( grid_cell( grid, col + 1, row )->west );
+        tabs[SOUTH_TAB] = LOAD_TAB( grid_cell( grid, col, row + 1 )->north );
+        tabs[WEST_TAB] = LOAD_TAB( grid_cell( grid, col, row )->west );
+
+        compared = 0;
+        found = find_piece( fill->piece_list, fill->index, tabs, &compared );
+        if (fill->stats != NULL)
+        {
+            fill->stats->cells_visited++;
+            fill->stats->cells_filled += (found != NO_PIECE_INDEX);
+            fill->stats->pieces_compared += compared;
+        }
+        if (found != NO_PIECE_INDEX)
+        {
+            place_piece( grid, fill->piece_list, col, row, found );
+            __atomic_store_n( &grid_cell( grid, col, row )->state, CELL_FILLED, __ATOMIC_RELEASE );
+
+            if (row > 0) dataflow_notify( fill, col, row - 1, SOUTH_TAB );
+            if (col + 1 < grid->numcols) dataflow_notify( fill, col + 1, row, WEST_TAB );
+            if (row + 1 < grid->numrows) dataflow_notify( fill, col, row + 1, NORTH_TAB );
+            if (col > 0) dataflow_notify( fill, col - 1, row, EAST_TAB );
+        }
+        else
+        {
+            fprintf( stderr, "Error piece not found for row %d, column %d\n", row, col );
+            __atomic_store_n( &dataflow->failed, 1, __ATOMIC_RELAXED );
+            __atomic_store_n( fill->unsolved, 1, __ATOMIC_RELAXED );
+        }
+
+        __atomic_fetch_sub( &dataflow->remaining, 1, __ATOMIC_RELEASE );
+    }
+
+    if (ticks != 0)
+    {
+        fill->stats->idle_ticks += stats_ticks() - ticks;
+    }
+    trace_end( TRACE_IDLE, idle, 0, 0, 0 );
+}
+
+/* Copy this thread's share of the pieces out of a binary puzzle.  If the
+   index came with the puzzle, check this thread's share of its slots as
+   well; otherwise build it as the pieces are copied.  As in load_pieces,
+   the last thread done notes the time. */
+
+int
+load_binary_pieces( fill_t *fill )
+{
+    long numpieces = fill->piece_list->numpieces;
+    long first = numpieces * fill->thread_id / fill->numThreads;
+    long last = numpieces * (fill->thread_id + 1) / fill->numThreads;
+    unsigned long long trace;
+
+    if ((fill->index->slots != NULL) && !fill->index->borrowed)
+    {
+        index_clear( fill->index, fill->thread_id, fill->numThreads );
+    }
+
+    pthread_barrier_wait( fill->barrier );
+
+    trace = trace_begin();
+    if (!copy_binary_pieces( fill->input, fill->piece_list, first, last, fill->index ))
+    {
+        __atomic_store_n( fill->input_ok, 0, __ATOMIC_RELAXED );
+    }
+    trace_end( TRACE_INDEX, trace, (int) (last - first), 0, 0 );
+    if (fill->index->borrowed &&
+            !index_check( fill->index, fill->piece_list, fill->thread_id, fill->numThreads ))
+    {
+        if (__atomic_exchange_n( fill->input_ok, 0, __ATOMIC_RELAXED ))
+        {
+            fprintf( stderr, "Error in puzzle input: the binary puzzle's index is damaged\n" );
+        }
+    }
+
+    if (pthread_barrier_wait( fill->barrier ) == PTHREAD_BARRIER_SERIAL_THREAD)
+    {
+        *fill->index_done = now_ms();
+    }
+
+    /* Every thread sees the same count of empty slots, so they all give up
+       together if there are none. */
+
+    if (fill->index->borrowed && (__atomic_load_n( &fill->index->empty, __ATOMIC_RELAXED ) == 0))
+    {
+        if (__atomic_exchange_n( fill->input_ok, 0, __ATOMIC_RELAXED ))
+        {
+            fprintf( stderr, "Error in puzzle input: the binary puzzle's index is damaged\n" );
+        }
+        return 0;
+    }
+
+    return __atomic_load_n( fill->input_ok, __ATOMIC_RELAXED );
+}
+
+/* Parse the pieces and build the index with every thread.  The piece section
+   is split into one chunk per thread at line boundaries.  Each thread counts
+   the pieces in its chunk (and clears its share of the index), so that after
+   the barrier it knows which piece number its chunk starts at; it then parses
+   its chunk straight into those slots of the piece list, entering each piece
+   in the index as it goes.  The last thread to finish notes when the index
+   was done (index_done), so that the time isn't taken while others are
+   still building it.  Returns 0 if the input was malformed. */
+
+int
+load_pieces( fill_t *fill )
+{
+    input_t chunk = *fill->input;
+    size_t start, end;
+    long first = 0;
+    long total = 0;
+    long parsed;
+    unsigned long long trace;
+    int i;
+
+    if (fill->input->binary != NULL)
+    {
+        return load_binary_pieces( fill );
+    }
+
+    input_chunk( fill->input, fill->thread_id, fill->numThreads, &start, &end );
+
+    if (fill->index->slots != NULL)
+    {
+        index_clear( fill->index, fill->thread_id, fill->numThreads );
+    }
+    fill->piece_counts[fill->thread_id] = count_piece_lines( chunk.data, start, end );
+
+    pthread_barrier_wait( fill->barrier );
+
+    for (i = 0; i < fill->numThreads; i++)
+    {
+        if (i < fill->thread_id)
+        {
+            first += fill->piece_counts[i];
+        }
+        total += fill->piece_counts[i];
+    }
+
+    if (total < fill->piece_list->numpieces)
+    {
+        if (fill->thread_id == 0)
+        {
+            fprintf( stderr, "Error in puzzle input: expected %ld pieces but found %ld\n",
+                     fill->piece_list->numpieces, total );
+        }
+        __atomic_store_n( fill->input_ok, 0, __ATOMIC_RELAXED );
+    }
+    else
+    {
+        trace = trace_begin();
+        chunk.pos = start;
+        parsed = parse_pieces( &chunk, end, fill->piece_list, first, fill->index );
+        if (parsed < 0)
+        {
+            __atomic_store_n( fill->input_ok, 0, __ATOMIC_RELAXED );
+        }
+        trace_end( TRACE_INDEX, trace, (int) parsed, 0, 0 );
+    }
+
+    if (pthread_barrier_wait( fill->barrier ) == PTHREAD_BARRIER_SERIAL_THREAD)
+    {
+        *fill->index_done = now_ms();
+    }
+
+    return __atomic_load_n( fill->input_ok, __ATOMIC_RELAXED );
+}
+
+/* Cut the piece section into blocks for the pipelined solver.  A binary
+   puzzle has nothing to parse, so it gets no blocks and is loaded whole
+   first.  Returns 0 if there is no memory. */
+
+int
+pipeline_alloc( pipeline_t *pipeline, input_t *input, int numThreads )
+{
+    pipeline->numblocks = 0;
+    if (input->binary == NULL)
+    {
+        pipeline->numblocks = (input->end - input->pos) / PIPELINE_BLOCK_LEN;
+        if (pipeline->numblocks < numThreads)
+        {
+            pipeline->numblocks = numThreads;
+        }
+    }
+
+    pipeline->starts = (size_t *) malloc( (pipeline->numblocks + 1) * sizeof( size_t ) );
+    pipeline->ends = (size_t *) malloc( (pipeline->numblocks + 1) * sizeof( size_t ) );
+    pipeline->firsts = (long *) malloc( (pipeline->numblocks + 1) * sizeof( long ) );
+    if ((pipeline->starts == NULL) || (pipeline->ends == NULL) || (pipeline->firsts == NULL))
+    {
+        free( pipeline->starts );
+        free( pipeline->ends );
+        free( pipeline->firsts );
+        return 0;
+    }
+
+    pipeline->next_block = 0;
+    pipeline->next_row = 0;
+    pipeline->blocks_done = 0;
+    pipeline->failed = 0;
+    pthread_mutex_init( &pipeline->lock, NULL );
+    pthread_cond_init( &pipeline->published, NULL );
+
+    return 1;
+}
+
+void
+pipeline_free( pipeline_t *pipeline )
+{
+    pthread_cond_destroy( &pipeline->published );
+    pthread_mutex_destroy( &pipeline->lock );
+    free( pipeline->starts );
+    free( pipeline->ends );
+    free( pipeline->firsts );
+}
+
+/* Stop solving, and wake everyone who is parked.  unsolved is set for a
+   puzzle with a cell no piece fits, but not when the pieces turn out to
+   share tab pairs, since then the puzzle is solved again exactly (see
+   pipeline_finish). */
+
+void
+pipeline_fail( fill_t *fill )
+{
+    pipeline_t *pipeline = fill->pipeline;
+
+    pthread_mutex_lock( &pipeline->lock );
+    __atomic_store_n( &pipeline->failed, 1, __ATOMIC_RELAXED );
+    if (__atomic_load_n( &fill->index->ambiguous, __ATOMIC_RELAXED ) == 0)
+    {
+        __atomic_store_n( fill->unsolved, 1, __ATOMIC_RELAXED );
+    }
+    pthread_cond_broadcast( &pipeline->published );
+    pthread_mutex_unlock( &pipeline->lock );
+}
+
+/* Get ready to solve while parsing: count the pieces in every block and
+   work out each block's first piece number.  Each thread counts every
+   numThreads-th block and clears its share of the index.  A binary puzzle
+   is just loaded.  Returns 0 if the input was malformed. */
+
+int
+pipeline_start( fill_t *fill )
+{
+    pipeline_t *pipeline = fill->pipeline;
+    long count, total;
+    int block;
+
+    if (fill->input->binary != NULL)
+    {
+        return load_pieces( fill );
+    }
+
+    index_clear( fill->index, fill->thread_id, fill->numThreads );
+    for (block = fill->thread_id; block < pipeline->numblocks; block += fill->numThreads)
+    {
+        input_chunk( fill->input, block, pipeline->numblocks, &pipeline->starts[block],
+                     &pipeline->ends[block] );
+        pipeline->firsts[block] = count_piece_lines( fill->input->data, pipeline->starts[block],
+                                                     pipeline->ends[block] );
+    }
+
+    pthread_barrier_wait( fill->barrier );
+
+    if (fill->thread_id == 0)
+    {
+        total = 0;
+        for (block = 0; block < pipeline->numblocks; block++)
+        {
+            count = pipeline->firsts[block];
+            pipeline->firsts[block] = total;
+            total += count;
+        }
+        if (total < fill->piece_list->numpieces)
+        {
+            fprintf( stderr, "Error in puzzle input: expected %ld pieces but found %ld\n",
+                     fill->piece_list->numpieces, total );
+            __atomic_store_n( fill->input_ok, 0, __ATOMIC_RELAXED );
+        }
+    }
+
+    pthread_barrier_wait( fill->barrier );
+
+    return __atomic_load_n( fill->input_ok, __ATOMIC_RELAXED );
+}
+
+/* Take the next block, parse its pieces into the piece list and the index,
+   and tell anyone parked that there are more pieces.  Returns 0 if every
+   block has already been taken. */
+
+int
+pipeline_read( fill_t *fill )
+{
+    pipeline_t *pipeline = fill->pipeline;
+    input_t chunk = *fill->input;
+    unsigned long long trace;
+    long parsed;
+    int block;
+    int ok;
+
+    /* Threads waiting on the row above call this over and over, so once
+       every block is taken next_block must stop growing. */
+
+    block = __atomic_load_n( &pipeline->next_block, __ATOMIC_RELAXED );
+    do
+    {
+        if (block >= pipeline->numblocks)
+        {
+            return 0;
+        }
+    }
+    while (!__atomic_compare_exchange_n( &pipeline->next_block, &block, block + 1, 1,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED ));
+
+    trace = trace_begin();
+    chunk.pos = pipeline->starts[block];
+    parsed = parse_pieces( &chunk, pipeline->ends[block], fill->piece_list, pipeline->firsts[block],
+                           fill->index );
+    ok = parsed >= 0;
+    trace_end( TRACE_INDEX, trace, (int) parsed, 0, 0 );
+
+    pthread_mutex_lock( &pipeline->lock );
+    if (!ok)
+    {
+        __atomic_store_n( &pipeline->failed, 1, __ATOMIC_RELAXED );
+        __atomic_store_n( fill->input_ok, 0, __ATOMIC_RELAXED );
+    }
+    __atomic_store_n( &pipeline->blocks_done, pipeline->blocks_done + 1, __ATOMIC_RELEASE );
+    if (pipeline->blocks_done == pipeline->numblocks)
+    {
+        *fill->index_done = now_ms();
+    }
+    pthread_cond_broadcast( &pipeline->published );
+    pthread_mutex_unlock( &pipeline->lock );
+
+    return 1;
+}
+
+/* Wait until more blocks than seen have been published. */
+
+void
+pipeline_park( pipeline_t *pipeline, int seen )
+{
+    pthread_mutex_lock( &pipeline->lock );
+    while ((pipeline->blocks_done == seen) && !pipeline->failed)
+    {
+        pthread_cond_wait( &pipeline->published, &pipeline->lock );
+    }
+    pthread_mutex_unlock( &pipeline->lock );
+}
+
+/* Solve rows in order while the pieces arrive.  Each cell waits for the
+   cell above it, and its piece is looked up by its north and west tabs; a
+   thread with nothing to do parses instead, and parks when there is
+   nothing left to parse either. */
+
+void
+fill_pipeline( fill_t *fill )
+{
+    grid_t *grid = fill->grid;
+    pipeline_t *pipeline = fill->pipeline;
+    cell_t *above;
+    int row, col;
+    int done;
+    int tabs[4];
+    int found;
+    long visited = 0, filled = 0, compared = 0;
+    unsigned long long idle_ticks = 0, ticks = 0;
+    unsigned long long idle;
+
+    while (!__atomic_load_n( &pipeline->failed, __ATOMIC_RELAXED ))
+    {
+        row = __atomic_fetch_add( &pipeline->next_row, 1, __ATOMIC_RELAXED );
+        if (row >= grid->numrows)
+        {
+            break;
+        }
+
+        for (col = 0; (col < grid->numcols) && !__atomic_load_n( &pipeline->failed, __ATOMIC_RELAXED ); col++)
+        {
+            if (row > 0)
+            {
+                above = grid_cell( grid, col, row - 1 );
+                idle = 0;
+                while ((__atomic_load_n( &above->state, __ATOMIC_ACQUIRE ) != CELL_FILLED) &&
+                        !__atomic_load_n( &pipeline->failed, __ATOMIC_RELAXED ))
+                {
+                    if (pipeline_read( fill ))
+                    {
+                        continue;
+                    }
+                    if (fill->stats != NULL)
+                    {
+                        ticks = stats_ticks();
+                    }
+                    if (idle == 0)
+                    {
+                        idle = trace_begin();
+                    }
+                    sched_yield();
+                    if (fill->stats != NULL)
+                    {
+                        idle_ticks += stats_ticks() - ticks;
+                    }
+                }
+                trace_end( TRACE_IDLE, idle, 0, 0, 0 );
+                if (__atomic_load_n( &pipeline->failed, __ATOMIC_RELAXED ))
+                {
+                    break;
+                }
+            }
+
+            tabs[NORTH_TAB] = LOAD_TAB( grid_cell( grid, col, row )->north );
+            tabs[EAST_TAB] = LOAD_TAB( grid_cell( grid, col + 1, row )->west );
+            tabs[SOUTH_TAB] = LOAD_TAB( grid_cell( grid, col, row + 1 )->north );
+            tabs[WEST_TAB] = LOAD_TAB( grid_cell( grid, col, row )->west );
+            visited++;
+
+            /* Blocks published before the lookup are in the index, so if
+               they were all in and the piece still isn't there, it never
+               will be. */
+
+            done = __atomic_load_n( &pipeline->blocks_done, __ATOMIC_ACQUIRE );
+            found = find_piece( fill->piece_list, fill->index, tabs, &compared );
+            while ((found == NO_PIECE_INDEX) && !__atomic_load_n( &pipeline->failed, __ATOMIC_RELAXED ))
+            {
+                if (done == pipeline->numblocks)
+                {
+                    if (__atomic_load_n( &fill->index->ambiguous, __ATOMIC_RELAXED ) == 0)
+                    {
+                        fprintf( stderr, "Error piece not found for row %d, column %d\n", row, col );
+                    }
+                    pipeline_fail( fill );
+                    break;
+                }
+                if (!pipeline_read( fill ))
+                {
+                    if (fill->stats != NULL)
+                    {
+                        ticks = stats_ticks();
+                    }
+                    idle = trace_begin();
+                    pipeline_park( pipeline, done );
+                    trace_end( TRACE_IDLE, idle, 0, 0, 0 );
+                    if (fill->stats != NULL)
+                    {
+                        idle_ticks += stats_ticks() - ticks;
+                    }
+                }
+                done = __atomic_load_n( &pipeline->blocks_done, __ATOMIC_ACQUIRE );
+                found = find_piece( fill->piece_list, fill->index, tabs, &compared );
+            }
+            if (found == NO_PIECE_INDEX)
+            {
+                break;
+            }
+
+            /* Once two pieces are known to share a pair of tabs, the first
+               piece that fits may be the wrong one, so give up on the
+               pieces as they come. */
+
+            if (__atomic_load_n( &fill->index->ambiguous, __ATOMIC_RELAXED ) > 0)
+            {
+                pipeline_fail( fill );
+                break;
+            }
+
+            place_piece( grid, fill->piece_list, col, row, found );
+            __atomic_store_n( &grid_cell( grid, col, row )->state, CELL_FILLED, __ATOMIC_RELEASE );
+            filled++;
+        }
+
+        if (fill->stats != NULL)
+        {
+            fill->stats->cells_visited += visited;
+            fill->stats->cells_filled += filled;
+            fill->stats->pieces_compared += compared;
+            fill->stats->idle_ticks += idle_ticks;
+            visited = filled = compared = 0;
+            idle_ticks = 0;
+        }
+    }
+
+    /* Whoever is done helps parse what is left, so that the parked
+       threads get their pieces. */
+
+    while (!__atomic_load_n( &pipeline->failed, __ATOMIC_RELAXED ) && pipeline_read( fill ))
+    {
+    }
+}
+
+/* Make room for solving a puzzle whose pieces share tab pairs: which
+   pieces are used, and a work queue for each thread.  Returns 0 if there
+   is no memory. */
+
+int
+exact_alloc( exact_t *exact, piece_list_t *piece_list, int numThreads )
+{
+    int i;
+
+    exact->cells = NULL;
+    exact->near = NULL;
+    exact->pieces = NULL;
+    exact->start = NULL;
+    exact->twin = NULL;
+    exact->tabs = NULL;
+    exact->values = NULL;
+    exact->spare = NULL;
+    exact->solution = NULL;
+    exact->numcells = 0;
+    exact->pending = 0;
+    exact->found = 0;
+    exact->used = (unsigned char *) calloc( piece_list->numpieces + 1, 1 );
+    exact->deques = (deque_t *) aligned_alloc( 64, numThreads * sizeof( deque_t ) );
+    if ((exact->used == NULL) || (exact->deques == NULL))
+    {
+        free( exact->used );
+        free( exact->deques );
+        exact->used = NULL;
+        return 0;
+    }
+
+    for (i = 0; i < numThreads; i++)
+    {
+        if (!deque_init( &exact->deques[i] ))
+        {
+            while (--i >= 0)
+            {
+                deque_destroy( &exact->deques[i] );
+            }
+            free( exact->used );
+            free( exact->deques );
+            exact->used = NULL;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void
+exact_free( exact_t *exact, int numThreads )
+{
+    int i;
+
+    for (i = 0; i < numThreads; i++)
+    {
+        deque_destroy( &exact->deques[i] );
+    }
+    free( exact->deques );
+    free( exact->used );
+    free( exact->cells );
+    free( exact->near );
+    free( exact->pieces );
+    free( exact->start );
+    free( exact->twin );
+    free( exact->tabs );
+    free( exact->values );
+    free( exact->spare );
+    free( exact->solution );
+    exact->used = NULL;
+}
+
+/* Once the pipelined solver stops, parse whatever it left and see whether
+   any pieces share a pair of tabs after all.  If they do, what it placed
+   can't be trusted, so every thread empties its share of the rows again
+   (keeping the boundaries), and thread 0 makes room for solving the puzzle
+   exactly.  Returns 1 if the puzzle is to be solved exactly. */
+
+int
+pipeline_finish( fill_t *fill )
+{
+    grid_t *grid = fill->grid;
+    cell_t *cell;
+    int first = (int) ((long) grid->numrows * fill->thread_id / fill->numThreads);
+    int last = (int) ((long) grid->numrows * (fill->thread_id + 1) / fill->numThreads);
+    int row, col;
+
+    while (pipeline_read( fill ))
+    {
+    }
+
+    pthread_barrier_wait( fill->barrier );
+
+    if (!__atomic_load_n( fill->input_ok, __ATOMIC_RELAXED ) ||
+            (__atomic_load_n( &fill->index->ambiguous, __ATOMIC_RELAXED ) == 0))
+    {
+        return 0;
+    }
+
+    for (row = first; row < last; row++)
+    {
+        for (col = 0; col < grid->numcols; col++)
+        {
+            cell = grid_cell( grid, col, row );
+            if (row > 0)
+            {
+                cell->north = NO_PIECE_INDEX;
+            }
+            if (col > 0)
+            {
+                cell->west = NO_PIECE_INDEX;
+            }
+            cell->piece = NO_PIECE_INDEX;
+            cell->state = CELL_EMPTY;
+        }
+    }
+    if (fill->thread_id == 0)
+    {
+        *fill->unsolved = 0;
+        if (!exact_alloc( fill->exact, fill->piece_list, fill->numThreads ))
+        {
+            fprintf(stderr, "Not enough memory to search for where the pieces go\n");
+            *fill->unsolved = 1;
+        }
+    }
+
+    pthread_barrier_wait( fill->barrier );
+
+    return fill->exact->used != NULL;
+}
+
+/* Where cell is in the first count cells of sorted, or -1. */
+
+static long
+exact_lookup( const long *sorted, long count, long cell )
+{
+    long low = 0, high = count;
+    long middle;
+
+    while (low < high)
+    {
+        middle = low + (high - low) / 2;
+        if (sorted[middle] < cell)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return ((low < count) && (sorted[low] == cell)) ? low : -1;
+}
+
+/* A piece's tabs, for sorting pieces that are alike next to each other. */
+
+typedef struct
+{
+    int tabs[4];
+    int piece;
+} exact_alike_t;
+
+static int
+exact_compare( const void *a, const void *b )
+{
+    const exact_alike_t *first = (const exact_alike_t *) a;
+    const exact_alike_t *second = (const exact_alike_t *) b;
+    int j;
+
+    for (j = 0; j < 4; j++)
+    {
+        if (first->tabs[j] != second->tabs[j])
+        {
+            return (first->tabs[j] > second->tabs[j]) - (first->tabs[j] < second->tabs[j]);
+        }
+    }
+
+    return (first->piece > second->piece) - (first->piece < second->piece);
+}
+
+static int
+exact_compare_tab( const void *a, const void *b )
+{
+    int first = *(const int *) a;
+    int second = *(const int *) b;
+
+    return (first > second) - (first < second);
+}
+
+/* Where a tab is among the numvalues sorted values, or -1. */
+
+static int
+exact_value( const int *values, int numvalues, int tab )
+{
+    const int *found = (const int *) bsearch( &tab, values, numvalues, sizeof( int ), exact_compare_tab );
+
+    return (found != NULL) ? (int) (found - values) : -1;
+}
+
+/* Candidate sets have a bit for each unused piece, numbered in the order of
+   exact->pieces. */
+
+#define EXACT_WORD(q) ((q) >> 6)
+#define EXACT_BIT(q) (1ULL << ((q) & 63))
+
+/* Get the cells left empty, which come in row order, ready to be searched:
+   which of their neighbours are empty too, the pieces still unused and
+   which of them are alike, the tabs they have and how many of each are
+   spare, and each cell's candidates, the unused pieces that agree with the
+   tabs already known around it.  Returns 0 if there is no memory. */
+
+static int
+exact_prepare( exact_t *exact, grid_t *grid, piece_list_t *piece_list )
+{
+    long numcells = exact->numcells;
+    long neighbours[4];
+    exact_alike_t *alike;
+    unsigned long long *set;
+    long cell;
+    long i, q;
+    int tabs[4];
+    int col, row;
+    int value;
+    int j;
+
+    exact->numfree = 0;
+    for (q = 0; q < piece_list->numpieces; q++)
+    {
+        exact->numfree += !exact->used[q];
+    }
+    exact->words = exact->numfree / 64 + 1;
+    exact->near = (int *) malloc( 4 * numcells * sizeof( int ) );
+    exact->pieces = (int *) malloc( (exact->numfree + 1) * sizeof( int ) );
+    exact->start = (unsigned long long *) calloc( numcells * exact->words, sizeof( unsigned long long ) );
+    exact->twin = (int *) malloc( (exact->numfree + 1) * sizeof( int ) );
+    exact->tabs = (int *) malloc( (4 * exact->numfree + 1) * sizeof( int ) );
+    exact->values = (int *) malloc( (4 * exact->numfree + 1) * sizeof( int ) );
+    exact->spare = (int *) calloc( 4 * exact->numfree + 1, sizeof( int ) );
+    exact->solution = (int *) malloc( numcells * sizeof( int ) );
+    alike = (exact_alike_t *) malloc( (exact->numfree + 1) * sizeof( exact_alike_t ) );
+    if ((exact->near == NULL) || (exact->pieces == NULL) || (exact->start == NULL) ||
+            (exact->twin == NULL) || (exact->tabs == NULL) || (exact->values == NULL) ||
+            (exact->spare == NULL) || (exact->solution == NULL) || (alike == NULL))
+    {
+        free( alike );
+        return 0;
+    }
+
+    i = 0;
+    for (q = 0; q < piece_list->numpieces; q++)
+    {
+        if (!exact->used[q])
+        {
+            exact->pieces[i++] = (int) q;
+        }
+    }
+
+    /* A piece that is just like one before it is its twin, which the search
+       takes first (see exact_next). */
+
+    for (q = 0; q < exact->numfree; q++)
+    {
+        for (j = 0; j < 4; j++)
+        {
+            alike[q].tabs[j] = piece_list->tab[j][exact->pieces[q]];
+        }
+        alike[q].piece = (int) q;
+    }
+    qsort( alike, exact->numfree, sizeof( exact_alike_t ), exact_compare );
+    for (q = 0; q < exact->numfree; q++)
+    {
+        exact->twin[alike[q].piece] = ((q > 0) && (memcmp( alike[q].tabs, alike[q - 1].tabs,
+                                                           sizeof( alike[q].tabs ) ) == 0)) ?
+            alike[q - 1].piece : -1;
+    }
+    free( alike );
+
+    /* Number the tabs the pieces have, and count them all as spare. */
+
+    for (q = 0; q < 4 * exact->numfree; q++)
+    {
+        exact->values[q] = piece_list->tab[q % 4][exact->pieces[q / 4]];
+    }
+    qsort( exact->values, 4 * exact->numfree, sizeof( int ), exact_compare_tab );
+    exact->numvalues = 0;
+    for (q = 0; q < 4 * exact->numfree; q++)
+    {
+        if ((q == 0) || (exact->values[q] != exact->values[q - 1]))
+        {
+            exact->values[exact->numvalues++] = exact->values[q];
+        }
+    }
+    for (q = 0; q < 4 * exact->numfree; q++)
+    {
+        exact->tabs[q] = exact_value( exact->values, exact->numvalues,
+                                      piece_list->tab[q % 4][exact->pieces[q / 4]] );
+        exact->spare[4 * exact->tabs[q] + q % 4]++;
+    }
+
+    for (i = 0; i < numcells; i++)
+    {
+        cell = exact->cells[i];
+        col = (int) (cell % grid->numcols);
+        row = (int) (cell / grid->numcols);
+        neighbours[NORTH_TAB] = (row > 0) ? cell - grid->numcols : -1;
+        neighbours[EAST_TAB] = (col + 1 < grid->numcols) ? cell + 1 : -1;
+        neighbours[SOUTH_TAB] = (row + 1 < grid->numrows) ? cell + grid->numcols : -1;
+        neighbours[WEST_TAB] = (col > 0) ? cell - 1 : -1;
+        for (j = 0; j < 4; j++)
+        {
+            exact->near[4 * i + j] = (neighbours[j] >= 0) ?
+                (int) exact_lookup( exact->cells, numcells, neighbours[j] ) : -1;
+        }
+
+        tabs[NORTH_TAB] = LOAD_TAB( grid_cell( grid, col, row )->north );
+        tabs[EAST_TAB] = LOAD_TAB( grid_cell( grid, col + 1, row )->west );
+        tabs[SOUTH_TAB] = LOAD_TAB( grid_cell( grid, col, row + 1 )->north );
+        tabs[WEST_TAB] = LOAD_TAB( grid_cell( grid, col, row )->west );
+        /* A tab already known is one that a piece has to be found for. */
+
+        for (j = 0; j < 4; j++)
+        {
+            value = (exact->near[4 * i + j] < 0) ? exact_value( exact->values, exact->numvalues, tabs[j] ) : -1;
+            if (value >= 0)
+            {
+                exact->spare[4 * value + j]--;
+            }
+        }
+
+        set = exact->start + i * exact->words;
+        for (q = 0; q < exact->numfree; q++)
+        {
+            for (j = 0; (j < 4) && ((tabs[j] == NO_PIECE_INDEX) ||
+                                    (tabs[j] == piece_list->tab[j][exact->pieces[q]])); j++)
+            {
+            }
+            if (j == 4)
+            {
+                set[EXACT_WORD( q )] |= EXACT_BIT( q );
+            }
+        }
+    }
+
+    return 1;
+}
+
+/* Try to place the one piece that fits a cell (see exact_find), if no
+   other thread is at it.  Returns 1 if the piece went in. */
+
+static int
+exact_place( fill_t *fill, int col, int row, long *compared )
+{
+    grid_t *grid = fill->grid;
+    cell_t *cell = grid_cell( grid, col, row );
+    int tabs[4];
+    int count;
+    int kind;
+    int found = EXACT_UNSURE;
+
+    if (!cell_claim( cell ))
+    {
+        return 0;
+    }
+    tabs[NORTH_TAB] = LOAD_TAB( cell->north );
+    tabs[EAST_TAB] = LOAD_TAB( grid_cell( grid, col + 1, row )->west );
+    tabs[SOUTH_TAB] = LOAD_TAB( grid_cell( grid, col, row + 1 )->north );
+    tabs[WEST_TAB] = LOAD_TAB( cell->west );
+    count = 0;
+    for (kind = PAIR_NE; kind <= PAIR_WN; kind++)
+    {
+        count += (tabs[kind] != NO_PIECE_INDEX) && (tabs[(kind + 1) % 4] != NO_PIECE_INDEX);
+    }
+    if (count > 0)
+    {
+        found = exact_find( fill->exact, fill->piece_list, fill->index, tabs, compared );
+    }
+    if (found >= 0)
+    {
+        place_piece( grid, fill->piece_list, col, row, found );
+    }
+    cell_release( cell, (found >= 0) ? CELL_FILLED : CELL_EMPTY );
+
+    return found >= 0;
+}
+
+/* Carry on placing the pieces that are sure to be right after the sweeps
+   (see exact_t).  Each round, a thread starts from the empty cells of its
+   band of rows and keeps a stack of the cells next to the pieces it
+   places; the rounds go on while the last one placed anything, since a
+   cell may have been busy with another thread when it was pushed, or only
+   become sure because its other pieces got used. */
+
+static void
+exact_propagate( fill_t *fill )
+{
+    exact_t *exact = fill->exact;
+    grid_t *grid = fill->grid;
+    int first = (int) ((long) grid->numrows * fill->thread_id / fill->numThreads);
+    int last = (int) ((long) grid->numrows * (fill->thread_id + 1) / fill->numThreads);
+    long *stack = NULL;
+    long *bigger;
+    long size = 0;
+    long depth;
+    long filled = 0;
+    long compared = 0;
+    long placed;
+    long cell;
+    int row, col;
+    int more = 1;
+
+    while (more)
+    {
+        if (fill->thread_id == 0)
+        {
+            exact->placed = 0;
+        }
+        pthread_barrier_wait( fill->barrier );
+
+        placed = 0;
+        depth = 0;
+        for (row = first; row < last; row++)
+        {
+            for (col = 0; col < grid->numcols; col++)
+            {
+                if (__atomic_load_n( &grid_cell( grid, col, row )->state, __ATOMIC_ACQUIRE ) == CELL_FILLED)
+                {
+                    continue;
+                }
+                if (exact_place( fill, col, row, &compared ))
+                {
+                    placed++;
+                    depth = 0;
+
+                    /* Follow the placements out from this cell. */
+
+                    cell = (long) row * grid->numcols + col;
+                    do
+                    {
+                        if (size < depth + 4)
+                        {
+                            size = 2 * size + 64;
+                            bigger = (long *) realloc( stack, size * sizeof( long ) );
+                            if (bigger == NULL)
+                            {
+                                /* Leave the rest to the next round. */
+                                size = 0;
+                                depth = 0;
+                                break;
+                            }
+                            stack = bigger;
+                        }
+                        if (cell >= 0)
+                        {
+                            if (cell >= grid->numcols)
+                                stack[depth++] = cell - grid->numcols;
+                            if (cell < (long) (grid->numrows - 1) * grid->numcols)
+                                stack[depth++] = cell + grid->numcols;
+                            if (cell % grid->numcols != 0)
+                                stack[depth++] = cell - 1;
+                            if ((cell + 1) % grid->numcols != 0)
+                                stack[depth++] = cell + 1;
+                        }
+                        cell = -1;
+                        while ((cell < 0) && (depth > 0))
+                        {
+                            cell = stack[--depth];
+                            if ((__atomic_load_n( &grid_cell( grid, (int) (cell % grid->numcols),
+                                                              (int) (cell / grid->numcols) )->state,
+                                                  __ATOMIC_ACQUIRE ) == CELL_FILLED) ||
+                                    !exact_place( fill, (int) (cell % grid->numcols),
+                                                  (int) (cell / grid->numcols), &compared ))
+                            {
+                                cell = -1;
+                            }
+                            else
+                            {
+                                placed++;
+                            }
+                        }
+                    }
+                    while (cell >= 0);
+                }
+            }
+        }
+
+        filled += placed;
+        if (placed > 0)
+        {
+            __atomic_fetch_add( &exact->placed, placed, __ATOMIC_RELAXED );
+            __atomic_fetch_sub( &fill->frontier->remaining, placed, __ATOMIC_RELEASE );
+        }
+        pthread_barrier_wait( fill->barrier );
+        more = (__atomic_load_n( &exact->placed, __ATOMIC_RELAXED ) > 0);
+        pthread_barrier_wait( fill->barrier );
+    }
+
+    free( stack );
+    if (fill->stats != NULL)
+    {
+        fill->stats->cells_filled += filled;
+        fill->stats->pieces_compared += compared;
+    }
+}
+
+/* Gather the cells left empty once nothing more is sure, each thread its
+   band of rows, and set the search going with a task for all of them. */
+
+static void
+exact_collect( fill_t *fill )
+{
+    exact_t *exact = fill->exact;
+    grid_t *grid = fill->grid;
+    int first = (int) ((long) grid->numrows * fill->thread_id / fill->numThreads);
+    int last = (int) ((long) grid->numrows * (fill->thread_id + 1) / fill->numThreads);
+    exact_task_t *root;
+    long count = 0;
+    long at = 0;
+    long total = 0;
+    int row, col;
+    int i;
+
+    pthread_barrier_wait( fill->barrier );
+
+    for (row = first; row < last; row++)
+    {
+        for (col = 0; col < grid->numcols; col++)
+        {
+            count += (grid_cell( grid, col, row )->state != CELL_FILLED);
+        }
+    }
+    fill->piece_counts[fill->thread_id] = count;
+
+    pthread_barrier_wait( fill->barrier );
+
+    for (i = 0; i < fill->numThreads; i++)
+    {
+        if (i < fill->thread_id)
+        {
+            at += fill->piece_counts[i];
+        }
+        total += fill->piece_counts[i];
+    }
+    if (fill->thread_id == 0)
+    {
+        exact->numcells = total;
+        exact->cells = (total > 0) ? (long *) malloc( total * sizeof( long ) ) : NULL;
+        if ((total > 0) && (exact->cells == NULL))
+        {
+            fprintf(stderr, "Not enough memory to search for the last %ld pieces\n", total);
+            exact->numcells = 0;
+        }
+    }
+
+    pthread_barrier_wait( fill->barrier );
+
+    if (exact->numcells > 0)
+    {
+        for (row = first; row < last; row++)
+        {
+            for (col = 0; col < grid->numcols; col++)
+            {
+                if (grid_cell( grid, col, row )->state != CELL_FILLED)
+                {
+                    exact->cells[at++] = (long) row * grid->numcols + col;
+                }
+            }
+        }
+    }
+
+    pthread_barrier_wait( fill->barrier );
+
+    if ((fill->thread_id == 0) && (exact->numcells > 0))
+    {
+        root = (exact_task_t *) malloc( sizeof( exact_task_t ) );
+        if ((root == NULL) || !exact_prepare( exact, grid, fill->piece_list ))
+        {
+            fprintf(stderr, "Not enough memory to search for the last %ld pieces\n", total);
+            exact->numcells = 0;
+            free( root );
+        }
+        else
+        {
+            root->depth = 0;
+            root->cell = -1;
+            root->after = -1;
+            exact->pending = 1;
+            deque_push( &exact->deques[0], (long) root );
+        }
+    }
+
+    pthread_barrier_wait( fill->barrier );
+}
+
+/* A thread's own search state: every empty cell's candidates as they stand
+   (words to a cell), the candidates taken so far, the candidates exact_choose
+   found room for, the spare tab counts, the tabs each cell's candidates
+   offer on each side, the one chosen for each cell or -1, the cells in the
+   order they are decided (order, and where each cell is in it), and at each
+   depth the last candidate tried and whether the rest were handed to
+   another thread. */
+
+typedef struct
+{
+    unsigned long long *cand;
+    unsigned long long *taken;
+    unsigned long long *seen;
+    int *spare;
+    unsigned long long *offers;
+    int *chosen;
+    int *order;
+    int *where;
+    int *tried;
+    unsigned char *handed;
+} exact_local_t;
+
+/* Cut a cell's candidates down to the ones that fit the pieces chosen for
+   its neighbours, from the ones it has (as a neighbour goes in) or from the
+   ones it started with (as one comes out).  Returns 0 if none is left that
+   isn't taken. */
+
+static int
+exact_refresh( exact_t *exact, exact_local_t *local, int cell, int restart )
+{
+    unsigned long long *set = local->cand + (long) cell * exact->words;
+    const unsigned long long *from = restart ? exact->start + (long) cell * exact->words : set;
+    unsigned long long bits;
+    int tabs[4];
+    int known = 0;
+    int left = 0;
+    int other;
+    long w, q;
+    int j;
+
+    for (j = 0; j < 4; j++)
+    {
+        other = exact->near[4 * cell + j];
+        tabs[j] = -1;
+        if ((other >= 0) && (local->chosen[other] >= 0))
+        {
+            tabs[j] = exact->tabs[4 * local->chosen[other] + (j + 2) % 4];
+            known = 1;
+        }
+    }
+
+    for (w = 0; w < exact->words; w++)
+    {
+        set[w] = from[w];
+        for (bits = known ? from[w] : 0; bits != 0; bits &= bits - 1)
+        {
+            q = w * 64 + __builtin_ctzll( bits );
+            for (j = 0; (j < 4) && ((tabs[j] < 0) || (tabs[j] == exact->tabs[4 * q + j])); j++)
+            {
+            }
+            if (j < 4)
+            {
+                set[w] &= ~EXACT_BIT( q );
+            }
+        }
+        left |= (set[w] & ~local->taken[w]) != 0;
+    }
+
+    return left;
+}
+
+/* Count a candidate's tabs in or out of the spare ones (by is -1 or 1) as
+   it goes in or comes out of the cell at depth: its own tabs are no longer
+   spare, nor are the ones facing it on empty neighbours, and the known tabs
+   it faces no longer need one.  Returns 0 if some tab it has is left with
+   more cells needing it than pieces that have it, or unlike numbers on
+   either side of a cell, which rules out fitting the rest. */
+
+static int
+exact_count( exact_t *exact, exact_local_t *local, long depth, int piece, int by )
+{
+    int cell = local->order[depth];
+    int *spare = local->spare;
+    int value;
+    int other;
+    int ok = 1;
+    int j;
+
+    for (j = 0; j < 4; j++)
+    {
+        value = exact->tabs[4 * piece + j];
+        other = exact->near[4 * cell + j];
+        spare[4 * value + j] += by;
+        if ((other < 0) || (local->chosen[other] >= 0))
+        {
+            spare[4 * value + j] -= by;
+        }
+        else
+        {
+            spare[4 * value + (j + 2) % 4] += by;
+        }
+    }
+    for (j = 0; j < 4; j++)
+    {
+        value = exact->tabs[4 * piece + j];
+        if ((spare[4 * value + j] < 0) || (spare[4 * value + j] != spare[4 * value + (j + 2) % 4]))
+        {
+            ok = 0;
+        }
+    }
+
+    return ok;
+}
+
+/* Give the cell at depth a candidate and prune its empty neighbours' sets.
+   Returns 0 if one of them has nothing left, or the tabs left can't
+   match up (see exact_count). */
+
+static int
+exact_assign( exact_t *exact, exact_local_t *local, long depth, int piece )
+{
+    int cell = local->order[depth];
+    int other;
+    int ok;
+    int j;
+
+    ok = exact_count( exact, local, depth, piece, -1 );
+    local->chosen[cell] = piece;
+    local->taken[EXACT_WORD( piece )] |= EXACT_BIT( piece );
+    for (j = 0; ok && (j < 4); j++)
+    {
+        other = exact->near[4 * cell + j];
+        if ((other >= 0) && (local->chosen[other] < 0))
+        {
+            ok = exact_refresh( exact, local, other, 0 );
+        }
+    }
+
+    return ok;
+}
+
+/* Take the candidate at depth back out, and give its neighbours back what
+   it pruned. */
+
+static void
+exact_undo( exact_t *exact, exact_local_t *local, long depth )
+{
+    int cell = local->order[depth];
+    int piece = local->chosen[cell];
+    int other;
+    int j;
+
+    local->chosen[cell] = -1;
+    local->taken[EXACT_WORD( piece )] &= ~EXACT_BIT( piece );
+    exact_count( exact, local, depth, piece, 1 );
+    for (j = 0; j < 4; j++)
+    {
+        other = exact->near[4 * cell + j];
+        if ((other >= 0) && (local->chosen[other] < 0))
+        {
+            exact_refresh( exact, local, other, 1 );
+        }
+    }
+}
+
+/* Make cell the one decided at depth. */
+
+static void
+exact_move( exact_local_t *local, long depth, int cell )
+{
+    int at = local->where[cell];
+    int other = local->order[depth];
+
+    local->order[at] = other;
+    local->where[other] = at;
+    local->order[depth] = cell;
+    local->where[cell] = (int) depth;
+}
+
+/* Pick the undecided cell with the fewest candidates left to be decided at
+   depth, and of those the one with the most neighbours known.  Returns 0
+   if some cell has no candidate left, or some piece no cell. */
+
+static int
+exact_choose( exact_t *exact, exact_local_t *local, long depth )
+{
+    unsigned long long *set;
+    unsigned long long *offers = local->offers;
+    unsigned long long allowed[4];
+    unsigned long long bits, rest;
+    int *tabs;
+    long fewest = 0;
+    long count;
+    long best = -1;
+    long k, w, q;
+    int known, most = 0;
+    int open;
+    int cell, other;
+    int masks = exact->numvalues <= 64;
+    int j;
+
+    /* With few enough tabs, note which ones each cell's candidates have on
+       each side, so that a candidate whose empty neighbour has nothing to
+       match it isn't counted. */
+
+    for (k = depth; masks && (k < exact->numcells); k++)
+    {
+        cell = local->order[k];
+        set = local->cand + (long) cell * exact->words;
+        offers[4 * cell] = offers[4 * cell + 1] = offers[4 * cell + 2] = offers[4 * cell + 3] = 0;
+        for (w = 0; w < exact->words; w++)
+        {
+            for (bits = set[w] & ~local->taken[w]; bits != 0; bits &= bits - 1)
+            {
+                tabs = exact->tabs + 4 * (w * 64 + __builtin_ctzll( bits ));
+                offers[4 * cell] |= 1ULL << tabs[0];
+                offers[4 * cell + 1] |= 1ULL << tabs[1];
+                offers[4 * cell + 2] |= 1ULL << tabs[2];
+                offers[4 * cell + 3] |= 1ULL << tabs[3];
+            }
+        }
+    }
+
+    memset( local->seen, 0, exact->words * sizeof( unsigned long long ) );
+    for (k = depth; k < exact->numcells; k++)
+    {
+        cell = local->order[k];
+        set = local->cand + (long) cell * exact->words;
+        known = 0;
+        open = 0;
+        for (j = 0; j < 4; j++)
+        {
+            other = exact->near[4 * cell + j];
+            allowed[j] = ~0ULL;
+            if ((other < 0) || (local->chosen[other] >= 0))
+            {
+                known++;
+            }
+            else if (masks)
+            {
+                allowed[j] = offers[4 * other + (j + 2) % 4];
+                open = 1;
+            }
+        }
+
+        count = 0;
+        for (w = 0; w < exact->words; w++)
+        {
+            bits = set[w] & ~local->taken[w];
+            for (rest = open ? bits : 0; rest != 0; rest &= rest - 1)
+            {
+                q = w * 64 + __builtin_ctzll( rest );
+                tabs = exact->tabs + 4 * q;
+                if (!((allowed[0] >> tabs[0]) & (allowed[1] >> tabs[1]) &
+                      (allowed[2] >> tabs[2]) & (allowed[3] >> tabs[3]) & 1))
+                {
+                    bits &= ~EXACT_BIT( q );
+                }
+            }
+            count += __builtin_popcountll( bits );
+            local->seen[w] |= bits;
+        }
+        if (count == 0)
+        {
+            return 0;
+        }
+        if ((best < 0) || (count < fewest) || ((count == fewest) && (known > most)))
+        {
+            best = k;
+            fewest = count;
+            most = known;
+        }
+    }
+
+    /* There are as many pieces as cells, so each one left has to go
+       somewhere. */
+
+    for (w = 0; (w < exact->words) && (exact->numfree == exact->numcells); w++)
+    {
+        if ((local->seen[w] | local->taken[w]) != ((w < EXACT_WORD( exact->numfree )) ? ~0ULL :
+                                                     EXACT_BIT( exact->numfree ) - 1))
+        {
+            return 0;
+        }
+    }
+    exact_move( local, depth, local->order[best] );
+
+    return 1;
+}
+
+/* The next candidate after after to try for the cell at depth, or -1.
+   Of pieces that are alike, only the first not taken is tried. */
+
+static int
+exact_next( exact_t *exact, exact_local_t *local, long depth, int after )
+{
+    unsigned long long *set = local->cand + (long) local->order[depth] * exact->words;
+    unsigned long long bits;
+    long w = EXACT_WORD( after + 1 );
+    int piece, twin;
+
+    bits = set[w] & ~local->taken[w] & (~0ULL << ((after + 1) & 63));
+    for (;;)
+    {
+        while (bits == 0)
+        {
+            if (++w >= exact->words)
+            {
+                return -1;
+            }
+            bits = set[w] & ~local->taken[w];
+        }
+        piece = (int) (w * 64 + __builtin_ctzll( bits ));
+        twin = exact->twin[piece];
+        if ((twin < 0) || (local->taken[EXACT_WORD( twin )] & EXACT_BIT( twin )))
+        {
+            return piece;
+        }
+        bits &= bits - 1;
+    }
+}
+
+/* Hand the candidates after the one tried at depth over as a task. */
+
+static void
+exact_hand( exact_t *exact, exact_local_t *local, deque_t *own, long depth )
+{
+    exact_task_t *rest;
+    long i;
+
+    rest = (exact_task_t *) malloc( sizeof( exact_task_t ) + 2 * depth * sizeof( int ) );
+    if (rest != NULL)
+    {
+        rest->depth = (int) depth;
+        rest->cell = local->order[depth];
+        rest->after = local->tried[depth];
+        for (i = 0; i < depth; i++)
+        {
+            rest->moves[2 * i] = local->order[i];
+            rest->moves[2 * i + 1] = local->chosen[local->order[i]];
+        }
+        __atomic_fetch_add( &exact->pending, 1, __ATOMIC_ACQ_REL );
+        deque_push( own, (long) rest );
+        local->handed[depth] = 1;
+    }
+}
+
+/* How many pieces exact_run tries from one task before it hands back
+   everything it hasn't finished and stops.  A bad choice near the top of
+   the search can hide no solution under millions of placements; suspending
+   lets the owner go on with its oldest task instead, so the search reaches
+   the other early choices in good time. */
+
+#define EXACT_BUDGET 10000
+
+/* Search on from a task until every choice under it has been tried, or
+   someone has found a way to fit every cell, or the budget runs out.
+   Returns 1 if it ran out, having pushed what was left onto the deque. */
+
+static int
+exact_run( fill_t *fill, exact_local_t *local, exact_task_t *task, long *compared )
+{
+    long nodes = 0;
+    int suspended = 0;
+    exact_t *exact = fill->exact;
+    deque_t *own = &exact->deques[fill->thread_id];
+    long depth;
+    long i;
+    int piece;
+    int ok = 1;
+
+    /* Start from the sets as the search found them, and make the task's
+       choices again. */
+
+    memcpy( local->cand, exact->start, exact->numcells * exact->words * sizeof( unsigned long long ) );
+    memset( local->taken, 0, exact->words * sizeof( unsigned long long ) );
+    memcpy( local->spare, exact->spare, 4 * exact->numvalues * sizeof( int ) );
+    for (i = 0; i < exact->numcells; i++)
+    {
+        local->chosen[i] = -1;
+        local->order[i] = (int) i;
+        local->where[i] = (int) i;
+    }
+    for (depth = 0; depth < task->depth; depth++)
+    {
+        exact_move( local, depth, task->moves[2 * depth] );
+        exact_assign( exact, local, depth, task->moves[2 * depth + 1] );
+    }
+    for (i = 0; i < 4 * exact->numvalues; i++)
+    {
+        if ((local->spare[i] < 0) || (local->spare[i] != local->spare[i - i % 4 + (i % 4 + 2) % 4]))
+        {
+            ok = 0;
+        }
+    }
+    if (task->cell >= 0)
+    {
+        exact_move( local, depth, task->cell );
+    }
+    else if (ok)
+    {
+        ok = exact_choose( exact, local, depth );
+    }
+    local->tried[depth] = task->after;
+    local->handed[depth] = 0;
+
+    while (ok && !__atomic_load_n( &exact->found, __ATOMIC_ACQUIRE ))
+    {
+        if (++nodes > EXACT_BUDGET)
+        {
+            for (i = task->depth; i <= depth; i++)
+            {
+                if (!local->handed[i])
+                {
+                    exact_hand( exact, local, own, i );
+                }
+            }
+            suspended = 1;
+            break;
+        }
+        piece = local->handed[depth] ? -1 : exact_next( exact, local, depth, local->tried[depth] );
+        if (piece < 0)
+        {
+            /* Nothing left to try here, so back up. */
+
+            if (depth == task->depth)
+            {
+                break;
+            }
+            depth--;
+            exact_undo( exact, local, depth );
+            continue;
+        }
+        local->tried[depth] = piece;
+        (*compared)++;
+
+        /* If there are other candidates to try here and nothing in our
+           deque for an idle thread to steal, hand them over as a task. */
+
+        if ((__atomic_load_n( &own->bottom, __ATOMIC_RELAXED ) <= __atomic_load_n( &own->top, __ATOMIC_RELAXED )) &&
+                (exact_next( exact, local, depth, piece ) >= 0))
+        {
+            exact_hand( exact, local, own, depth );
+        }
+
+        /* A neighbour left with nothing means this piece can't go here. */
+
+        if (!exact_assign( exact, local, depth, piece ))
+        {
+            exact_undo( exact, local, depth );
+            continue;
+        }
+        depth++;
+        if (depth == exact->numcells)
+        {
+            if (!__atomic_exchange_n( &exact->found, 1, __ATOMIC_ACQ_REL ))
+            {
+                for (i = 0; i < exact->numcells; i++)
+                {
+                    exact->solution[i] = exact->pieces[local->chosen[i]];
+                }
+            }
+            break;
+        }
+        /* Nor can it if some other cell is left with nothing, say because
+           this piece was the last it had. */
+
+        if (!exact_choose( exact, local, depth ))
+        {
+            depth--;
+            exact_undo( exact, local, depth );
+            continue;
+        }
+        local->tried[depth] = -1;
+        local->handed[depth] = 0;
+    }
+
+    return suspended;
+}
+
+/* Fill the cells that the sweeps of a puzzle with shared tab pairs left,
+   by searching for pieces that fit them all (see exact_t).  Thread 0 puts
+   the pieces in once they are found. */
+
+void
+fill_exact( fill_t *fill )
+{
+    exact_t *exact = fill->exact;
+    grid_t *grid = fill->grid;
+    exact_local_t local;
+    unsigned int seed = fill->thread_id * 2654435761u + 1;
+    long numcells;
+    long compared = 0;
+    long item;
+    long i;
+    int victim, tries;
+    int oldest = 0;
+    int ok;
+
+    exact_propagate( fill );
+    exact_collect( fill );
+    numcells = exact->numcells;
+    if (numcells == 0)
+    {
+        return;
+    }
+
+    local.cand = (unsigned long long *) malloc( numcells * exact->words * sizeof( unsigned long long ) );
+    local.taken = (unsigned long long *) malloc( exact->words * sizeof( unsigned long long ) );
+    local.seen = (unsigned long long *) malloc( exact->words * sizeof( unsigned long long ) );
+    local.spare = (int *) malloc( (4 * exact->numvalues + 1) * sizeof( int ) );
+    local.offers = (unsigned long long *) malloc( 4 * numcells * sizeof( unsigned long long ) );
+    local.chosen = (int *) malloc( numcells * sizeof( int ) );
+    local.order = (int *) malloc( numcells * sizeof( int ) );
+    local.where = (int *) malloc( numcells * sizeof( int ) );
+    local.tried = (int *) malloc( (numcells + 1) * sizeof( int ) );
+    local.handed = (unsigned char *) malloc( numcells + 1 );
+    ok = (local.cand != NULL) && (local.taken != NULL) && (local.seen != NULL) &&
+        (local.spare != NULL) && (local.offers != NULL) && (local.chosen != NULL) &&
+        (local.order != NULL) && (local.where != NULL) && (local.tried != NULL) && (local.handed != NULL);
+
+    /* A thread without the memory to search leaves it to the others. */
+
+    while (ok && !__atomic_load_n( &exact->found, __ATOMIC_ACQUIRE ) &&
+            (__atomic_load_n( &exact->pending, __ATOMIC_ACQUIRE ) > 0))
+    {
+        item = oldest ? deque_steal( &exact->deques[fill->thread_id] ) : deque_take( &exact->deques[fill->thread_id] );
+        for (tries = 0; (item < 0) && (tries < fill->numThreads); tries++)
+        {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            victim = seed % fill->numThreads;
+            if (victim != fill->thread_id)
+            {
+                item = deque_steal( &exact->deques[victim] );
+            }
+        }
+        if (item < 0)
+        {
+            sched_yield();
+            continue;
+        }
+
+        oldest = exact_run( fill, &local, (exact_task_t *) item, &compared );
+        free( (exact_task_t *) item );
+        __atomic_fetch_sub( &exact->pending, 1, __ATOMIC_ACQ_REL );
+    }
+
+    free( local.cand );
+    free( local.taken );
+    free( local.seen );
+    free( local.spare );
+    free( local.offers );
+    free( local.chosen );
+    free( local.order );
+    free( local.where );
+    free( local.tried );
+    free( local.handed );
+    if (fill->stats != NULL)
+    {
+        fill->stats->pieces_compared += compared;
+    }
+
+    pthread_barrier_wait( fill->barrier );
+
+    if (fill->thread_id != 0)
+    {
+        return;
+    }
+
+    /* Put the pieces in, and throw away the tasks nobody got to. */
+
+    if (exact->found)
+    {
+        for (i = 0; i < numcells; i++)
+        {
+            place_piece( grid, fill->piece_list, (int) (exact->cells[i] % grid->numcols),
+                         (int) (exact->cells[i] / grid->numcols), exact->solution[i] );
+            grid_cell( grid, (int) (exact->cells[i] % grid->numcols),
+                       (int) (exact->cells[i] / grid->numcols) )->state = CELL_FILLED;
+            exact->used[exact->solution[i]] = 1;
+        }
+        fill->frontier->remaining -= numcells;
+        if (fill->stats != NULL)
+        {
+            fill->stats->cells_filled += numcells;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Error no way to fit pieces into the last %ld cells!!!\n", numcells);
+    }
+    for (i = 0; i < fill->numThreads; i++)
+    {
+        while ((item = deque_take( &exact->deques[i] )) >= 0)
+        {
+            free( (exact_task_t *) item );
+        }
+    }
+}
+
+/* Sweep the grid from the corner and in the direction the fill struct
+   gives. */
+
+void
+fill_sweep( fill_t *fill )
+{
+    // Define variables to pass into fill_in_dir
+    piece_list_t *piece_list;
+    grid_t *grid;
+    index_t *index;
+    frontier_t *frontier;
+    exact_t *exact;
+    int i;
+    int start_col;
+    int start_row;
+    int inc_index;
+
+    // Get info to pass into fill_to_dir
+    grid = fill->grid;
+    piece_list = fill->piece_list;
+    start_col = fill->start_col;
+    start_row = fill->start_row;
+    inc_index = fill->inc_index;
+    index = fill->index;
+    frontier = fill->frontier;
+    exact = (fill->exact->used != NULL) ? fill->exact : NULL;
+
+    /* Logic for running each thread and which corner and direction */
+    // Call fill_to_dir based on inc_index and start row
+
+    /* Left to right and right to left */
+    // Top left
+    if (inc_index == GO_LEFT_TO_RIGHT && start_row == 0)
+    {
+        for (i = start_row; (i < grid->numrows) && !frontier_stopped(frontier); i++)
+        {
+            fill_any_dir(grid, piece_list, index, frontier, exact, start_col, i, GO_LEFT_TO_RIGHT, fill->stats);
+        }
+    }
+
+    // Bottom right
+    if (inc_index == GO_RIGHT_TO_LEFT && start_row == grid->numrows - 1)
+    {
+        for (i = start_row; (i >= 0) && !frontier_stopped(frontier); i--)
+        {
+            fill_any_dir(grid, piece_list, index, frontier, exact, start_col, i, GO_RIGHT_TO_LEFT, fill->stats);
+        }
+    }
+
+    //Top right
+    if (inc_index == GO_RIGHT_TO_LEFT && start_row == 0)
+    {
+        for (i = start_row; (i < grid->numrows) && !frontier_stopped(frontier); i++)
+        {
+            fill_any_dir(grid, piece_list, index, frontier, exact, start_col, i, GO_RIGHT_TO_LEFT, fill->stats);
+        }
+    }
+
+    //Bottom left
+    if (inc_index == GO_LEFT_TO_RIGHT && start_row == grid->numrows - 1)
+    {
+        for (i = start_row; (i >= 0) && !frontier_stopped(frontier); i--)
+        {
+            fill_any_dir(grid, piece_list, index, frontier, exact, start_col, i, GO_LEFT_TO_RIGHT, fill->stats);
+        }
+    }
+
+    /* Top to bottom and bottom to top */
+
+    // Top left
+    if (inc_index == GO_TOP_TO_BOTTOM && start_col == 0)
+    {
+        for (i = start_col; (i < grid->numcols) && !frontier_stopped(frontier); i++)
+        {
+            fill_any_dir(grid, piece_list, index, frontier, exact, i, start_row, GO_TOP_TO_BOTTOM, fill->stats);
+        }
+    }
+
+    // Bottom right
+    if (inc_index == GO_BOTTOM_TO_TOP && start_col == grid->numcols - 1)
+    {
+        for (i = start_col; (i >= 0) && !frontier_stopped(frontier); i--)
+        {
+            fill_any_dir(grid, piece_list, index, frontier, exact, i, start_row, GO_BOTTOM_TO_TOP, fill->stats);
+        }
+    }
+
+    //Top right
+    if (inc_index == GO_TOP_TO_BOTTOM && start_col == grid->numcols - 1)
+    {
+        for (i = start_col; (i >= 0) && !frontier_stopped(frontier); i--)
+        {
+            fill_any_dir(grid, piece_list, index, frontier, exact, i, start_row, GO_TOP_TO_BOTTOM, fill->stats);
+        }
+    }
+
+    //Bottom left
+    if (inc_index == GO_BOTTOM_TO_TOP && start_col == 0)
+    {
+        for (i = start_col; (i < grid->numcols) && !frontier_stopped(frontier); i++)
+        {
+            fill_any_dir(grid, piece_list, index, frontier, exact, i, start_row, GO_BOTTOM_TO_TOP, fill->stats);
+        }
+    }
+
+    /* A thread can get to the end of its sweeps while cells are still
+       empty: ones it stepped over as unready, waiting on tabs another thread
+       was about to place, and ones another thread had claimed.  So unless
+       fill_exact is to place the rest, sweep the rows from the top until
+       every cell is in.  Going left to right the north and west tabs of each
+       cell are known when it is reached, so a round only stops short at a
+       row with a cell another thread still has, and the rows below it
+       mostly need that one.  So the round ends there, and the thread gives
+       way to the others before starting the next. */
+    while ((exact == NULL) && !frontier_stopped(frontier))
+    {
+        for (i = 0; (i < grid->numrows) && !frontier_stopped(frontier); i++)
+        {
+            if (fill_any_dir(grid, piece_list, index, frontier, exact, 0, i, GO_LEFT_TO_RIGHT, fill->stats))
+            {
+                break;
+            }
+        }
+        if (!frontier_stopped(frontier))
+        {
+            sched_yield();
+        }
+    }
+}
+
+/* This function is called when a new thread is created, and starts in a position
+   dependent on the fill sturct contents */
+void *puzzleThreadSolver(void *temp)
+{
+    // Set temp to a fill_t struct
+    fill_t *fill = (fill_t *)temp;
+    unsigned long long trace;
+
+    /* With --numa each thread sets up its own band of the grid, so that
+       its pages are on the thread's node; the barriers in loading the
+       pieces keep anyone from using the grid before it is all there. */
+    grid_touch(fill->grid, fill->thread_id, fill->numThreads);
+
+    /* Parse the pieces and build the tab-pair index together before anyone
+       starts solving, unless they are parsed while solving. */
+    if (fill->mode == SOLVE_PIPELINE)
+    {
+        if (!pipeline_start(fill))
+        {
+            return NULL;
+        }
+    }
+    else if (!load_pieces(fill))
+    {
+        return NULL;
+    }
+
+    /* Only now is it known whether any pieces share a pair of tabs.  If
+       they do, no solver mode can take the first piece that fits, so the
+       grid is swept for the cells only one piece can go in and the rest
+       are searched for.  That search doesn't turn pieces. */
+    if (fill->piece_list->rotated && (fill->index->ambiguous > 0))
+    {
+        if (fill->thread_id == 0)
+        {
+            fprintf(stderr, "Error in puzzle input: --rotate can't solve pieces that share tab pairs\n");
+            *fill->input_ok = 0;
+        }
+        return NULL;
+    }
+    if ((fill->mode != SOLVE_PIPELINE) && (fill->index->ambiguous > 0))
+    {
+        if ((fill->thread_id == 0) && !exact_alloc(fill->exact, fill->piece_list, fill->numThreads))
+        {
+            fprintf(stderr, "Not enough memory to search for where the pieces go\n");
+        }
+        pthread_barrier_wait(fill->barrier);
+    }
+
+    if (fill->stats != NULL)
+    {
+        fill->stats->start_ms = now_ms();
+        fill->stats->start_ticks = stats_ticks();
+    }
+    trace = trace_begin();
+
+    if (fill->exact->used != NULL)
+    {
+        fill_sweep(fill);
+        fill_exact(fill);
+    }
+    else if (fill->mode == SOLVE_WAVEFRONT)
+    {
+        fill_wavefront(fill);
+    }
+    else if (fill->mode == SOLVE_DATAFLOW)
+    {
+        fill_dataflow(fill);
+    }
+    else if (fill->mode == SOLVE_PIPELINE)
+    {
+        fill_pipeline(fill);
+        if (pipeline_finish(fill))
+        {
+            fill_sweep(fill);
+            fill_exact(fill);
+        }
+    }
+    else
+    {
+        fill_sweep(fill);
+    }
+
+    trace_end(TRACE_SOLVE, trace, fill->mode, 0, 0);
+    if (fill->stats != NULL)
+    {
+        fill->stats->end_ticks = stats_ticks();
+        fill->stats->end_ms = now_ms();
+    }
+
+    return NULL;
+}
+
+/* Get a puzzle that get_input has read the boundaries of ready to be solved
+   by numThreads threads: make room for the index and whatever the solver
+   mode needs, and set up a fill_t for each thread, with statistics if
+   stats is set.  With rotate set the pieces may have been turned, and are
+   looked up through an index of their tab pairs in every rotation.
+   Returns 0 if there isn't the memory. */
+
+int
+solve_init( solve_t *solve, int numThreads, int mode, int match, int stats, int rotate )
+{
+    grid_t *grid = &solve->grid;
+    fill_t *fills;
+    int wave_block;
+    int i;
+
+    solve->numThreads = numThreads;
+    solve->mode = mode;
+    solve->input_ok = 1;
+    solve->unsolved = 0;
+    solve->fills = (fill_t *) malloc( numThreads * sizeof( fill_t ) );
+    solve->piece_counts = (long *) malloc( numThreads * sizeof( long ) );
+    solve->stats = NULL;
+    if (stats)
+    {
+        solve->stats = (stats_t *) aligned_alloc( sizeof( stats_t ), numThreads * sizeof( stats_t ) );
+    }
+    if ((solve->fills == NULL) || (solve->piece_counts == NULL) || (stats && (solve->stats == NULL)))
+    {
+        fprintf(stderr, "Not enough memory to solve the puzzle\n");
+        free( solve->fills );
+        free( solve->piece_counts );
+        free( solve->stats );
+        return 0;
+    }
+    if (stats)
+    {
+        memset( solve->stats, 0, numThreads * sizeof( stats_t ) );
+    }
+    fills = solve->fills;
+
+    /* Only the index can find a piece whichever way round it is, and a
+       binary puzzle's index only has the pieces the way they came. */
+    solve->piece_list.rotated = rotate;
+    if (rotate && (match != MATCH_INDEX))
+    {
+        fprintf(stderr, "Turned pieces can only be found through the tab-pair index, using it\n");
+        match = MATCH_INDEX;
+    }
+
+    // Use the index that came with a binary puzzle, or make room for
+    // the tab-pair index and let the threads fill it in.  It is built
+    // even when the pieces are found by scanning, since only it can tell
+    // whether any pieces share a pair of tabs; without one every piece
+    // is found by scanning.
+    if (rotate || !index_borrow( &solve->index, &solve->input ))
+    {
+        if (!index_alloc( &solve->index, &solve->piece_list, solve->arena ) && rotate)
+        {
+            fprintf(stderr, "Not enough memory for the index the turned pieces need\n");
+            free( solve->fills );
+            free( solve->piece_counts );
+            free( solve->stats );
+            return 0;
+        }
+    }
+    solve->index.scan = (match != MATCH_INDEX);
+    pthread_barrier_init( &solve->barrier, NULL, numThreads );
+
+    /* Make the wavefront blocks small enough that the longer diagonals
+       have a couple of blocks for every thread, but big enough that a
+       block is worth a trip through the barrier. */
+    wave_block = (grid->numcols < grid->numrows ? grid->numcols : grid->numrows) / (2 * numThreads);
+    if (wave_block < 4) wave_block = 4;
+    if (wave_block > 64) wave_block = 64;
+
+    if ((mode == SOLVE_DATAFLOW) && !dataflow_alloc( &solve->dataflow, grid, numThreads ))
+    {
+        fprintf(stderr, "Not enough memory for the dataflow solver\n");
+        solve->mode = SOLVE_SWEEP;
+    }
+
+    /* The pipelined solver doesn't turn the pieces. */
+    if ((mode == SOLVE_PIPELINE) && rotate)
+    {
+        fprintf(stderr, "The pipelined solver can't turn the pieces, sweeping instead\n");
+        solve->mode = SOLVE_SWEEP;
+    }
+
+    /* Pieces can only be looked up while others are still going in
+       through the index. */
+    if ((solve->mode == SOLVE_PIPELINE) &&
+            ((solve->index.slots == NULL) || solve->index.scan ||
+             !pipeline_alloc( &solve->pipeline, &solve->input, numThreads )))
+    {
+        fprintf(stderr, "The pipelined solver needs the tab-pair index, sweeping instead\n");
+        solve->mode = SOLVE_SWEEP;
+    }
+
+    /* Nor can it tell which of several pieces goes in a cell, which a
+       binary puzzle's index says up front. */
+    if ((solve->mode == SOLVE_PIPELINE) && (solve->index.ambiguous > 0))
+    {
+        fprintf(stderr, "The pipelined solver needs every pair of tabs to be on one piece, sweeping instead\n");
+        pipeline_free( &solve->pipeline );
+        solve->mode = SOLVE_SWEEP;
+    }
+
+    /* The sweeps share how far they have got, whichever mode they fell
+       back from.  Puzzles whose pieces share tab pairs are swept first in
+       every mode. */
+    if (!frontier_alloc( &solve->frontier, grid ))
+    {
+        fprintf(stderr, "Not enough memory to solve the puzzle\n");
+        pthread_barrier_destroy( &solve->barrier );
+        free( solve->fills );
+        free( solve->piece_counts );
+        free( solve->stats );
+        return 0;
+    }
+
+    solve->exact.used = NULL;
+
+    /* Create all of the structs to pass in with the threads */
+    for (i = 0; i < numThreads; i++)
+    {
+        fills[i].grid = grid;
+        fills[i].piece_list = &solve->piece_list;
+        fills[i].index = &solve->index;
+        fills[i].thread_id = i;
+        fills[i].numThreads = numThreads;
+        fills[i].barrier = &solve->barrier;
+        fills[i].input = &solve->input;
+        fills[i].piece_counts = solve->piece_counts;
+        fills[i].input_ok = &solve->input_ok;
+        fills[i].index_done = &solve->index_time;
+        fills[i].unsolved = &solve->unsolved;
+        fills[i].mode = solve->mode;
+        fills[i].wave_block = wave_block;
+        fills[i].frontier = &solve->frontier;
+        fills[i].exact = &solve->exact;
+        fills[i].dataflow = &solve->dataflow;
+        fills[i].pipeline = &solve->pipeline;
+        fills[i].stats = stats ? &solve->stats[i] : NULL;
+
+        // Pick which corner to put the thread in, and to go which direction
+        if (i % 8 == 0) // Top left
+        {
+            fills[i].start_col = 0;
+            fills[i].start_row = 0;
+            fills[i].inc_index = GO_LEFT_TO_RIGHT;
+        }
+        else if (i % 8 == 1) // Bottom right
+        {
+            fills[i].start_col = grid->numcols - 1;
+            fills[i].start_row = grid->numrows - 1;
+            fills[i].inc_index = GO_RIGHT_TO_LEFT;
+        }
+        else if (i % 8 == 2) // Top right
+        {
+            fills[i].start_col = grid->numcols - 1;
+            fills[i].start_row = 0;
+            fills[i].inc_index = GO_RIGHT_TO_LEFT;
+        }
+        else if ( i % 8 == 3) // Bottom left
+        {
+            fills[i].start_col = 0;
+            fills[i].start_row = grid->numrows - 1;
+            fills[i].inc_index = GO_LEFT_TO_RIGHT;
+        }
+        else if ( i % 8 == 4) // Top left top-bottom
+        {
+            fills[i].start_col = 0;
+            fills[i].start_row = 0;
+            fills[i].inc_index = GO_TOP_TO_BOTTOM;
+        }
+        else if ( i % 8 == 5) // Bottom right bottom-top
+        {
+            fills[i].start_col = grid->numcols - 1;
+            fills[i].start_row = grid->numrows - 1;
+            fills[i].inc_index = GO_BOTTOM_TO_TOP;
+        }
+        else if ( i % 8 == 6) // Top right top-bottom
+        {
+            fills[i].start_col = grid->numcols - 1;
+            fills[i].start_row = 0;
+            fills[i].inc_index = GO_TOP_TO_BOTTOM;
+        }
+        else if ( i % 8 == 7) // Bottom left bottom-top
+        {
+            fills[i].start_col = 0;
+            fills[i].start_row = grid->numrows - 1;
+            fills[i].inc_index = GO_BOTTOM_TO_TOP;
+        }
+    }
+
+    return 1;
+}
+
+/* Free everything that get_input and solve_init made room for, other than
+   what came out of the arena. */
+
+void
+solve_free( solve_t *solve )
+{
+    frontier_free( &solve->frontier );
+    if (solve->exact.used != NULL)
+    {
+        exact_free( &solve->exact, solve->numThreads );
+    }
+    if (solve->mode == SOLVE_DATAFLOW)
+    {
+        dataflow_free( &solve->dataflow, solve->numThreads );
+    }
+    if (solve->mode == SOLVE_PIPELINE)
+    {
+        pipeline_free( &solve->pipeline );
+    }
+    pthread_barrier_destroy( &solve->barrier );
+    index_free( &solve->index );
+    release_memory( &solve->grid, &solve->piece_list );
+    free( solve->fills );
+    free( solve->piece_counts );
+    free( solve->stats );
+}
+
+/* Whether every cell of a puzzle got its piece, once the threads are done
+   with it: no thread found a cell that nothing fits, and the sweeps, which
+   only report that through the cells they leave, left none. */
+
+int
+solve_complete( solve_t *solve )
+{
+    if (solve->unsolved)
+    {
+        return 0;
+    }
+    if ((solve->mode == SOLVE_SWEEP) || (solve->exact.used != NULL))
+    {
+        return solve->frontier.remaining == 0;
+    }
+
+    return 1;
+}
+
+/* Print the statistics gathered while solving a puzzle as one line of JSON
+   on stderr: each thread's counters and waits, and their totals.  number
+   is the puzzle's place in a batch, or -1 outside of batch mode. */
+
+void
+solve_print_stats( solve_t *solve, long number )
+{
+    const char *modes[] = { "sweep", "wavefront", "dataflow", "pipeline" };
+    stats_t *stats;
+    stats_t total;
+    double ms_per_tick;
+    double idle_ms;
+    double total_idle_ms = 0.0;
+    int i;
+
+    memset( &total, 0, sizeof( total ) );
+
+    fprintf(stderr, "{");
+    if (number >= 0)
+    {
+        fprintf(stderr, "\"puzzle\": %ld, ", number);
+    }
+    fprintf(stderr, "\"mode\": \"%s\", \"threads\": [", modes[solve->mode]);
+    for (i = 0; i < solve->numThreads; i++)
+    {
+        stats = &solve->stats[i];
+
+        /* Work out how long a tick was from how long the thread ran. */
+
+        ms_per_tick = 0.0;
+        if (stats->end_ticks > stats->start_ticks)
+        {
+            ms_per_tick = (stats->end_ms - stats->start_ms) / (stats->end_ticks - stats->start_ticks);
+        }
+        idle_ms = stats->idle_ticks * ms_per_tick;
+
+        fprintf(stderr, "%s{\"thread\": %d, \"cells_visited\": %ld, \"cells_filled\": %ld, "
+                "\"skipped_solved\": %ld, \"skipped_unready\": %ld, \"pieces_compared\": %ld, "
+                "\"claims_lost\": %ld, \"idle_wait_ms\": %.3f, \"run_ms\": %.3f}",
+                (i > 0) ? ", " : "", i, stats->cells_visited, stats->cells_filled,
+                stats->skipped_solved, stats->skipped_unready, stats->pieces_compared,
+                stats->claims_lost, idle_ms, stats->end_ms - stats->start_ms);
+
+        total.cells_visited += stats->cells_visited;
+        total.cells_filled += stats->cells_filled;
+        total.skipped_solved += stats->skipped_solved;
+        total.skipped_unready += stats->skipped_unready;
+        total.pieces_compared += stats->pieces_compared;
+        total.claims_lost += stats->claims_lost;
+        total_idle_ms += idle_ms;
+    }
+    fprintf(stderr, "], \"total\": {\"cells_visited\": %ld, \"cells_filled\": %ld, "
+            "\"skipped_solved\": %ld, \"skipped_unready\": %ld, \"pieces_compared\": %ld, "
+            "\"claims_lost\": %ld, \"idle_wait_ms\": %.3f}}\n",
+            total.cells_visited, total.cells_filled, total.skipped_solved,
+            total.skipped_unready, total.pieces_compared, total.claims_lost, total_idle_ms);
+}
+
+/* Say which NUMA nodes the pages of the grid, the pieces and the index
+   ended up on, for --affinity and --numa.  A borrowed index is part of the
+   input file and goes wherever the page cache put it. */
+
+void
+solve_print_placement( solve_t *solve )
+{
+    grid_t *grid = &solve->grid;
+    size_t tile_rows = ((size_t) grid->numrows + GRID_TILE) >> GRID_TILE_SHIFT;
+
+    numa_report( "grid", grid->cells,
+                 (tile_rows * grid->tile_cols << (2 * GRID_TILE_SHIFT)) * sizeof( cell_t ) );
+    if (solve->piece_list.tab_space != NULL)
+    {
+        numa_report( "pieces", solve->piece_list.tab_space,
+                     4 * solve->piece_list.numpieces * sizeof( int ) );
+    }
+    if ((solve->index.slots != NULL) && !solve->index.borrowed)
+    {
+        numa_report( "index", solve->index.slots, (solve->index.mask + 1) * sizeof( unsigned int ) );
+    }
+}
@@ -0,0 +1,263 @@
+
+#ifndef SOLVE_H
+#define SOLVE_H
+
+#include <pthread.h>
+
+#include "puzzle.h"
+#include "libpuzzle.h"
+
+/* Ways of sharing the puzzle out between the threads.  The sweep solver has
+   every thread walk rows or columns from one of the corners.  The wavefront
+   solver fills the grid one anti-diagonal of square blocks at a time: once
+   the cells above and to the left of a block are placed, every cell of the
+   block can be filled, so all the blocks on a diagonal go in parallel.
+   These are the modes the library offers (see libpuzzle.h). */
+
+#define SOLVE_SWEEP (PUZZLE_MODE_SWEEP)
+#define SOLVE_WAVEFRONT (PUZZLE_MODE_WAVEFRONT)
+#define SOLVE_DATAFLOW (PUZZLE_MODE_DATAFLOW)
+#define SOLVE_PIPELINE (PUZZLE_MODE_PIPELINE)
+
+/* The dataflow solver only ever touches cells it can fill.  Each cell keeps
+   a mask of which of its tabs are known; filling a cell sets the matching
+   bit in each of its neighbours, and the thread that gives a neighbour its
+   first pair of adjacent known tabs pushes it onto its own work queue.
+   Idle threads steal from the other queues until every cell is placed.
+
+   The queues are Chase-Lev work-stealing deques: the owner pushes and takes
+   at the bottom, thieves steal from the top, and the item array doubles
+   when it fills up.  Old arrays are kept until the deque is destroyed since
+   a thief may still be reading from one. */
+
+#define DEQUE_EMPTY (-1)
+#define DEQUE_ABORT (-2)
+#define DEQUE_INITIAL_SIZE (1024)
+
+#define KNOWN_READY(mask) (((mask) & (((mask) >> 1) | ((mask) << 3)) & 0xf) != 0)
+
+typedef struct deque_array
+{
+    long size;
+    struct deque_array *retired;
+    long items[];
+} deque_array_t;
+
+typedef struct
+{
+    long top __attribute__ ((aligned (64)));
+    long bottom __attribute__ ((aligned (64)));
+    deque_array_t *array;
+} deque_t;
+
+typedef struct
+{
+    unsigned char *known;
+    deque_t *deques;
+    long remaining;
+    int failed;
+} dataflow_t;
+
+/* How far the sweep solver has got.  done[dir][line] is how many cells of a
+   row (for the left to right and right to left sweeps) or of a column (for
+   the top to bottom and bottom to top ones) are known to be filled, counted
+   in from the edge that sweep starts at.  They only ever grow, so a sweep
+   can start past the cells solved from its own edge, stop where the ones
+   solved from the far edge begin, and step over cells that the crossing
+   rows or columns say are done without touching them.  remaining is the
+   number of cells still to be placed; the sweeps go on until it is 0, or
+   until failed says a cell turned up that no piece fits. */
+
+typedef struct
+{
+    int *done[4];
+    long remaining __attribute__ ((aligned (64)));
+    int failed;
+} frontier_t;
+
+/* Solving a puzzle where pieces share pairs of neighbouring tabs.  The
+   sweeps only place a piece when it is the one unused piece that fits
+   everything known around its cell, which has to be right if the puzzle
+   can be solved at all, and mark it used.  That is carried on past the
+   sweeps: every cell next to a newly placed piece is tried again, and
+   once nothing more can be placed that way every empty cell is, until a
+   whole round places nothing (placed counts a round's pieces).  The cells
+   left over are then searched depth first.  Each one starts with a
+   candidate set (start, a bit for each of the numfree pieces still unused,
+   words to a set) of the pieces that fit the tabs known around it; near
+   says which of its neighbours are among the cells left.  Choosing a piece
+   for a cell prunes its neighbours' sets to what fits it, and the search
+   backs up as soon as some cell has no candidate left, so it always goes
+   on with the cell that has the fewest.  tabs has each unused piece's tabs
+   as indexes into values, the distinct tabs in order, and spare counts,
+   for each tab and side, the unused pieces' tabs that still need a match
+   from an empty cell; a tab whose counts on opposite sides differ can't
+   pair up, so the search backs up then too.  twin is the piece alike in
+   every tab just before each one (or -1), which is only tried once that
+   piece is taken.  A task is the cells and pieces
+   chosen at the first depth steps, with the cell to decide next (or -1 to
+   pick it) and the candidate to carry on after; a thread whose deque has
+   run dry gets handed the untried candidates of the cell being decided,
+   and idle threads steal, as in the dataflow solver, and a thread that
+   has spent its budget on one task hands all of it back.  pending counts the
+   tasks not yet finished and found is set by the thread that fits the last
+   cell, which leaves the pieces in solution. */
+
+typedef struct
+{
+    int depth;
+    int cell;
+    int after;
+    int moves[];
+} exact_task_t;
+
+typedef struct
+{
+    unsigned char *used;
+    long *cells;
+    int *near;
+    int *pieces;
+    unsigned long long *start;
+    int *twin;
+    int *tabs;
+    int *values;
+    int *spare;
+    int *solution;
+    long numcells;
+    long numfree;
+    long words;
+    int numvalues;
+    deque_t *deques;
+    long placed __attribute__ ((aligned (64)));
+    long pending __attribute__ ((aligned (64)));
+    int found __attribute__ ((aligned (64)));
+} exact_t;
+
+/* The pipelined solver starts solving while the pieces are still being
+   parsed.  The piece section is cut into blocks of about PIPELINE_BLOCK_LEN
+   bytes at line boundaries, and the threads only count the pieces in each
+   block before they start, which tells them the number of every block's
+   first piece.  They then take rows in order, each following the row above
+   it a cell behind.  A thread that can't find a cell's piece yet, or is
+   waiting for the row above, parses the next block and enters its pieces
+   in the index; once every block is taken it parks until another block is
+   published.  Pieces mostly come in row order, so the top rows are solved
+   while the bottom ones are still being read.  If two pieces turn out to
+   share a pair of tabs, the first piece found may be wrong, so solving
+   stops and the puzzle is solved exactly once every block is in.
+
+   next_block counts the blocks taken and blocks_done the blocks published;
+   blocks_done only changes under the lock, so a parked thread can't miss
+   one. */
+
+#define PIPELINE_BLOCK_LEN (256 << 10)
+
+typedef struct
+{
+    size_t *starts;
+    size_t *ends;
+    long *firsts;
+    int numblocks;
+    int next_block __attribute__ ((aligned (64)));
+    int next_row __attribute__ ((aligned (64)));
+    int blocks_done __attribute__ ((aligned (64)));
+    int failed;
+    pthread_mutex_t lock;
+    pthread_cond_t published;
+} pipeline_t;
+
+/* What each thread did while solving, gathered with --stats.  The solver
+   loops count in local variables and add them in here once a row, block or
+   cell is done, and time their waits only when there is somewhere to put
+   them, so without --stats the only cost is a few register increments.
+   Each thread's counters have a cache line to themselves.  Waits are timed
+   in ticks of stats_ticks; the thread's start and end times in both ticks
+   and milliseconds say how long a tick is. */
+typedef struct
+{
+    long cells_visited;
+    long cells_filled;
+    long skipped_solved;
+    long skipped_unready;
+    long pieces_compared;
+    long claims_lost;
+    unsigned long long idle_ticks;
+    unsigned long long start_ticks;
+    unsigned long long end_ticks;
+    double start_ms;
+    double end_ms;
+} __attribute__ ((aligned (64))) stats_t;
+
+/* Create a sturct for all of the fill_any_dir arguments to pass into threads */
+typedef struct
+{
+    grid_t *grid;
+    piece_list_t *piece_list;
+    index_t *index;
+    int start_col;
+    int start_row;
+    int inc_index;
+
+    /* Shared by all threads so that they can parse the pieces and build the
+       index together. */
+    int thread_id;
+    int numThreads;
+    pthread_barrier_t *barrier;
+    input_t *input;
+    long *piece_counts;
+    int *input_ok;
+    double *index_done;
+
+    /* Set by any thread that finds a cell no piece fits. */
+    int *unsolved;
+
+    int mode;
+    int wave_block;
+    frontier_t *frontier;
+    exact_t *exact;
+    dataflow_t *dataflow;
+    pipeline_t *pipeline;
+
+    /* This thread's statistics, or NULL without --stats. */
+    stats_t *stats;
+} fill_t;
+
+/* Everything it takes to solve one puzzle with some number of threads: the
+   puzzle, the state the threads share while they solve it, and one fill_t
+   for each thread.  The input is a view of just this puzzle, which may be
+   one of many in the same stream.  The grid, pieces and index come out of
+   the arena, which belongs to whoever is solving and outlives the puzzle. */
+typedef struct
+{
+    arena_t *arena;
+    input_t input;
+    grid_t grid;
+    piece_list_t piece_list;
+    index_t index;
+    frontier_t frontier;
+    exact_t exact;
+    dataflow_t dataflow;
+    pipeline_t pipeline;
+    pthread_barrier_t barrier;
+    fill_t *fills;
+    long *piece_counts;
+    stats_t *stats;
+    int numThreads;
+    int mode;
+    int input_ok;
+    int unsolved;
+    double start_time;
+    double index_time;
+    double end_time;
+} solve_t;
+
+/* solve.c */
+
+void *puzzleThreadSolver( void *temp );
+int solve_init( solve_t *solve, int numThreads, int mode, int match, int stats, int rotate );
+void solve_free( solve_t *solve );
+int solve_complete( solve_t *solve );
+void solve_print_stats( solve_t *solve, long number );
+void solve_print_placement( solve_t *solve );
+
+#endif
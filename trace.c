@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "puzzle.h"
+
+/* The timeline written by --trace.  Each thread that records anything gets
+   a ring of events the first time it does, found again through a thread
+   local pointer, and pushes the ring onto a list with a compare and swap.
+   Only its own thread ever writes to a ring, so nothing is locked, and the
+   rings are only read once the threads that wrote them have finished.  A
+   ring keeps the newest TRACE_RING_LEN events, counting the ones it lets
+   go.  The events are written as Chrome trace-event JSON, which Perfetto
+   and chrome://tracing can open: complete events for spans and instant
+   events for instants, with times in microseconds from trace_open. */
+
+#define TRACE_NAME_LEN (32)
+
+typedef struct
+{
+    unsigned long long start;
+    unsigned long long end;
+    int what;
+    int args[3];
+} trace_event_t;
+
+typedef struct trace_ring
+{
+    struct trace_ring *next;
+    int tid;
+    char name[TRACE_NAME_LEN];
+    unsigned long count;
+    trace_event_t events[TRACE_RING_LEN];
+} trace_ring_t;
+
+/* What each kind of event is called, what category it is in, and what its
+   numbers are (NULL for numbers it doesn't have). */
+
+typedef struct
+{
+    const char *name;
+    const char *cat;
+    const char *args[3];
+} trace_kind_t;
+
+static const trace_kind_t kinds[] =
+{
+    { "read", "input", { NULL, NULL, NULL } },
+    { "parse", "input", { "puzzle", NULL, NULL } },
+    { "index build", "input", { "pieces", NULL, NULL } },
+    { "solve", "solve", { "mode", NULL, NULL } },
+    { "sweep left to right", "solve", { "row", "filled", "claims_lost" } },
+    { "sweep top to bottom", "solve", { "column", "filled", "claims_lost" } },
+    { "sweep right to left", "solve", { "row", "filled", "claims_lost" } },
+    { "sweep bottom to top", "solve", { "column", "filled", "claims_lost" } },
+    { "block", "solve", { "column", "row", "filled" } },
+    { "idle", "wait", { NULL, NULL, NULL } },
+    { "claim lost", "wait", { "column", "row", NULL } },
+    { "format", "print", { "first_row", "rows", NULL } },
+    { "write", "print", { "bytes", NULL, NULL } },
+};
+
+int trace_on = 0;
+
+static FILE *trace_file = NULL;
+static unsigned long long trace_origin;
+static trace_ring_t *rings = NULL;
+static int numrings = 0;
+static __thread trace_ring_t *own = NULL;
+
+/* Nanoseconds on the monotonic clock, never 0. */
+
+unsigned long long
+trace_clock( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec + 1;
+}
+
+/* This thread's ring, made the first time it is wanted.  Returns NULL if
+   there isn't the memory, and nothing is recorded for the thread. */
+
+static trace_ring_t *
+trace_ring( void )
+{
+    trace_ring_t *ring = own;
+
+    if (ring == NULL)
+    {
+        ring = (trace_ring_t *) malloc( sizeof( trace_ring_t ) );
+        if (ring == NULL)
+        {
+            return NULL;
+        }
+        ring->tid = __atomic_add_fetch( &numrings, 1, __ATOMIC_RELAXED );
+        snprintf( ring->name, TRACE_NAME_LEN, "thread %d", ring->tid );
+        ring->count = 0;
+        ring->next = __atomic_load_n( &rings, __ATOMIC_RELAXED );
+        while (!__atomic_compare_exchange_n( &rings, &ring->next, ring, 1,
+                                             __ATOMIC_RELEASE, __ATOMIC_RELAXED ))
+        {
+        }
+        own = ring;
+    }
+
+    return ring;
+}
+
+/* Start recording, to be written to path by trace_close.  The calling
+   thread is named main.  Returns 0 if the file can't be made. */
+
+int
+trace_open( const char *path )
+{
+    trace_file = fopen( path, "w" );
+    if (trace_file == NULL)
+    {
+        perror( path );
+        return 0;
+    }
+    trace_origin = trace_clock();
+    trace_on = 1;
+    trace_thread( "main", -1 );
+
+    return 1;
+}
+
+/* Name the calling thread on the timeline, with its number if it has one. */
+
+void
+trace_thread( const char *role, int number )
+{
+    trace_ring_t *ring;
+
+    if (!trace_on || ((ring = trace_ring()) == NULL))
+    {
+        return;
+    }
+    if (number < 0)
+    {
+        snprintf( ring->name, TRACE_NAME_LEN, "%s", role );
+    }
+    else
+    {
+        snprintf( ring->name, TRACE_NAME_LEN, "%s %d", role, number );
+    }
+}
+
+void
+trace_record( int what, unsigned long long start, unsigned long long end, int a, int b, int c )
+{
+    trace_ring_t *ring = trace_ring();
+    trace_event_t *event;
+
+    if (ring == NULL)
+    {
+        return;
+    }
+    event = &ring->events[ring->count & (TRACE_RING_LEN - 1)];
+    event->start = start;
+    event->end = end;
+    event->what = what;
+    event->args[0] = a;
+    event->args[1] = b;
+    event->args[2] = c;
+    ring->count++;
+}
+
+/* Microseconds since trace_open, as Chrome trace events have them. */
+
+static double
+trace_us( unsigned long long ns )
+{
+    return (ns < trace_origin) ? 0.0 : (ns - trace_origin) / 1000.0;
+}
+
+static void
+trace_event( FILE *out, trace_ring_t *ring, trace_event_t *event, int *first )
+{
+    const trace_kind_t *kind = &kinds[event->what];
+    int i, any = 0;
+
+    fprintf( out, "%s\n{\"name\": \"%s\", \"cat\": \"%s\", ", *first ? "" : ",", kind->name,
+             kind->cat );
+    if (event->start == event->end)
+    {
+        fprintf( out, "\"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, ", trace_us( event->start ) );
+    }
+    else
+    {
+        fprintf( out, "\"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, ", trace_us( event->start ),
+                 (event->end - event->start) / 1000.0 );
+    }
+    fprintf( out, "\"pid\": 1, \"tid\": %d, \"args\": {", ring->tid );
+    for (i = 0; i < 3; i++)
+    {
+        if (kind->args[i] != NULL)
+        {
+            fprintf( out, "%s\"%s\": %d", any ? ", " : "", kind->args[i], event->args[i] );
+            any = 1;
+        }
+    }
+    fprintf( out, "}}" );
+    *first = 0;
+}
+
+/* Stop recording and write out every thread's events, oldest first, and
+   free the rings.  Every thread that recorded anything but the caller
+   must have finished.  Returns 0 if the file couldn't be written. */
+
+int
+trace_close( void )
+{
+    trace_ring_t *ring;
+    trace_ring_t *next;
+    unsigned long i, kept;
+    unsigned long dropped = 0;
+    int first = 1;
+    int ok;
+
+    if (trace_file == NULL)
+    {
+        return 1;
+    }
+    trace_on = 0;
+
+    fprintf( trace_file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" );
+    for (ring = __atomic_load_n( &rings, __ATOMIC_ACQUIRE ); ring != NULL; ring = ring->next)
+    {
+        fprintf( trace_file, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                 "\"tid\": %d, \"args\": {\"name\": \"%s\"}}", first ? "" : ",", ring->tid,
+                 ring->name );
+        fprintf( trace_file, ",\n{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, "
+                 "\"tid\": %d, \"args\": {\"sort_index\": %d}}", ring->tid, ring->tid );
+        first = 0;
+
+        kept = (ring->count < TRACE_RING_LEN) ? ring->count : TRACE_RING_LEN;
+        dropped += ring->count - kept;
+        for (i = ring->count - kept; i < ring->count; i++)
+        {
+            trace_event( trace_file, ring, &ring->events[i & (TRACE_RING_LEN - 1)], &first );
+        }
+    }
+    fprintf( trace_file, "\n],\n\"otherData\": {\"dropped_events\": %lu}}\n", dropped );
+
+    ok = !ferror( trace_file );
+    if (fclose( trace_file ) != 0)
+    {
+        ok = 0;
+    }
+    trace_file = NULL;
+    if (!ok)
+    {
+        perror( "Error writing the trace" );
+    }
+    if (dropped > 0)
+    {
+        fprintf( stderr, "The trace only kept the last %d events of each thread\n",
+                 TRACE_RING_LEN );
+    }
+
+    for (ring = rings; ring != NULL; ring = next)
+    {
+        next = ring->next;
+        free( ring );
+    }
+    rings = NULL;
+    own = NULL;
+
+    return ok;
+}
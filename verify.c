@@ -0,0 +1,604 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "puzzle.h"
+
+/* Check a proposed solution to a puzzle:
+
+     ./verify [--threads=n] [--compact] puzzle solution
+
+   The solution is what the puzzle program prints: a line for every row of
+   the grid with the names of its pieces separated by spaces, or with
+   --compact the pieces' numbers, each followed by a slash and its number of
+   quarter turns if the pieces were solved with --rotate.  Every piece has
+   to be used exactly once, and every tab, turned with its piece, has to
+   match the tab of the piece next to it or the boundary.  Either file can
+   be "-" for stdin, and the puzzle can be in the binary format.
+
+   The threads share out the work in phases, meeting at a barrier between
+   them: parse the pieces, enter their names in a hash table and count the
+   solution's rows, place the pieces of their share of the rows, then check
+   the tabs of those rows.  The first thing found wrong stops them all.
+   Exits with status 0 if the solution is right, 1 if it is wrong (saying
+   what is wrong on stderr), and 2 if a file can't be read. */
+
+#define NAME_EMPTY (0xffffffffu)
+
+#define VERIFY_OK (0)
+#define VERIFY_WRONG (1)
+#define VERIFY_UNREADABLE (2)
+
+typedef struct
+{
+    input_t puzzle;
+    input_t solution;
+    grid_t grid;
+    piece_list_t piece_list;
+    int compact;
+    int numThreads;
+    pthread_barrier_t barrier;
+
+    /* Piece numbers hashed by name. */
+    unsigned int *names;
+    size_t name_mask;
+
+    /* The piece in each cell as placed (see PLACED), in row order, and
+       which pieces are placed. */
+    int *placed;
+    unsigned char *used;
+
+    long *piece_counts;
+    long *row_counts;
+    int status;
+    char message[256];
+} verify_t;
+
+typedef struct
+{
+    verify_t *verify;
+    int thread_id;
+} verify_thread_t;
+
+/* Note what is wrong, unless another thread got there first. */
+
+static void
+fail( verify_t *verify, int status, const char *format, ... )
+{
+    int expected = VERIFY_OK;
+    va_list args;
+
+    if (__atomic_compare_exchange_n( &verify->status, &expected, status, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ))
+    {
+        va_start( args, format );
+        vsnprintf( verify->message, sizeof( verify->message ), format, args );
+        va_end( args );
+    }
+}
+
+static int
+failed( verify_t *verify )
+{
+    return __atomic_load_n( &verify->status, __ATOMIC_ACQUIRE ) != VERIFY_OK;
+}
+
+/* FNV-1a over the len bytes of a name. */
+
+static size_t
+name_hash( const char *name, size_t len )
+{
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        hash = (hash ^ (unsigned char) name[i]) * 0x100000001b3ULL;
+    }
+
+    return (size_t) hash;
+}
+
+/* Is the name of piece the len bytes at name? */
+
+static int
+name_is( piece_list_t *piece_list, long piece, const char *name, size_t len )
+{
+    const char *other = piece_name( piece_list, piece );
+
+    return (strnlen( other, piece_list->name_stride ) == len) && (memcmp( other, name, len ) == 0);
+}
+
+/* Enter a piece in the name table.  Threads insert at the same time,
+   claiming slots with a compare and swap. */
+
+static void
+name_insert( verify_t *verify, long piece )
+{
+    const char *name = piece_name( &verify->piece_list, piece );
+    size_t len = strnlen( name, verify->piece_list.name_stride );
+    size_t slot = name_hash( name, len ) & verify->name_mask;
+    unsigned int expected = NAME_EMPTY;
+
+    while (!__atomic_compare_exchange_n( &verify->names[slot], &expected, (unsigned int) piece, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ))
+    {
+        if (name_is( &verify->piece_list, expected, name, len ))
+        {
+            fail( verify, VERIFY_UNREADABLE, "Pieces %u and %ld are both called %.*s, so the "
+                  "solution can't be checked by name", expected, piece, (int) len, name );
+            return;
+        }
+        slot = (slot + 1) & verify->name_mask;
+        expected = NAME_EMPTY;
+    }
+}
+
+static long
+name_find( verify_t *verify, const char *name, size_t len )
+{
+    size_t slot = name_hash( name, len ) & verify->name_mask;
+    unsigned int piece;
+
+    while ((piece = verify->names[slot]) != NAME_EMPTY)
+    {
+        if (name_is( &verify->piece_list, piece, name, len ))
+        {
+            return piece;
+        }
+        slot = (slot + 1) & verify->name_mask;
+    }
+
+    return NO_PIECE_INDEX;
+}
+
+/* Parse this thread's share of the pieces, the same way the puzzle program
+   does (see load_pieces). */
+
+static void
+verify_pieces( verify_t *verify, int thread_id )
+{
+    input_t chunk = verify->puzzle;
+    index_t no_index = { NULL, 0, 0, 0 };
+    long numpieces = verify->piece_list.numpieces;
+    size_t start, end;
+    long first = 0, total = 0;
+    int i;
+
+    if (verify->puzzle.binary != NULL)
+    {
+        if (!copy_binary_pieces( &verify->puzzle, &verify->piece_list,
+                                 numpieces * thread_id / verify->numThreads,
+                                 numpieces * (thread_id + 1) / verify->numThreads, &no_index ))
+        {
+            fail( verify, VERIFY_UNREADABLE, "The binary puzzle's pieces can't be read" );
+        }
+        pthread_barrier_wait( &verify->barrier );
+        return;
+    }
+
+    input_chunk( &verify->puzzle, thread_id, verify->numThreads, &start, &end );
+    verify->piece_counts[thread_id] = count_piece_lines( chunk.data, start, end );
+
+    pthread_barrier_wait( &verify->barrier );
+
+    for (i = 0; i < verify->numThreads; i++)
+    {
+        if (i < thread_id)
+        {
+            first += verify->piece_counts[i];
+        }
+        total += verify->piece_counts[i];
+    }
+
+    if (total < numpieces)
+    {
+        fail( verify, VERIFY_UNREADABLE, "Error in puzzle input: expected %ld pieces but found %ld",
+              numpieces, total );
+    }
+    else
+    {
+        chunk.pos = start;
+        if (parse_pieces( &chunk, end, &verify->piece_list, first, NULL ) < 0)
+        {
+            fail( verify, VERIFY_UNREADABLE, "The puzzle's pieces can't be read" );
+        }
+    }
+
+    pthread_barrier_wait( &verify->barrier );
+}
+
+/* Place the pieces named on one row of the solution, from start up to
+   line_end. */
+
+static void
+verify_row( verify_t *verify, int row, size_t start, size_t line_end )
+{
+    const char *data = verify->solution.data;
+    grid_t *grid = &verify->grid;
+    size_t token;
+    size_t stem;
+    long piece;
+    int turn;
+    int col = 0;
+
+    while (start < line_end)
+    {
+        if ((data[start] == ' ') || (data[start] == '\t') || (data[start] == '\r'))
+        {
+            start++;
+            continue;
+        }
+
+        token = start;
+        while ((start < line_end) && (data[start] != ' ') && (data[start] != '\t') &&
+                (data[start] != '\r'))
+        {
+            start++;
+        }
+
+        if (col >= grid->numcols)
+        {
+            fail( verify, VERIFY_WRONG, "Row %d has more than %d pieces", row, grid->numcols );
+            return;
+        }
+
+        /* A turned piece ends in /t, which a name may have as well. */
+
+        stem = start;
+        turn = 0;
+        if ((start - token > 2) && (data[start - 2] == '/') && (data[start - 1] >= '0') &&
+                (data[start - 1] <= '3'))
+        {
+            stem = start - 2;
+            turn = data[start - 1] - '0';
+        }
+
+        if (verify->compact)
+        {
+            piece = 0;
+            while ((token < stem) && (data[token] >= '0') && (data[token] <= '9') &&
+                    (piece <= verify->piece_list.numpieces))
+            {
+                piece = piece * 10 + (data[token++] - '0');
+            }
+            if ((token < stem) || (piece >= verify->piece_list.numpieces))
+            {
+                piece = NO_PIECE_INDEX;
+            }
+        }
+        else
+        {
+            piece = name_find( verify, data + token, start - token );
+            if ((piece != NO_PIECE_INDEX) || (stem == start))
+            {
+                turn = 0;
+            }
+            else
+            {
+                piece = name_find( verify, data + token, stem - token );
+            }
+        }
+
+        if (piece == NO_PIECE_INDEX)
+        {
+            if ((start - token == 1) && (data[token] == '.'))
+            {
+                fail( verify, VERIFY_WRONG, "Row %d, column %d isn't filled in", row, col );
+            }
+            else
+            {
+                fail( verify, VERIFY_WRONG, "Row %d, column %d has a piece that isn't in the "
+                      "puzzle", row, col );
+            }
+            return;
+        }
+        if (__atomic_exchange_n( &verify->used[piece], 1, __ATOMIC_RELAXED ))
+        {
+            fail( verify, VERIFY_WRONG, "Row %d, column %d has piece %s, which is used twice",
+                  row, col, piece_name( &verify->piece_list, piece ) );
+            return;
+        }
+
+        verify->placed[(long) row * grid->numcols + col] = PLACED( piece, turn );
+        col++;
+    }
+
+    if (col < grid->numcols)
+    {
+        fail( verify, VERIFY_WRONG, "Row %d has only %d of its %d pieces", row, col, grid->numcols );
+    }
+}
+
+/* Check the tabs of a placed piece against its north and west neighbours,
+   and against the boundary if it is on the south or east edge. */
+
+static void
+verify_cell( verify_t *verify, int col, int row )
+{
+    grid_t *grid = &verify->grid;
+    piece_list_t *piece_list = &verify->piece_list;
+    long cell = (long) row * grid->numcols + col;
+    int placed = verify->placed[cell];
+    long piece = PLACED_PIECE( placed );
+    int north, west;
+
+    north = (row == 0) ? grid_cell( grid, col, 0 )->north :
+            placed_tab( piece_list, verify->placed[cell - grid->numcols], SOUTH_TAB );
+    west = (col == 0) ? grid_cell( grid, 0, row )->west :
+           placed_tab( piece_list, verify->placed[cell - 1], EAST_TAB );
+
+    if (placed_tab( piece_list, placed, NORTH_TAB ) != north)
+    {
+        fail( verify, VERIFY_WRONG, "Row %d, column %d: the north tab of %s is %d but should be %d",
+              row, col, piece_name( piece_list, piece ), placed_tab( piece_list, placed, NORTH_TAB ),
+              north );
+    }
+    else if (placed_tab( piece_list, placed, WEST_TAB ) != west)
+    {
+        fail( verify, VERIFY_WRONG, "Row %d, column %d: the west tab of %s is %d but should be %d",
+              row, col, piece_name( piece_list, piece ), placed_tab( piece_list, placed, WEST_TAB ),
+              west );
+    }
+    else if ((row == grid->numrows - 1) &&
+             (placed_tab( piece_list, placed, SOUTH_TAB ) != grid_cell( grid, col, grid->numrows )->north))
+    {
+        fail( verify, VERIFY_WRONG, "Row %d, column %d: the south tab of %s doesn't match the "
+              "bottom boundary", row, col, piece_name( piece_list, piece ) );
+    }
+    else if ((col == grid->numcols - 1) &&
+             (placed_tab( piece_list, placed, EAST_TAB ) != grid_cell( grid, grid->numcols, row )->west))
+    {
+        fail( verify, VERIFY_WRONG, "Row %d, column %d: the east tab of %s doesn't match the "
+              "right boundary", row, col, piece_name( piece_list, piece ) );
+    }
+}
+
+static void *
+verify_thread( void *temp )
+{
+    verify_thread_t *self = (verify_thread_t *) temp;
+    verify_t *verify = self->verify;
+    int thread_id = self->thread_id;
+    long numpieces = verify->piece_list.numpieces;
+    const char *data = verify->solution.data;
+    const char *newline;
+    size_t start, end, line_end;
+    long first_row = 0, total_rows = 0;
+    long piece;
+    int row, rows, col;
+    int i;
+
+    verify_pieces( verify, thread_id );
+    if (failed( verify ))
+    {
+        return NULL;
+    }
+
+    /* Name the pieces and count the rows of the solution. */
+
+    if (!verify->compact)
+    {
+        for (piece = numpieces * thread_id / verify->numThreads;
+                piece < numpieces * (thread_id + 1) / verify->numThreads; piece++)
+        {
+            name_insert( verify, piece );
+        }
+    }
+    input_chunk( &verify->solution, thread_id, verify->numThreads, &start, &end );
+    verify->row_counts[thread_id] = count_piece_lines( data, start, end );
+
+    pthread_barrier_wait( &verify->barrier );
+    if (failed( verify ))
+    {
+        return NULL;
+    }
+
+    for (i = 0; i < verify->numThreads; i++)
+    {
+        if (i < thread_id)
+        {
+            first_row += verify->row_counts[i];
+        }
+        total_rows += verify->row_counts[i];
+    }
+    if (total_rows != verify->grid.numrows)
+    {
+        fail( verify, VERIFY_WRONG, "The solution has %ld rows but the puzzle has %d",
+              total_rows, verify->grid.numrows );
+        return NULL;
+    }
+
+    /* Place the pieces of this thread's rows. */
+
+    row = first_row;
+    while ((start < end) && !failed( verify ))
+    {
+        newline = (const char *) memchr( data + start, '\n', end - start );
+        line_end = (newline == NULL) ? end : (size_t) (newline - data);
+        if (count_piece_lines( data, start, line_end ) > 0)
+        {
+            verify_row( verify, row, start, line_end );
+            row++;
+        }
+        start = line_end + 1;
+    }
+    rows = row - first_row;
+
+    pthread_barrier_wait( &verify->barrier );
+    if (failed( verify ))
+    {
+        return NULL;
+    }
+
+    /* Check the tabs of the same rows, now that every cell is placed. */
+
+    for (row = first_row; (row < first_row + rows) && !failed( verify ); row++)
+    {
+        for (col = 0; col < verify->grid.numcols; col++)
+        {
+            verify_cell( verify, col, row );
+        }
+    }
+
+    return NULL;
+}
+
+/* Read a whole file, or stdin for "-".  Returns 0 if it can't be read. */
+
+static int
+read_file( input_t *input, const char *path )
+{
+    int fd = (strcmp( path, "-" ) == 0) ? 0 : open( path, O_RDONLY );
+    int ok;
+
+    if (fd < 0)
+    {
+        perror( path );
+        return 0;
+    }
+    ok = input_read( input, fd );
+    if (fd != 0)
+    {
+        close( fd );
+    }
+
+    return ok;
+}
+
+int
+main( int argc, char **argv )
+{
+    verify_t verify;
+    arena_t arena;
+    const char *paths[2];
+    int numpaths = 0;
+    size_t capacity;
+    long numcells;
+    int arg;
+    int i;
+
+    memset( &verify, 0, sizeof( verify ) );
+    verify.numThreads = sysconf( _SC_NPROCESSORS_ONLN );
+    if (verify.numThreads < 1)
+    {
+        verify.numThreads = 1;
+    }
+
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (strncmp( argv[arg], "--threads=", 10 ) == 0)
+        {
+            verify.numThreads = atoi( argv[arg] + 10 );
+            if (verify.numThreads < 1)
+            {
+                printf( "The number of threads must be at least 1\n" );
+                return VERIFY_UNREADABLE;
+            }
+        }
+        else if (strcmp( argv[arg], "--compact" ) == 0)
+        {
+            verify.compact = 1;
+        }
+        else if (numpaths < 2)
+        {
+            paths[numpaths++] = argv[arg];
+        }
+        else
+        {
+            numpaths++;
+        }
+    }
+
+    if (numpaths != 2)
+    {
+        printf( "usage: %s [--threads=n] [--compact] puzzle solution\n", argv[0] );
+        return VERIFY_UNREADABLE;
+    }
+
+    if (!read_file( &verify.puzzle, paths[0] ))
+    {
+        return VERIFY_UNREADABLE;
+    }
+    if (!read_file( &verify.solution, paths[1] ))
+    {
+        input_close( &verify.puzzle );
+        return VERIFY_UNREADABLE;
+    }
+
+    arena_init( &arena, ARENA_HUGE_THRESHOLD );
+    if (!get_input( &verify.puzzle, &verify.grid, &verify.piece_list, &arena ))
+    {
+        arena_free( &arena );
+        input_close( &verify.solution );
+        input_close( &verify.puzzle );
+        return VERIFY_UNREADABLE;
+    }
+    verify.puzzle.end = find_pieces_end( &verify.puzzle, verify.piece_list.numpieces );
+
+    /* The name table is kept at most half full. */
+
+    numcells = (long) verify.grid.numcols * verify.grid.numrows;
+    for (capacity = 1; capacity < 2 * (size_t) verify.piece_list.numpieces; capacity <<= 1)
+    {
+    }
+    verify.name_mask = capacity - 1;
+    verify.names = (unsigned int *) malloc( capacity * sizeof( unsigned int ) );
+    verify.placed = (int *) malloc( numcells * sizeof( int ) );
+    verify.used = (unsigned char *) calloc( verify.piece_list.numpieces, 1 );
+    verify.piece_counts = (long *) malloc( verify.numThreads * sizeof( long ) );
+    verify.row_counts = (long *) malloc( verify.numThreads * sizeof( long ) );
+    pthread_t threads[verify.numThreads];
+    verify_thread_t selves[verify.numThreads];
+
+    if ((verify.names == NULL) || (verify.placed == NULL) || (verify.used == NULL) ||
+            (verify.piece_counts == NULL) || (verify.row_counts == NULL))
+    {
+        fail( &verify, VERIFY_UNREADABLE, "Not enough memory to check the solution" );
+    }
+    else
+    {
+        memset( verify.names, 0xff, capacity * sizeof( unsigned int ) );
+        pthread_barrier_init( &verify.barrier, NULL, verify.numThreads );
+        for (i = 0; i < verify.numThreads; i++)
+        {
+            selves[i].verify = &verify;
+            selves[i].thread_id = i;
+            if (pthread_create( &threads[i], NULL, verify_thread, &selves[i] ))
+            {
+                fprintf( stderr, "Error creating thread\n" );
+                exit( VERIFY_UNREADABLE );
+            }
+        }
+        for (i = 0; i < verify.numThreads; i++)
+        {
+            pthread_join( threads[i], NULL );
+        }
+        pthread_barrier_destroy( &verify.barrier );
+    }
+
+    if (verify.status == VERIFY_OK)
+    {
+        printf( "The solution is right: all %ld pieces fit\n", verify.piece_list.numpieces );
+    }
+    else
+    {
+        fprintf( stderr, "%s\n", verify.message );
+    }
+
+    free( verify.names );
+    free( verify.placed );
+    free( verify.used );
+    free( verify.piece_counts );
+    free( verify.row_counts );
+    release_memory( &verify.grid, &verify.piece_list );
+    arena_free( &arena );
+    input_close( &verify.solution );
+    input_close( &verify.puzzle );
+
+    return verify.status;
+}
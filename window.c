@@ -0,0 +1,423 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "puzzle.h"
+
+/* The out-of-core solver, for puzzles too big to hold in memory.  It works
+   on a binary puzzle file with an index, and leaves everything in the file:
+   the boundaries, tabs and names are read where they lie in the mapping and
+   pieces are found through the file's own index, so the operating system
+   pages in only what is used and can drop it again.  Of the grid, only a
+   window of a few rows is kept, as a ring of rows in a grid_t of its own,
+   so memory grows with the number of columns and not with the area.
+
+   Every row is filled left to right from its north and west tabs.  The
+   threads take rows in order, so that the rows being filled are a pipeline:
+   each thread follows the row above it cell by cell, waiting for a cell to
+   be filled before it uses the south tab it left in the row below.  Before
+   filling a row, a thread sets up the next row of the ring, which is where
+   its south tabs go; that row has to have been written out first, and so
+   does the row after it, which reads it as the row above.  The main thread
+   writes the rows out in order as they are finished. */
+
+typedef struct
+{
+    input_t *input;
+    const binfmt_header_t *header;
+    const unsigned char *boundaries;
+    const unsigned char *tabs;
+    index_t index;
+    grid_t window;
+    piece_list_t piece_list;
+    int window_rows;
+
+    /* Which row of the puzzle each row of the ring holds, once it is set
+       up for it. */
+    int *holds;
+
+    int next_row __attribute__ ((aligned (64)));
+    int written __attribute__ ((aligned (64)));
+    int failed;
+} window_t;
+
+/* Tab k of a piece, or boundary tab i. */
+
+static inline int
+window_tab( window_t *window, int k, long piece )
+{
+    return binfmt_tab( window->tabs + k * window->header->tab_stride, window->header->tab_width,
+                       piece );
+}
+
+static inline int
+window_boundary( window_t *window, uint64_t i )
+{
+    return binfmt_tab( window->boundaries, window->header->tab_width, i );
+}
+
+/* Wait until the rows before row have been written.  Returns 0 if the
+   solve has failed instead. */
+
+static int
+window_wait_written( window_t *window, int row )
+{
+    while (__atomic_load_n( &window->written, __ATOMIC_ACQUIRE ) < row)
+    {
+        if (__atomic_load_n( &window->failed, __ATOMIC_RELAXED ))
+        {
+            return 0;
+        }
+        sched_yield();
+    }
+
+    return 1;
+}
+
+/* Wait until a row of the ring has been set up for row of the puzzle, so
+   that what is in it isn't left over from an earlier row.  Returns 0 if the
+   solve has failed instead. */
+
+static int
+window_wait_holds( window_t *window, int slot, int row )
+{
+    while (__atomic_load_n( &window->holds[slot], __ATOMIC_ACQUIRE ) != row)
+    {
+        if (__atomic_load_n( &window->failed, __ATOMIC_RELAXED ))
+        {
+            return 0;
+        }
+        sched_yield();
+    }
+
+    return 1;
+}
+
+/* Wait until a cell is filled.  Returns 0 if the solve has failed instead. */
+
+static int
+window_wait_filled( window_t *window, cell_t *cell )
+{
+    while (__atomic_load_n( &cell->state, __ATOMIC_ACQUIRE ) != CELL_FILLED)
+    {
+        if (__atomic_load_n( &window->failed, __ATOMIC_RELAXED ))
+        {
+            return 0;
+        }
+        sched_yield();
+    }
+
+    return 1;
+}
+
+/* Make a row of the ring ready for row of the puzzle, whose north tabs are
+   still to come from the row above.  The puzzle row can be numrows, for the
+   south tabs of the bottom row. */
+
+static void
+window_clear_row( window_t *window, int slot, int row )
+{
+    grid_t *grid = &window->window;
+    uint64_t cols = window->header->cols;
+    uint64_t rows = window->header->rows;
+    cell_t *cell;
+    int col;
+
+    for (col = 0; col < grid->numcols; col++)
+    {
+        cell = grid_cell( grid, col, slot );
+        cell->north = NO_PIECE_INDEX;
+        cell->west = NO_PIECE_INDEX;
+        cell->piece = NO_PIECE_INDEX;
+        cell->state = CELL_EMPTY;
+    }
+    if ((uint64_t) row < rows)
+    {
+        grid_cell( grid, 0, slot )->west = window_boundary( window, 2 * cols + row );
+        grid_cell( grid, grid->numcols, slot )->west = window_boundary( window, 2 * cols + rows + row );
+    }
+    __atomic_store_n( &window->holds[slot], row, __ATOMIC_RELEASE );
+}
+
+static void *
+window_thread( void *temp )
+{
+    window_t *window = (window_t *) temp;
+    grid_t *grid = &window->window;
+    int numrows = window->header->rows;
+    int row, slot, next, above;
+    int col;
+    int found;
+    cell_t *cell;
+
+    while (!__atomic_load_n( &window->failed, __ATOMIC_RELAXED ))
+    {
+        row = __atomic_fetch_add( &window->next_row, 1, __ATOMIC_RELAXED );
+        if (row >= numrows)
+        {
+            break;
+        }
+        slot = row % window->window_rows;
+        next = (row + 1) % window->window_rows;
+        above = (row + window->window_rows - 1) % window->window_rows;
+
+        /* The next row of the ring last held row + 1 - window_rows, which
+           has to be written out, and the row after it has to be done with
+           it. */
+
+        if (!window_wait_written( window, row + 3 - window->window_rows ))
+        {
+            break;
+        }
+        window_clear_row( window, next, row + 1 );
+        if ((row > 0) && !window_wait_holds( window, above, row - 1 ))
+        {
+            break;
+        }
+
+        for (col = 0; col < grid->numcols; col++)
+        {
+            if ((row > 0) && !window_wait_filled( window, grid_cell( grid, col, above ) ))
+            {
+                break;
+            }
+
+            cell = grid_cell( grid, col, slot );
+            found = index_find_binary( &window->index, window->header, PAIR_WN,
+                                       LOAD_TAB( cell->west ), LOAD_TAB( cell->north ) );
+            if (found == NO_PIECE_INDEX)
+            {
+                if (!__atomic_exchange_n( &window->failed, 1, __ATOMIC_RELAXED ))
+                {
+                    fprintf( stderr, "Error piece not found for row %d, column %d\n", row, col );
+                }
+                return NULL;
+            }
+
+            cell->piece = found;
+            STORE_TAB( grid_cell( grid, col + 1, slot )->west, window_tab( window, EAST_TAB, found ) );
+            STORE_TAB( grid_cell( grid, col, next )->north, window_tab( window, SOUTH_TAB, found ) );
+            __atomic_store_n( &cell->state, CELL_FILLED, __ATOMIC_RELEASE );
+        }
+    }
+
+    return NULL;
+}
+
+/* Write the rows out in order as the threads finish them.  Returns 0 if
+   the solve failed or the solution couldn't be written. */
+
+static int
+window_write( window_t *window, int fd, int compact )
+{
+    grid_t *grid = &window->window;
+    size_t row_len = (size_t) grid->numcols * (LABEL_LEN + 1) + 1;
+    struct iovec iov;
+    char *buffer;
+    size_t used = 0;
+    int row, slot;
+    int ok = 1;
+
+    buffer = (char *) malloc( PRINT_BUFFER_LEN + row_len );
+    if (buffer == NULL)
+    {
+        fprintf( stderr, "Not enough memory to print the solution\n" );
+        __atomic_store_n( &window->failed, 1, __ATOMIC_RELAXED );
+        return 0;
+    }
+
+    for (row = 0; ok && (row < (int) window->header->rows); row++)
+    {
+        slot = row % window->window_rows;
+        if (!window_wait_holds( window, slot, row ) ||
+                !window_wait_filled( window, grid_cell( grid, grid->numcols - 1, slot ) ))
+        {
+            ok = 0;
+            break;
+        }
+
+        used += format_rows( grid, &window->piece_list, compact, slot, slot + 1, buffer + used );
+        if ((used >= PRINT_BUFFER_LEN) || (row == (int) window->header->rows - 1))
+        {
+            iov.iov_base = buffer;
+            iov.iov_len = used;
+            ok = write_all( fd, &iov, 1 );
+            used = 0;
+        }
+
+        __atomic_store_n( &window->written, row + 1, __ATOMIC_RELEASE );
+    }
+
+    if (!ok)
+    {
+        __atomic_store_n( &window->failed, 1, __ATOMIC_RELAXED );
+    }
+    free( buffer );
+
+    return ok;
+}
+
+/* Solve the binary puzzle on stdin out of core with numThreads threads,
+   keeping window_rows rows of the grid in memory (or the default for 0),
+   and print the solution as it goes. */
+
+int
+window_main( int numThreads, int window_rows, int compact, size_t huge_threshold )
+{
+    pthread_t threads[numThreads];
+    window_t window;
+    input_t input;
+    arena_t arena;
+    struct stat info;
+    const binfmt_header_t *header;
+    const char *problem = NULL;
+    grid_t *grid = &window.window;
+    size_t numcells;
+    double start_time, end_time;
+    long i;
+    int col;
+    int return_value = 0;
+
+    if ((fstat( 0, &info ) != 0) || !S_ISREG( info.st_mode ))
+    {
+        fprintf( stderr, "The out-of-core solver needs a binary puzzle file on stdin\n" );
+        return 1;
+    }
+    if (!input_read( &input, 0 ))
+    {
+        return 1;
+    }
+
+    header = (const binfmt_header_t *) input.data;
+    problem = binfmt_check( header, input.length );
+    if ((problem == NULL) && ((header->cols > INT_MAX - 1) || (header->rows > INT_MAX - 1) ||
+                              (header->numpieces >= (uint64_t) MAX_PIECES)))
+    {
+        problem = "binary puzzle is too big";
+    }
+    if ((problem == NULL) && (header->name_width > LABEL_LEN + 1))
+    {
+        problem = "binary puzzle piece names are too long";
+    }
+    input.binary = (problem == NULL) ? header : NULL;
+    if ((problem == NULL) && !index_borrow( &window.index, &input ))
+    {
+        problem = "the out-of-core solver needs a binary puzzle with an index "
+                  "(see convert --index)";
+    }
+    if ((problem == NULL) && window.index.ambiguous)
+    {
+        problem = "the out-of-core solver needs every pair of tabs to be on one piece";
+    }
+    if (problem != NULL)
+    {
+        fprintf( stderr, "Error in puzzle input: %s\n", problem );
+        input_close( &input );
+        return 1;
+    }
+
+    /* The pieces are looked up all over the file. */
+
+    madvise( input.data, input.length, MADV_RANDOM );
+
+    if (window_rows == 0)
+    {
+        window_rows = WINDOW_ROWS_PER_THREAD * numThreads;
+    }
+    if (window_rows < WINDOW_MIN_ROWS)
+    {
+        window_rows = WINDOW_MIN_ROWS;
+    }
+
+    window.input = &input;
+    window.header = header;
+    window.boundaries = (const unsigned char *) input.data + header->boundary_offset;
+    window.tabs = (const unsigned char *) input.data + header->tabs_offset;
+    window.window_rows = window_rows;
+    window.next_row = 0;
+    window.written = 0;
+    window.failed = 0;
+
+    /* The names are only needed for printing. */
+
+    window.piece_list.names = input.data + header->names_offset;
+    window.piece_list.name_stride = header->name_width;
+    window.piece_list.numpieces = header->numpieces;
+    window.piece_list.tab_space = NULL;
+    window.piece_list.name_space = NULL;
+    window.piece_list.rotated = 0;
+    for (i = NORTH_TAB; i <= WEST_TAB; i++)
+    {
+        window.piece_list.tab[i] = NULL;
+    }
+
+    /* The ring of rows is a grid of window_rows rows laid out in tiles
+       like any other, with the right boundary alongside. */
+
+    grid->numcols = header->cols;
+    grid->numrows = window_rows;
+    grid->tile_cols = ((size_t) grid->numcols + GRID_TILE) >> GRID_TILE_SHIFT;
+    numcells = grid->tile_cols * ((((size_t) window_rows + GRID_TILE) >> GRID_TILE_SHIFT)
+                                  << (2 * GRID_TILE_SHIFT));
+    arena_init( &arena, huge_threshold );
+    if (!arena_reserve( &arena, numcells * sizeof( cell_t ) + window_rows * sizeof( int ) +
+                         2 * ARENA_ALIGN ))
+    {
+        fprintf( stderr, "Not enough memory for %d rows of %d pieces\n", window_rows, grid->numcols );
+        arena_free( &arena );
+        input_close( &input );
+        return 1;
+    }
+    grid->cells = (cell_t *) arena_alloc( &arena, numcells * sizeof( cell_t ) );
+    window.holds = (int *) arena_alloc( &arena, window_rows * sizeof( int ) );
+    for (i = 0; i < window_rows; i++)
+    {
+        window.holds[i] = -1;
+    }
+
+    window_clear_row( &window, 0, 0 );
+    for (col = 0; col < grid->numcols; col++)
+    {
+        grid_cell( grid, col, 0 )->north = window_boundary( &window, col );
+    }
+
+    start_time = now_ms();
+    for (i = 0; i < numThreads; i++)
+    {
+        if (pthread_create( &threads[i], NULL, window_thread, &window ))
+        {
+            fprintf( stderr, "Error creating thread\n" );
+            __atomic_store_n( &window.failed, 1, __ATOMIC_RELAXED );
+            numThreads = i;
+            break;
+        }
+    }
+
+    if (!window_write( &window, 1, compact ))
+    {
+        return_value = 1;
+    }
+
+    for (i = 0; i < numThreads; i++)
+    {
+        pthread_join( threads[i], NULL );
+    }
+    end_time = now_ms();
+
+    if (return_value == 0)
+    {
+        fprintf( stderr, "solve time: %.3f ms\n", end_time - start_time );
+    }
+
+    arena_free( &arena );
+    input_close( &input );
+
+    return return_value;
+}